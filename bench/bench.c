@@ -0,0 +1,223 @@
+/*
+ * Author: Luka Perkov <luka.perkov@sartura.hr>
+ *
+ * Copyright (C) 2014, QA Cafe, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * For more information see the project website [1].
+ *
+ * [1] https://www.cloudshark.org/
+ */
+
+/*
+ * What the benchmarks share: the global and uci entry points cshark.c and
+ * config.c would provide, the config a fresh install loads, and synthetic
+ * traffic to capture.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <pcap.h>
+
+#include "bench.h"
+#include "config.h"
+#include "cshark.h"
+
+struct cshark cshark;
+
+/* nothing is read from or written to uci while benchmarking */
+int config_load(void)
+{
+	return 0;
+}
+
+int config_save_url(char *url)
+{
+	return 0;
+}
+
+/* what config_load() leaves behind for an empty config, except where noted */
+void bench_config(void)
+{
+	config_defaults();
+
+	snprintf(config.url, sizeof(config.url), "http://127.0.0.1:8080");
+	snprintf(config.token, sizeof(config.token), "bench");
+	snprintf(config.spool_dir, sizeof(config.spool_dir), "%s/spool", config.dir);
+
+	/* cshark-server has a self-signed certificate at best, and no stats file is written */
+	config.ca_verify = false;
+	config.stats_interval = 0;
+}
+
+double bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* a positive number and nothing else, anything that would leave a bench without an end fails */
+int bench_count(const char *opt, const char *arg, uint64_t *v)
+{
+	char *end;
+
+	errno = 0;
+	*v = strtoull(arg, &end, 10);
+	if (errno || end == arg || *end || !*v || arg[0] == '-') {
+		fprintf(stderr, "%s: %s needs a positive number, not '%s'\n",
+			program_invocation_short_name, opt, arg);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* size:weight pairs spelled out packet by packet, so sizes can cycle through them */
+int bench_mix(const char *mix, unsigned int *pattern, unsigned int max)
+{
+	unsigned int size, weight, nr = 0, i;
+	const char *p;
+	int len;
+
+	for (p = mix; *p; p += len) {
+		if (sscanf(p, "%u:%u%n", &size, &weight, &len) != 2 || size > BENCH_FRAME_MAX) {
+			fprintf(stderr, "%s: could not parse size mix at '%s'\n", program_invocation_short_name, p);
+			return -1;
+		}
+		if (p[len] == ',')
+			len++;
+
+		/* below the headers there is nothing to send */
+		if (size < BENCH_FRAME_MIN)
+			size = BENCH_FRAME_MIN;
+
+		for (i = 0; i < weight && nr < max; i++)
+			pattern[nr++] = size;
+	}
+
+	if (!nr) {
+		fprintf(stderr, "%s: empty size mix\n", program_invocation_short_name);
+		return -1;
+	}
+
+	return nr;
+}
+
+/* headers of packet n of a flow, whatever is in pkt after them is the payload */
+void bench_frame(u_char *pkt, unsigned int size, uint64_t n, unsigned int flow)
+{
+	/* ethernet */
+	memcpy(pkt, "\x02\x00\x00\x00\x00\x01\x02\x00\x00\x00\x00\x02\x08\x00", 14);
+
+	/* ipv4, the id keeps the duplicate filter from matching */
+	pkt[14] = 0x45;
+	pkt[15] = 0;
+	pkt[16] = (size - 14) >> 8;
+	pkt[17] = (size - 14) & 0xff;
+	pkt[18] = n >> 8;
+	pkt[19] = n & 0xff;
+	pkt[20] = pkt[21] = 0;
+	pkt[22] = 64;
+	pkt[23] = 17;
+	pkt[24] = pkt[25] = 0;
+	memcpy(pkt + 26, "\x0a\x00", 2);
+	pkt[28] = flow >> 8;
+	pkt[29] = flow & 0xff;
+	memcpy(pkt + 30, "\x0a\x01\x00\x01", 4);
+
+	/* udp */
+	pkt[34] = (1024 + flow) >> 8;
+	pkt[35] = (1024 + flow) & 0xff;
+	pkt[36] = 0x13;
+	pkt[37] = 0x89;
+	pkt[38] = (size - 34) >> 8;
+	pkt[39] = (size - 34) & 0xff;
+	pkt[40] = pkt[41] = 0;
+}
+
+/*
+ * Spread over a number of flows, with sizes cycling through the mix. Writing
+ * stops after packets or once bytes are written, 0 leaves out one of the two
+ * limits but not both.
+ */
+int bench_traffic(const char *filename, const char *mix, uint64_t packets, uint64_t bytes,
+		  unsigned int flows)
+{
+	unsigned int pattern[BENCH_MIX_MAX];
+	struct pcap_pkthdr hdr;
+	pcap_dumper_t *d;
+	u_char pkt[BENCH_FRAME_MAX];
+	uint64_t n, written = 0;
+	unsigned int i;
+	pcap_t *dead;
+	int nr;
+
+	/* without either limit the file would grow until the disk is full */
+	if (!packets && !bytes) {
+		fprintf(stderr, "%s: synthetic traffic needs a packet or byte count\n",
+			program_invocation_short_name);
+		return -1;
+	}
+
+	nr = bench_mix(mix, pattern, BENCH_MIX_MAX);
+	if (nr < 0 || !flows)
+		return -1;
+
+	dead = pcap_open_dead(DLT_EN10MB, 65535);
+	d = dead ? pcap_dump_open(dead, filename) : NULL;
+	if (!d) {
+		fprintf(stderr, "%s: could not create '%s'\n", program_invocation_short_name, filename);
+		if (dead)
+			pcap_close(dead);
+		return -1;
+	}
+
+	for (i = 0; i < sizeof(pkt); i++)
+		pkt[i] = random();
+
+	memset(&hdr, 0, sizeof(hdr));
+
+	for (n = 0; (!packets || n < packets) && (!bytes || written < bytes); n++) {
+		hdr.caplen = hdr.len = pattern[n % nr];
+		hdr.ts.tv_sec = n / 1000000;
+		hdr.ts.tv_usec = n % 1000000;
+
+		bench_frame(pkt, hdr.caplen, n, n % flows);
+		pcap_dump((u_char *) d, &hdr, pkt);
+		written += hdr.caplen;
+	}
+
+	pcap_dump_close(d);
+	pcap_close(dead);
+
+	return 0;
+}
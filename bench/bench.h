@@ -0,0 +1,54 @@
+/*
+ * Author: Luka Perkov <luka.perkov@sartura.hr>
+ *
+ * Copyright (C) 2014, QA Cafe, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * For more information see the project website [1].
+ *
+ * [1] https://www.cloudshark.org/
+ */
+
+#ifndef __CSHARK_BENCH_H__
+#define __CSHARK_BENCH_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/* size:weight pairs, the usual simple IMIX */
+#define BENCH_MIX "64:7,576:4,1500:1"
+/* packets of the mix spelled out, weights add up to at most this */
+#define BENCH_MIX_MAX 1024
+
+/* Ethernet, IPv4 and UDP headers up to a jumbo frame */
+#define BENCH_FRAME_MIN 42
+#define BENCH_FRAME_MAX 9000
+
+void bench_config(void);
+double bench_now(void);
+int bench_count(const char *opt, const char *arg, uint64_t *v);
+int bench_mix(const char *mix, unsigned int *pattern, unsigned int max);
+void bench_frame(u_char *pkt, unsigned int size, uint64_t n, unsigned int flow);
+int bench_traffic(const char *filename, const char *mix, uint64_t packets, uint64_t bytes,
+		  unsigned int flows);
+
+#endif /* __CSHARK_BENCH_H__ */
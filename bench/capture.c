@@ -0,0 +1,356 @@
+/*
+ * Author: Luka Perkov <luka.perkov@sartura.hr>
+ *
+ * Copyright (C) 2014, QA Cafe, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * For more information see the project website [1].
+ *
+ * [1] https://www.cloudshark.org/
+ */
+
+/*
+ * Replays a capture file, or synthetic traffic written to one first, through
+ * the packet handler and writer of a live capture as fast as they take it.
+ * Every run prints one line of key=value pairs with packets and bytes per
+ * second, cpu cycles per packet and the allocations cshark made per packet.
+ * Allocations are counted by wrapping malloc() at link time, see the
+ * cshark-bench target, so only the ones made by cshark itself show up.
+ */
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include <pcap.h>
+
+#include "bench.h"
+#include "config.h"
+#include "cshark.h"
+#include "dedup.h"
+#include "flow.h"
+#include "pcap.h"
+#include "session.h"
+
+#define BENCH_NAME "cshark-bench"
+
+static uint64_t allocs;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void *__wrap_malloc(size_t size);
+void *__wrap_calloc(size_t nmemb, size_t size);
+void *__wrap_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+	__atomic_add_fetch(&allocs, 1, __ATOMIC_RELAXED);
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+	__atomic_add_fetch(&allocs, 1, __ATOMIC_RELAXED);
+	return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+	__atomic_add_fetch(&allocs, 1, __ATOMIC_RELAXED);
+	return __real_realloc(ptr, size);
+}
+
+/* cycles of this process and the threads it starts, -1 where there is no counter */
+static int bench_cycles_open(void)
+{
+	struct perf_event_attr pe;
+
+	memset(&pe, 0, sizeof(pe));
+	pe.type = PERF_TYPE_HARDWARE;
+	pe.size = sizeof(pe);
+	pe.config = PERF_COUNT_HW_CPU_CYCLES;
+	pe.disabled = 1;
+	pe.inherit = 1;
+	pe.exclude_hv = 1;
+
+	return syscall(__NR_perf_event_open, &pe, 0, -1, -1, 0);
+}
+
+static uint64_t bench_cycles_read(int fd)
+{
+	uint64_t cycles = 0;
+
+	if (fd < 0 || read(fd, &cycles, sizeof(cycles)) != sizeof(cycles))
+		return 0;
+
+	return cycles;
+}
+
+/* one pass over the file, from the first packet to the writer closing the capture */
+static int bench_run(struct cshark *cs, const char *input)
+{
+	char e[PCAP_ERRBUF_SIZE];
+	uint64_t cycles, allocs_start;
+	double start, elapsed;
+	int fd, rc;
+	pcap_t *p;
+
+	p = pcap_open_offline_with_tstamp_precision(input, PCAP_TSTAMP_PRECISION_NANO, e);
+	if (!p) {
+		fprintf(stderr, "%s: %s\n", BENCH_NAME, e);
+		return -1;
+	}
+
+	cs->packets = cs->caplen = 0;
+	cs->reserved_packets = cs->reserved_caplen = 0;
+
+	if (cs->dedup_window && cshark_dedup_init(cs))
+		goto error;
+	if ((cs->flow_packets || cs->flow_bytes || cs->flow_sample > 1) && cshark_flow_init(cs))
+		goto error;
+	if (cshark_pcap_attach(cs, p))
+		goto error;
+
+	fd = bench_cycles_open();
+	if (fd >= 0) {
+		ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+		ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+	}
+	allocs_start = allocs;
+	start = bench_now();
+
+	rc = pcap_dispatch(p, -1, cshark_pcap_manage_packet, (u_char *) cs);
+	if (rc >= 0)
+		rc = cshark_writer_flush(&cs->writer);
+	cshark_pcap_done(cs);
+
+	elapsed = bench_now() - start;
+	if (fd >= 0)
+		ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+	cycles = bench_cycles_read(fd);
+	if (fd >= 0)
+		close(fd);
+
+	cshark_dedup_done(cs);
+	cshark_flow_done(cs);
+
+	if (rc < 0 || !cs->packets) {
+		fprintf(stderr, "%s: replay failed\n", BENCH_NAME);
+		return -1;
+	}
+
+	printf("capture writer=%s format=%s compress=%s packets=%lu bytes=%lu seconds=%.3f pps=%.0f mbit_s=%.2f",
+		cs->writer_ops->name, cs->format == CSHARK_FORMAT_PCAPNG ? "pcapng" : "pcap",
+		cs->compress_ops ? cs->compress_ops->name : "none",
+		(long unsigned int) cs->packets, (long unsigned int) cs->caplen, elapsed,
+		elapsed > 0 ? cs->packets / elapsed : 0, elapsed > 0 ? cs->caplen * 8 / elapsed / 1e6 : 0);
+	if (cycles)
+		printf(" cycles_pkt=%.0f", (double) cycles / cs->packets);
+	else
+		printf(" cycles_pkt=na");
+	printf(" allocs_pkt=%.4f\n", (double) (allocs - allocs_start) / cs->packets);
+	fflush(stdout);
+
+	return 0;
+
+error:
+	cshark_dedup_done(cs);
+	cshark_flow_done(cs);
+	if (cs->p == p)
+		cshark_pcap_done(cs);
+	else
+		pcap_close(p);
+
+	return -1;
+}
+
+static void bench_usage(void)
+{
+	printf("usage: %s [-r file] [-c packets] [-S mix] [-F flows] [-w file] [-W writer] [-f format] [-z compress] [-Z level] [-x] [-m ms] [-P packets] [-n runs]\n\n%s",
+		BENCH_NAME, \
+		"  -r  capture file to replay, synthetic traffic if not given\n" \
+		"  -c  packets of synthetic traffic, 1000000 by default\n" \
+		"  -S  synthetic packet sizes as size:weight pairs, " BENCH_MIX " by default\n" \
+		"  -F  flows the synthetic traffic is spread over, 1024 by default\n" \
+		"  -w  capture file to write, a temporary file if not given\n" \
+		"  -W  capture file writer, 'writev', 'mmap' or 'io_uring'\n" \
+		"  -f  capture file format, 'pcap' or 'pcapng'\n" \
+		"  -z  compress the capture, 'none', 'gzip' or 'zstd'\n" \
+		"  -Z  compression level, use 0 for the default\n" \
+		"  -x  slice packets by protocol\n" \
+		"  -m  drop duplicate packets seen within this many milliseconds\n" \
+		"  -P  keep this many packets of every flow\n" \
+		"  -n  runs, 3 by default\n" \
+		"  -h  shows this help\n");
+}
+
+int main(int argc, char *argv[])
+{
+	char synthetic[] = "/tmp/cshark-bench-in-XXXXXX";
+	char output[] = "/tmp/cshark-bench-out-XXXXXX";
+	const char *input = NULL;
+	const char *mix = BENCH_MIX;
+	uint64_t packets = 1000000;
+	unsigned int flows = 1024, runs = 3, run;
+	uint64_t v;
+	struct cshark_options o;
+	struct stat st;
+	int c, fd, rc = EXIT_FAILURE;
+	bool temp_in = false, temp_out = false;
+
+	memset(&cshark, 0, sizeof(cshark));
+	memset(&o, 0, sizeof(o));
+	bench_config();
+
+	cshark.interface = "any";
+	cshark.snaplen = 65535;
+
+	openlog(BENCH_NAME, LOG_PERROR | LOG_PID, LOG_USER);
+
+	while ((c = getopt(argc, argv, "r:c:S:F:w:W:f:z:Z:xm:P:n:h")) != -1) {
+		switch (c) {
+			case 'r':
+				input = optarg;
+				break;
+
+			case 'c':
+				if (bench_count("-c", optarg, &packets))
+					return EXIT_FAILURE;
+				break;
+
+			case 'S':
+				mix = optarg;
+				break;
+
+			case 'F':
+				if (bench_count("-F", optarg, &v))
+					return EXIT_FAILURE;
+				/* the flow goes into 16 bits of the source address */
+				if (v > UINT16_MAX) {
+					fprintf(stderr, "%s: at most %u flows\n", BENCH_NAME, UINT16_MAX);
+					return EXIT_FAILURE;
+				}
+				flows = v;
+				break;
+
+			case 'w':
+				cshark.filename = strdup(optarg);
+				break;
+
+			case 'W':
+				o.writer = optarg;
+				break;
+
+			case 'f':
+				o.format = optarg;
+				break;
+
+			case 'z':
+				o.compress = optarg;
+				break;
+
+			case 'Z':
+				cshark.compress_level = atoi(optarg);
+				break;
+
+			case 'x':
+				cshark.slice = true;
+				break;
+
+			case 'm':
+				cshark.dedup_window = atoi(optarg);
+				break;
+
+			case 'P':
+				cshark.flow_packets = atoi(optarg);
+				break;
+
+			case 'n':
+				if (bench_count("-n", optarg, &v))
+					return EXIT_FAILURE;
+				runs = v;
+				break;
+
+			default:
+				bench_usage();
+				return EXIT_FAILURE;
+		}
+	}
+
+	if (!input) {
+		fd = mkstemp(synthetic);
+		if (fd < 0) {
+			fprintf(stderr, "%s: could not create '%s'\n", BENCH_NAME, synthetic);
+			goto exit;
+		}
+		close(fd);
+		temp_in = true;
+
+		if (bench_traffic(synthetic, mix, packets, 0, flows))
+			goto exit;
+		input = synthetic;
+	}
+
+	if (!cshark.filename) {
+		fd = mkstemp(output);
+		if (fd < 0) {
+			fprintf(stderr, "%s: could not create '%s'\n", BENCH_NAME, output);
+			goto exit;
+		}
+		close(fd);
+		temp_out = true;
+		cshark.filename = strdup(output);
+	}
+
+	if (!cshark.filename || cshark_session_setup(&cshark, &o))
+		goto exit;
+
+	/* room for the capture and the pcapng overhead, rather than all free space */
+	if (!stat(input, &st))
+		cshark.disk_budget = 2 * st.st_size + 1024 * 1024;
+
+	for (run = 0; run < runs; run++)
+		if (bench_run(&cshark, input))
+			goto exit;
+
+	rc = EXIT_SUCCESS;
+
+exit:
+	if (temp_in)
+		remove(synthetic);
+	if (temp_out)
+		remove(output);
+	free(cshark.filename);
+
+	return rc;
+}
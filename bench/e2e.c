@@ -0,0 +1,258 @@
+/*
+ * Author: Luka Perkov <luka.perkov@sartura.hr>
+ *
+ * Copyright (C) 2014, QA Cafe, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * For more information see the project website [1].
+ *
+ * [1] https://www.cloudshark.org/
+ */
+
+/*
+ * Captures synthetic traffic of a range of sizes and uploads it to
+ * cshark-server, or any other server taking the CloudShark upload API, the
+ * way cshark does once capturing stops. Every run happens in a child of its
+ * own so peak RSS is that of one capture, and prints one line of key=value
+ * pairs: time from stop until the URL is known, upload throughput and peak
+ * RSS.
+ */
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <pcap.h>
+
+#include <libubox/uloop.h>
+
+#include "bench.h"
+#include "config.h"
+#include "cshark.h"
+#include "pcap.h"
+#include "session.h"
+
+#define BENCH_NAME "cshark-e2e-bench"
+
+/* capture, stop and upload in this process, the result goes to out */
+static int bench_run(FILE *out, const char *input, const struct cshark_options *o, uint64_t size)
+{
+	char e[PCAP_ERRBUF_SIZE];
+	double start, stopped, done;
+	uint64_t capture_size = 0;
+	struct rusage ru;
+	struct stat st;
+	pcap_t *p;
+	bool ok;
+
+	memset(&cshark, 0, sizeof(cshark));
+	cshark.interface = "any";
+	cshark.snaplen = 65535;
+
+	if (cshark_session_setup(&cshark, o))
+		return -1;
+
+	uloop_init();
+
+	p = pcap_open_offline_with_tstamp_precision(input, PCAP_TSTAMP_PRECISION_NANO, e);
+	if (!p) {
+		fprintf(stderr, "%s: %s\n", BENCH_NAME, e);
+		goto error;
+	}
+
+	cshark.state = CSHARK_STATE_CAPTURING;
+	if (cshark_pcap_attach(&cshark, p))
+		goto error;
+
+	/* the whole capture happens before the clock starts */
+	if (pcap_dispatch(p, -1, cshark_pcap_manage_packet, (u_char *) &cshark) < 0 ||
+	    cshark_writer_flush(&cshark.writer))
+		goto error;
+
+	start = bench_now();
+	if (cshark_session_stop(&cshark))
+		goto error;
+	stopped = bench_now();
+
+	if (!stat(cshark.filename, &st))
+		capture_size = st.st_size;
+
+	uloop_run();
+	done = bench_now();
+
+	ok = !cshark.upload_failed && cshark.upload_url[0];
+	getrusage(RUSAGE_SELF, &ru);
+
+	fprintf(out, "e2e size=%lu capture_bytes=%lu stop_ms=%.1f url_ms=%.1f mbit_s=%.2f rss_kib=%ld ok=%d\n",
+		(long unsigned int) size, (long unsigned int) capture_size,
+		(stopped - start) * 1000, (done - start) * 1000,
+		done > stopped ? capture_size * 8 / (done - stopped) / 1e6 : 0, ru.ru_maxrss, ok);
+	fflush(out);
+
+	cshark_session_finish(&cshark, ok);
+	uloop_done();
+
+	return ok ? 0 : -1;
+
+error:
+	cshark_session_finish(&cshark, false);
+	uloop_done();
+
+	return -1;
+}
+
+static void bench_usage(void)
+{
+	printf("usage: %s [-u url] [-s sizes] [-S mix] [-W writer] [-f format] [-z compress] [-j connections] [-n runs]\n\n%s",
+		BENCH_NAME, \
+		"  -u  server to upload to, http://127.0.0.1:8080 by default\n" \
+		"  -s  comma separated list of capture sizes in MiB, 1,16,64,256 by default\n" \
+		"  -S  packet sizes as size:weight pairs, " BENCH_MIX " by default\n" \
+		"  -W  capture file writer, 'writev', 'mmap' or 'io_uring'\n" \
+		"  -f  capture file format, 'pcap' or 'pcapng'\n" \
+		"  -z  compress the capture, 'none', 'gzip' or 'zstd'\n" \
+		"  -j  parallel connections for the upload, 1 by default\n" \
+		"  -n  runs for every size, 3 by default\n" \
+		"  -h  shows this help\n");
+}
+
+int main(int argc, char *argv[])
+{
+	char input[] = "/tmp/cshark-e2e-bench-XXXXXX";
+	const char *url = "http://127.0.0.1:8080";
+	const char *mix = BENCH_MIX;
+	char *sizes = "1,16,64,256";
+	unsigned int runs = 3, run;
+	char *list, *tok, *save;
+	struct cshark_options o;
+	uint64_t size;
+	int c, fd, status, rc = EXIT_FAILURE;
+	FILE *out;
+	pid_t pid;
+
+	memset(&o, 0, sizeof(o));
+	bench_config();
+
+	while ((c = getopt(argc, argv, "u:s:S:W:f:z:j:n:h")) != -1) {
+		switch (c) {
+			case 'u':
+				url = optarg;
+				break;
+
+			case 's':
+				sizes = optarg;
+				break;
+
+			case 'S':
+				mix = optarg;
+				break;
+
+			case 'W':
+				o.writer = optarg;
+				break;
+
+			case 'f':
+				o.format = optarg;
+				break;
+
+			case 'z':
+				o.compress = optarg;
+				break;
+
+			case 'j':
+				config.upload_parts = atoi(optarg);
+				if (!config.upload_parts)
+					config.upload_parts = 1;
+				break;
+
+			case 'n':
+				runs = atoi(optarg);
+				break;
+
+			default:
+				bench_usage();
+				return EXIT_FAILURE;
+		}
+	}
+
+	snprintf(config.url, sizeof(config.url), "%s", url);
+
+	fd = mkstemp(input);
+	if (fd < 0) {
+		fprintf(stderr, "%s: could not create '%s'\n", BENCH_NAME, input);
+		return EXIT_FAILURE;
+	}
+	close(fd);
+
+	list = strdup(sizes);
+	for (tok = strtok_r(list, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+		if (bench_count("-s", tok, &size))
+			goto exit;
+		size *= 1024 * 1024;
+
+		if (bench_traffic(input, mix, 0, size, 1024))
+			goto exit;
+
+		for (run = 0; run < runs; run++) {
+			fflush(stdout);
+
+			pid = fork();
+			if (pid < 0)
+				goto exit;
+
+			if (!pid) {
+				/* what cshark prints along the way is not part of the result */
+				out = fdopen(dup(STDOUT_FILENO), "w");
+				fd = open("/dev/null", O_WRONLY);
+				if (!out || fd < 0)
+					_exit(EXIT_FAILURE);
+				dup2(fd, STDOUT_FILENO);
+				close(fd);
+
+				openlog(BENCH_NAME, LOG_PERROR | LOG_PID, LOG_USER);
+				_exit(bench_run(out, input, &o, size) ? EXIT_FAILURE : EXIT_SUCCESS);
+			}
+
+			if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status)) {
+				fprintf(stderr, "%s: run for %s MiB did not finish\n", BENCH_NAME, tok);
+				goto exit;
+			}
+		}
+	}
+
+	rc = EXIT_SUCCESS;
+
+exit:
+	free(list);
+	remove(input);
+
+	return rc;
+}
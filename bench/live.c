@@ -0,0 +1,478 @@
+/*
+ * Author: Luka Perkov <luka.perkov@sartura.hr>
+ *
+ * Copyright (C) 2014, QA Cafe, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * For more information see the project website [1].
+ *
+ * [1] https://www.cloudshark.org/
+ */
+
+/*
+ * Captures live traffic the kernel delivers, which the replay benchmarks never
+ * touch. A network namespace of its own gets a veth pair, a generator sends
+ * synthetic traffic into one end as fast as asked for and cshark captures on
+ * the other, in a child so its CPU time can be told apart. Every capture
+ * backend and number of workers asked for prints one line of key=value pairs
+ * with what was sent, captured and dropped by the kernel, and the CPU the
+ * capture took. Needs CAP_NET_ADMIN and the ip tool.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <net/if.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include <libubox/uloop.h>
+
+#include "bench.h"
+#include "config.h"
+#include "cshark.h"
+#include "pcap.h"
+#include "session.h"
+
+#define BENCH_NAME "cshark-live-bench"
+#define BENCH_TX "cshark-tx"
+#define BENCH_RX "cshark-rx"
+
+/* packets handed to the kernel in one sendmmsg() */
+#define BENCH_BATCH 64
+
+/* time the capture gets to catch up once the generator stops */
+#define BENCH_DRAIN_MS 250
+
+/* what the capture child reports back once it is stopped */
+struct bench_result {
+	uint64_t packets;
+	uint64_t caplen;
+	uint64_t recv;
+	uint64_t drop;
+	uint64_t ifdrop;
+};
+
+struct bench_generator {
+	unsigned int pattern[BENCH_MIX_MAX];
+	int nr;
+	unsigned int flows;
+	/* packets per second, 0 for as fast as it goes */
+	uint64_t rate;
+	double seconds;
+
+	uint64_t sent;
+	uint64_t failed;
+	double elapsed;
+};
+
+/* a private namespace goes away with the process, and the veth pair with it */
+static int bench_netns(void)
+{
+	int fd;
+
+	if (unshare(CLONE_NEWNET)) {
+		fprintf(stderr, "%s: could not create a network namespace: %s\n", BENCH_NAME, strerror(errno));
+		return -1;
+	}
+
+	/* router solicitations and the like are not part of the traffic */
+	fd = open("/proc/sys/net/ipv6/conf/default/disable_ipv6", O_WRONLY);
+	if (fd >= 0 && write(fd, "1", 1) != 1)
+		fprintf(stderr, "%s: IPv6 stays on, a few packets will not be from the generator\n", BENCH_NAME);
+	if (fd >= 0)
+		close(fd);
+
+	if (system("ip link add " BENCH_TX " type veth peer name " BENCH_RX " && "
+		   "ip link set " BENCH_TX " up && ip link set " BENCH_RX " up")) {
+		fprintf(stderr, "%s: could not create the veth pair\n", BENCH_NAME);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int bench_socket(void)
+{
+	struct sockaddr_ll sll;
+	int one = 1, fd;
+
+	fd = socket(AF_PACKET, SOCK_RAW | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+
+	memset(&sll, 0, sizeof(sll));
+	sll.sll_family = AF_PACKET;
+	sll.sll_protocol = htons(ETH_P_IP);
+	sll.sll_ifindex = if_nametoindex(BENCH_TX);
+
+	if (!sll.sll_ifindex || bind(fd, (struct sockaddr *) &sll, sizeof(sll))) {
+		close(fd);
+		return -1;
+	}
+
+	/* straight to the device, the qdisc would only queue and drop on its own */
+	setsockopt(fd, SOL_PACKET, PACKET_QDISC_BYPASS, &one, sizeof(one));
+
+	return fd;
+}
+
+/* sends for the given time, paced to the rate when there is one */
+static int bench_generate(struct bench_generator *g)
+{
+	static u_char frames[BENCH_BATCH][BENCH_FRAME_MAX];
+	struct mmsghdr msgs[BENCH_BATCH];
+	struct iovec iov[BENCH_BATCH];
+	struct timespec pause = { .tv_nsec = 20000 };
+	double start, elapsed;
+	unsigned int batch, i, j;
+	uint64_t n = 0, due;
+	int fd, rc;
+
+	fd = bench_socket();
+	if (fd < 0) {
+		fprintf(stderr, "%s: could not open a packet socket on %s\n", BENCH_NAME, BENCH_TX);
+		return -1;
+	}
+
+	for (i = 0; i < BENCH_BATCH; i++)
+		for (j = 0; j < BENCH_FRAME_MAX; j++)
+			frames[i][j] = random();
+
+	memset(msgs, 0, sizeof(msgs));
+	g->sent = g->failed = 0;
+
+	start = bench_now();
+	for (;;) {
+		elapsed = bench_now() - start;
+		if (elapsed >= g->seconds)
+			break;
+
+		batch = BENCH_BATCH;
+		if (g->rate) {
+			due = elapsed * g->rate;
+			if (n >= due) {
+				nanosleep(&pause, NULL);
+				continue;
+			}
+			if (due - n < batch)
+				batch = due - n;
+		}
+
+		for (i = 0; i < batch; i++) {
+			iov[i].iov_base = frames[i];
+			iov[i].iov_len = g->pattern[(n + i) % g->nr];
+			bench_frame(frames[i], iov[i].iov_len, n + i, (n + i) % g->flows);
+
+			msgs[i].msg_hdr.msg_iov = &iov[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+
+		rc = sendmmsg(fd, msgs, batch, 0);
+		if (rc < 0) {
+			/* the packet that failed is skipped, the rest go with the next batch */
+			g->failed++;
+			n++;
+			continue;
+		}
+
+		g->sent += rc;
+		n += rc;
+	}
+	g->elapsed = bench_now() - start;
+
+	close(fd);
+
+	return 0;
+}
+
+/* the capture child, stopped by SIGINT like cshark on the command line */
+static void bench_capture(int ready, int result, const struct cshark_options *o,
+			  unsigned int workers)
+{
+	struct bench_result r;
+	int fd;
+
+	/* what cshark prints along the way is not part of the result */
+	fd = open("/dev/null", O_WRONLY);
+	if (fd >= 0) {
+		dup2(fd, STDOUT_FILENO);
+		close(fd);
+	}
+
+	memset(&cshark, 0, sizeof(cshark));
+	memset(&r, 0, sizeof(r));
+	cshark.interface = BENCH_RX;
+	cshark.snaplen = 65535;
+	cshark.workers = workers;
+
+	if (cshark_session_setup(&cshark, o))
+		_exit(EXIT_FAILURE);
+
+	uloop_init();
+	if (cshark_session_start(&cshark))
+		_exit(EXIT_FAILURE);
+
+	if (write(ready, "", 1) != 1)
+		_exit(EXIT_FAILURE);
+	close(ready);
+
+	uloop_run();
+
+	pthread_mutex_lock(&cshark.lock);
+	cshark_pcap_stats(&cshark, &r.packets, &r.caplen);
+	pthread_mutex_unlock(&cshark.lock);
+	r.recv = cshark.stats_recv;
+	r.drop = cshark.stats_drop;
+	r.ifdrop = cshark.stats_ifdrop;
+
+	cshark_session_finish(&cshark, true);
+	uloop_done();
+
+	_exit(write(result, &r, sizeof(r)) == sizeof(r) ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+static int bench_run(struct bench_generator *g, const struct cshark_options *o, unsigned int workers)
+{
+	int ready[2], result[2];
+	struct bench_result r;
+	struct rusage ru;
+	double start, elapsed, cpu;
+	int status, rc = -1;
+	char c;
+	pid_t pid;
+
+	if (pipe2(ready, O_CLOEXEC))
+		return -1;
+	if (pipe2(result, O_CLOEXEC)) {
+		close(ready[0]);
+		close(ready[1]);
+		return -1;
+	}
+
+	fflush(stdout);
+
+	pid = fork();
+	if (pid < 0)
+		goto exit;
+
+	if (!pid) {
+		close(ready[0]);
+		close(result[0]);
+		bench_capture(ready[1], result[1], o, workers);
+	}
+
+	close(ready[1]);
+	close(result[1]);
+	ready[1] = result[1] = -1;
+
+	/* nothing to read means the capture did not start */
+	if (read(ready[0], &c, 1) != 1) {
+		fprintf(stderr, "%s: capture with the %s backend and %u workers did not start\n",
+			BENCH_NAME, o->backend, workers);
+		waitpid(pid, &status, 0);
+		goto exit;
+	}
+
+	start = bench_now();
+	if (bench_generate(g)) {
+		kill(pid, SIGKILL);
+		waitpid(pid, &status, 0);
+		goto exit;
+	}
+
+	usleep(BENCH_DRAIN_MS * 1000);
+	kill(pid, SIGINT);
+
+	memset(&r, 0, sizeof(r));
+	if (read(result[0], &r, sizeof(r)) != sizeof(r) || wait4(pid, &status, 0, &ru) < 0) {
+		fprintf(stderr, "%s: capture did not report back\n", BENCH_NAME);
+		goto exit;
+	}
+	elapsed = bench_now() - start;
+
+	cpu = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+
+	printf("live backend=%s workers=%u seconds=%.2f sent=%lu tx_failed=%lu tx_pps=%.0f "
+	       "received=%lu dropped=%lu ifdropped=%lu captured=%lu capture_pps=%.0f lost_pct=%.2f cpu_pct=%.1f\n",
+		o->backend, workers, g->elapsed, (long unsigned int) g->sent, (long unsigned int) g->failed,
+		g->elapsed > 0 ? g->sent / g->elapsed : 0,
+		(long unsigned int) r.recv, (long unsigned int) r.drop, (long unsigned int) r.ifdrop,
+		(long unsigned int) r.packets, g->elapsed > 0 ? r.packets / g->elapsed : 0,
+		g->sent && g->sent > r.packets ? (g->sent - r.packets) * 100.0 / g->sent : 0,
+		elapsed > 0 ? cpu * 100 / elapsed : 0);
+	fflush(stdout);
+
+	rc = 0;
+
+exit:
+	close(ready[0]);
+	close(result[0]);
+	if (ready[1] >= 0)
+		close(ready[1]);
+	if (result[1] >= 0)
+		close(result[1]);
+
+	return rc;
+}
+
+static void bench_usage(void)
+{
+	printf("usage: %s [-r rate] [-S mix] [-F flows] [-T seconds] [-b backends] [-j workers] [-W writer] [-f format] [-z compress]\n\n%s",
+		BENCH_NAME, \
+		"  -r  packets per second to send, 0 for as fast as it goes, the default\n" \
+		"  -S  packet sizes as size:weight pairs, " BENCH_MIX " by default\n" \
+		"  -F  flows the traffic is spread over, 1024 by default\n" \
+		"  -T  seconds to send for, 5 by default\n" \
+		"  -b  comma separated list of capture backends, pcap,tpacket by default\n" \
+		"  -j  comma separated list of capture workers to try with tpacket, 1,2,4 by default\n" \
+		"  -W  capture file writer, 'writev', 'mmap' or 'io_uring'\n" \
+		"  -f  capture file format, 'pcap' or 'pcapng'\n" \
+		"  -z  compress the capture, 'none', 'gzip' or 'zstd'\n" \
+		"  -h  shows this help\n");
+}
+
+int main(int argc, char *argv[])
+{
+	struct bench_generator g;
+	struct cshark_options o;
+	const char *mix = BENCH_MIX;
+	char *backends = "pcap,tpacket";
+	char *workers = "1,2,4";
+	char *blist, *btok, *bsave;
+	char *wlist, *wtok, *wsave;
+	unsigned int nr;
+	int c, rc = EXIT_FAILURE;
+
+	memset(&g, 0, sizeof(g));
+	memset(&o, 0, sizeof(o));
+	bench_config();
+
+	g.flows = 1024;
+	g.seconds = 5;
+
+	while ((c = getopt(argc, argv, "r:S:F:T:b:j:W:f:z:h")) != -1) {
+		switch (c) {
+			case 'r':
+				g.rate = strtoull(optarg, NULL, 10);
+				break;
+
+			case 'S':
+				mix = optarg;
+				break;
+
+			case 'F':
+				g.flows = atoi(optarg);
+				if (!g.flows)
+					g.flows = 1;
+				break;
+
+			case 'T':
+				g.seconds = atof(optarg);
+				break;
+
+			case 'b':
+				backends = optarg;
+				break;
+
+			case 'j':
+				workers = optarg;
+				break;
+
+			case 'W':
+				o.writer = optarg;
+				break;
+
+			case 'f':
+				o.format = optarg;
+				break;
+
+			case 'z':
+				o.compress = optarg;
+				break;
+
+			default:
+				bench_usage();
+				return EXIT_FAILURE;
+		}
+	}
+
+	g.nr = bench_mix(mix, g.pattern, BENCH_MIX_MAX);
+	if (g.nr < 0)
+		return EXIT_FAILURE;
+
+	openlog(BENCH_NAME, LOG_PERROR | LOG_PID, LOG_USER);
+	signal(SIGPIPE, SIG_IGN);
+
+	if (bench_netns())
+		return EXIT_FAILURE;
+
+	blist = strdup(backends);
+	wlist = strdup(workers);
+	if (!blist || !wlist)
+		goto exit;
+
+	for (btok = strtok_r(blist, ",", &bsave); btok; btok = strtok_r(NULL, ",", &bsave)) {
+		o.backend = btok;
+
+		/* only tpacket has workers, pcap always runs on one */
+		if (strcmp(btok, "tpacket")) {
+			if (bench_run(&g, &o, 1))
+				goto exit;
+			continue;
+		}
+
+		free(wlist);
+		wlist = strdup(workers);
+		if (!wlist)
+			goto exit;
+
+		for (wtok = strtok_r(wlist, ",", &wsave); wtok; wtok = strtok_r(NULL, ",", &wsave)) {
+			nr = atoi(wtok);
+			if (bench_run(&g, &o, nr ? nr : 1))
+				goto exit;
+		}
+	}
+
+	rc = EXIT_SUCCESS;
+
+exit:
+	free(blist);
+	free(wlist);
+
+	return rc;
+}
@@ -0,0 +1,834 @@
+/*
+ * Author: Luka Perkov <luka.perkov@sartura.hr>
+ *
+ * Copyright (C) 2014, QA Cafe, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * For more information see the project website [1].
+ *
+ * [1] https://www.cloudshark.org/
+ */
+
+/*
+ * A stand-in for the CloudShark upload API, so uploads can be measured on one
+ * box. It takes PUT /api/v1/<token>/upload and answers with the JSON id like
+ * the real service. Resumed, parallel and chunked uploads are understood as
+ * well, see uclient.c, multipart.c and stream.c for what the client sends.
+ *
+ * A long link is emulated per connection: a request is answered one round trip
+ * after its last byte and at most one window of body is read per round trip,
+ * which is what a TCP window does to a single connection over a long link.
+ * A bandwidth limit is shared by all connections, like the uplink it stands
+ * for, and connections can be reset every so many bytes to exercise retries.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include <libubox/uloop.h>
+#include <libubox/usock.h>
+#include <libubox/ustream.h>
+#include <libubox/utils.h>
+#ifdef WITH_SSL
+#include <libubox/ustream-ssl.h>
+#endif
+
+#define SERVER_NAME "cshark-server"
+#define SERVER_HEAD_MAX 8192
+#define SERVER_LINE_MAX 256
+#define SERVER_UPLOADS 64
+#define SERVER_PARTS 8192
+
+/* smallest amount of body worth waiting for under a bandwidth limit */
+#define SERVER_SLICE (16 * 1024)
+
+enum server_chunk {
+	SERVER_CHUNK_SIZE,
+	SERVER_CHUNK_DATA,
+	SERVER_CHUNK_TRAILER,
+	SERVER_CHUNK_DONE,
+};
+
+struct server_upload {
+	char id[64];
+	uint64_t size;
+	/* bytes received in order from the start of the file */
+	uint64_t offset;
+	/* bytes received in parts, each part counted once */
+	uint64_t parts_have;
+	uint8_t parts[SERVER_PARTS / 8];
+};
+
+struct server_conn {
+	struct ustream_fd sfd;
+#ifdef WITH_SSL
+	struct ustream_ssl ssl;
+#endif
+	/* the stream requests are read from, the TLS one over sfd with -c */
+	struct ustream *s;
+	struct uloop_timeout delay;
+	bool closing;
+	bool reset;
+
+	char head[SERVER_HEAD_MAX + 1];
+	size_t head_len;
+	bool head_done;
+
+	/* the request being received */
+	bool is_head;
+	bool keep_alive;
+	bool chunked;
+	enum server_chunk chunk;
+	char line[SERVER_LINE_MAX + 1];
+	size_t line_len;
+	uint64_t length;
+	uint64_t body_left;
+	uint64_t body_pos;
+	uint64_t total;
+	uint64_t complete;
+	int part;
+	struct server_upload *up;
+	struct server_upload anon;
+
+	/* body bytes that may still be read in this round trip */
+	uint64_t window_left;
+
+	char out[1024];
+	size_t out_len;
+	bool out_queued;
+	bool responding;
+};
+
+static struct server_upload uploads[SERVER_UPLOADS];
+static unsigned int captures;
+
+static unsigned int latency;
+static uint64_t window = 64 * 1024;
+static bool verbose;
+
+/* bytes per second for all connections together, 0 for no limit */
+static uint64_t rate;
+static double bucket;
+static double bucket_time;
+
+/* a connection is reset every time this many more body bytes came in */
+static uint64_t reset_every;
+static uint64_t reset_count;
+
+#ifdef WITH_SSL
+static struct ustream_ssl_ctx *ssl_ctx;
+#endif
+
+static void server_delay_cb(struct uloop_timeout *t);
+
+static double server_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* body bytes the bandwidth limit lets through right now, up to want */
+static size_t server_allow(size_t want)
+{
+	double now = server_now();
+	double burst = rate / 20 > SERVER_SLICE ? rate / 20 : SERVER_SLICE;
+
+	bucket += (now - bucket_time) * rate;
+	bucket_time = now;
+	if (bucket > burst)
+		bucket = burst;
+
+	if (want > bucket)
+		want = bucket;
+	bucket -= want;
+
+	return want;
+}
+
+/* milliseconds until a slice of body may be read again */
+static int server_allow_wait(void)
+{
+	double ms = (SERVER_SLICE - bucket) * 1000 / rate;
+
+	return ms < 1 ? 1 : (int) ms + 1;
+}
+
+static struct server_upload *server_upload_find(const char *id, bool create)
+{
+	struct server_upload *free_slot = NULL;
+	unsigned int i;
+
+	for (i = 0; i < SERVER_UPLOADS; i++) {
+		if (!uploads[i].id[0]) {
+			if (!free_slot)
+				free_slot = &uploads[i];
+			continue;
+		}
+		if (!strcmp(uploads[i].id, id))
+			return &uploads[i];
+	}
+
+	if (!create || !free_slot)
+		return NULL;
+
+	memset(free_slot, 0, sizeof(*free_slot));
+	snprintf(free_slot->id, sizeof(free_slot->id), "%s", id);
+
+	return free_slot;
+}
+
+/* value of a request header, NULL if it is not there */
+static const char *server_header(const char *head, const char *name, char *value, size_t len)
+{
+	char pattern[64];
+	const char *p;
+	size_t n;
+
+	snprintf(pattern, sizeof(pattern), "\r\n%s:", name);
+	p = strcasestr(head, pattern);
+	if (!p)
+		return NULL;
+
+	p += strlen(pattern);
+	while (*p == ' ')
+		p++;
+
+	n = strcspn(p, "\r\n");
+	if (n >= len)
+		n = len - 1;
+	memcpy(value, p, n);
+	value[n] = 0;
+
+	return value;
+}
+
+static void server_conn_free(struct server_conn *c)
+{
+	struct linger lin = { .l_onoff = 1, .l_linger = 0 };
+
+	uloop_timeout_cancel(&c->delay);
+
+	/* no linger turns the close into a reset */
+	if (c->reset)
+		setsockopt(c->sfd.fd.fd, SOL_SOCKET, SO_LINGER, &lin, sizeof(lin));
+
+#ifdef WITH_SSL
+	if (c->s == &c->ssl.stream)
+		ustream_free(&c->ssl.stream);
+#endif
+	ustream_free(&c->sfd.stream);
+	close(c->sfd.fd.fd);
+	free(c);
+}
+
+/* freed from the state callback, ustream may still use the connection on the way back */
+static void server_conn_close(struct server_conn *c)
+{
+	c->closing = true;
+	ustream_set_read_blocked(c->s, true);
+	ustream_state_change(c->s);
+}
+
+static void server_conn_reset(struct server_conn *c)
+{
+	c->head_len = 0;
+	c->head[0] = 0;
+	c->head_done = false;
+	c->responding = false;
+	c->out_len = 0;
+	c->out_queued = false;
+	c->up = NULL;
+}
+
+/* reads are held back while the connection waits for the timer */
+static void server_wait(struct server_conn *c, int msecs)
+{
+	ustream_set_read_blocked(c->s, true);
+	uloop_timeout_set(&c->delay, msecs);
+}
+
+static void server_respond(struct server_conn *c, int status, const char *reason,
+			   const char *extra, const char *body)
+{
+	c->out_len = snprintf(c->out, sizeof(c->out),
+		"HTTP/1.1 %d %s\r\n"
+		"Content-Type: application/json\r\n"
+		"Content-Length: %zu\r\n"
+		"%s"
+		"Connection: %s\r\n"
+		"\r\n"
+		"%s",
+		status, reason, c->is_head ? 0 : strlen(body), extra,
+		c->keep_alive ? "keep-alive" : "close", c->is_head ? "" : body);
+	c->out_queued = false;
+	c->responding = true;
+
+	/* the answer takes one more round trip to arrive */
+	server_wait(c, latency);
+}
+
+/* the rest of a request that was turned down is not read, the connection goes */
+static void server_reject(struct server_conn *c, int status, const char *reason)
+{
+	c->keep_alive = false;
+	server_respond(c, status, reason, "", "{}");
+}
+
+static void server_request_done(struct server_conn *c)
+{
+	struct server_upload *up = c->up;
+	char extra[128] = "";
+	char body[128];
+
+	if (c->is_head) {
+		if (!up || up == &c->anon) {
+			server_respond(c, 404, "Not Found", "", "");
+			return;
+		}
+
+		snprintf(extra, sizeof(extra), "Upload-Offset: %lu\r\n", (long unsigned int) up->offset);
+		server_respond(c, 200, "OK", extra, "");
+		return;
+	}
+
+	/* the size of a chunked body is known once the last chunk is in */
+	if (c->chunked && !c->complete)
+		up->size = up->offset;
+
+	if (c->part >= 0) {
+		if (c->part < SERVER_PARTS && !(up->parts[c->part / 8] & (1 << (c->part % 8)))) {
+			up->parts[c->part / 8] |= 1 << (c->part % 8);
+			up->parts_have += c->length;
+		}
+		snprintf(body, sizeof(body), "{\"part\": %d}", c->part);
+		server_respond(c, 200, "OK", "", body);
+		return;
+	}
+
+	if (c->complete) {
+		if (up->offset + up->parts_have < c->complete) {
+			snprintf(body, sizeof(body), "{\"error\": \"missing %lu bytes\"}",
+				(long unsigned int) (c->complete - up->offset - up->parts_have));
+			server_respond(c, 409, "Conflict", "", body);
+			return;
+		}
+	} else if (up->offset < up->size) {
+		snprintf(body, sizeof(body), "{\"offset\": %lu}", (long unsigned int) up->offset);
+		server_respond(c, 409, "Conflict", "", body);
+		return;
+	}
+
+	snprintf(body, sizeof(body), "{\"id\": \"%012x\"}", ++captures);
+	if (verbose)
+		fprintf(stderr, "%s: capture %012x, %lu bytes\n", SERVER_NAME, captures,
+			(long unsigned int) (c->complete ? c->complete : up->size));
+
+	memset(up, 0, sizeof(*up));
+	server_respond(c, 200, "OK", "", body);
+}
+
+static int server_request_head(struct server_conn *c)
+{
+	char value[128];
+	long long unsigned int a, b, total;
+	uint64_t length = 0;
+
+	c->is_head = !strncmp(c->head, "HEAD ", 5);
+	c->keep_alive = !server_header(c->head, "Connection", value, sizeof(value)) ||
+		strcasecmp(value, "close");
+	c->chunked = server_header(c->head, "Transfer-Encoding", value, sizeof(value)) &&
+		!strcasecmp(value, "chunked");
+	c->chunk = SERVER_CHUNK_SIZE;
+	c->line_len = 0;
+	c->part = -1;
+	c->complete = 0;
+
+	if (!c->is_head && strncmp(c->head, "PUT ", 4)) {
+		server_reject(c, 405, "Method Not Allowed");
+		return -1;
+	}
+
+	if (!strstr(c->head, "/api/v1/") || !strstr(c->head, "/upload")) {
+		server_reject(c, 404, "Not Found");
+		return -1;
+	}
+
+	if (server_header(c->head, "Content-Length", value, sizeof(value)))
+		length = strtoull(value, NULL, 10);
+	else if (!c->is_head && !c->chunked) {
+		server_reject(c, 411, "Length Required");
+		return -1;
+	}
+
+	if (server_header(c->head, "Upload-Id", value, sizeof(value))) {
+		c->up = server_upload_find(value, !c->is_head);
+		if (!c->up && !c->is_head) {
+			server_reject(c, 503, "Service Unavailable");
+			return -1;
+		}
+	} else {
+		memset(&c->anon, 0, sizeof(c->anon));
+		c->up = &c->anon;
+	}
+
+	/* a chunked body is read chunk by chunk, body_left is what is left of the current one */
+	c->body_left = c->is_head || c->chunked ? 0 : length;
+	c->body_pos = 0;
+	c->total = length;
+
+	if (server_header(c->head, "Content-Range", value, sizeof(value))) {
+		if (sscanf(value, "bytes %llu-%llu/%llu", &a, &b, &total) != 3 || b < a || b - a + 1 != length) {
+			server_reject(c, 416, "Range Not Satisfiable");
+			return -1;
+		}
+		c->body_pos = a;
+		c->total = total;
+	}
+	c->length = length;
+
+	if (server_header(c->head, "Upload-Part", value, sizeof(value)))
+		c->part = atoi(value);
+
+	if (server_header(c->head, "Upload-Complete", value, sizeof(value)))
+		c->complete = strtoull(value, NULL, 10);
+
+	if (c->up && !c->is_head && !c->complete && !c->chunked)
+		c->up->size = c->total;
+
+	if (verbose)
+		fprintf(stderr, "%s: %s %s at %lu%s\n", SERVER_NAME, c->is_head ? "HEAD" : "PUT",
+			c->chunked ? "chunked" : "bytes", (long unsigned int) c->body_pos,
+			c->part >= 0 ? " as a part" : c->complete ? ", commit" : "");
+
+	return 0;
+}
+
+static void server_body(struct server_conn *c, size_t n)
+{
+	struct server_upload *up = c->up;
+
+	/* only bytes that continue what is there count towards a resume */
+	if (c->part < 0 && c->body_pos == up->offset)
+		up->offset += n;
+
+	c->body_pos += n;
+	c->body_left -= n;
+	if (latency)
+		c->window_left -= n;
+
+	if (reset_every) {
+		reset_count += n;
+		if (reset_count >= reset_every) {
+			reset_count = 0;
+			c->reset = true;
+			if (verbose)
+				fprintf(stderr, "%s: resetting the connection at %lu\n", SERVER_NAME,
+					(long unsigned int) c->body_pos);
+		}
+	}
+}
+
+/* the head ends at the empty line, whatever follows stays in the stream */
+static int server_read_head(struct server_conn *c)
+{
+	char *data, *end;
+	size_t from, n;
+	int len;
+
+	data = ustream_get_read_buf(c->s, &len);
+	if (!data || !len)
+		return c->s->eof ? -1 : 0;
+
+	if (c->head_len == SERVER_HEAD_MAX)
+		return -1;
+
+	n = len < SERVER_HEAD_MAX - c->head_len ? len : SERVER_HEAD_MAX - c->head_len;
+	memcpy(c->head + c->head_len, data, n);
+	c->head[c->head_len + n] = 0;
+
+	/* the empty line may have started in an earlier read */
+	from = c->head_len > 3 ? c->head_len - 3 : 0;
+	end = strstr(c->head + from, "\r\n\r\n");
+	if (end) {
+		n = end + 4 - (c->head + c->head_len);
+		c->head_done = true;
+	}
+
+	ustream_consume(c->s, n);
+	c->head_len += n;
+	c->head[c->head_len] = 0;
+
+	return 1;
+}
+
+/* one line of a chunked body without its line break, 0 until it is all there */
+static int server_read_line(struct server_conn *c)
+{
+	char *data, *nl;
+	size_t n;
+	int len;
+
+	data = ustream_get_read_buf(c->s, &len);
+	if (!data || !len)
+		return c->s->eof ? -1 : 0;
+
+	nl = memchr(data, '\n', len);
+	n = nl ? nl + 1 - data : (size_t) len;
+	if (c->line_len + n > SERVER_LINE_MAX)
+		return -1;
+
+	memcpy(c->line + c->line_len, data, n);
+	c->line_len += n;
+	ustream_consume(c->s, n);
+	if (!nl)
+		return 0;
+
+	while (c->line_len && (c->line[c->line_len - 1] == '\n' || c->line[c->line_len - 1] == '\r'))
+		c->line_len--;
+	c->line[c->line_len] = 0;
+	c->line_len = 0;
+
+	return 1;
+}
+
+/* size lines, the line break after each chunk and the trailer of a chunked body */
+static int server_read_chunked(struct server_conn *c)
+{
+	int rc;
+
+	rc = server_read_line(c);
+	if (rc <= 0)
+		return rc;
+
+	switch (c->chunk) {
+		case SERVER_CHUNK_SIZE:
+			c->body_left = strtoull(c->line, NULL, 16);
+			c->chunk = c->body_left ? SERVER_CHUNK_DATA : SERVER_CHUNK_TRAILER;
+			break;
+
+		case SERVER_CHUNK_DATA:
+			c->chunk = SERVER_CHUNK_SIZE;
+			break;
+
+		case SERVER_CHUNK_TRAILER:
+			if (!c->line[0])
+				c->chunk = SERVER_CHUNK_DONE;
+			break;
+
+		case SERVER_CHUNK_DONE:
+			break;
+	}
+
+	return 1;
+}
+
+static int server_read(struct server_conn *c)
+{
+	char *data;
+	size_t n;
+	int len, rc;
+
+	for (;;) {
+		if (c->responding || c->closing)
+			return 0;
+
+		if (!c->head_done) {
+			rc = server_read_head(c);
+			if (rc <= 0)
+				return rc;
+			if (c->head_done && server_request_head(c))
+				return 0;
+			continue;
+		}
+
+		if (!c->body_left) {
+			if (!c->chunked || c->chunk == SERVER_CHUNK_DONE) {
+				server_request_done(c);
+				return 0;
+			}
+
+			rc = server_read_chunked(c);
+			if (rc <= 0)
+				return rc;
+			continue;
+		}
+
+		/* the window for this round trip is used up, wait for the next one */
+		if (latency && !c->window_left) {
+			server_wait(c, latency);
+			return 0;
+		}
+
+		data = ustream_get_read_buf(c->s, &len);
+		if (!data || !len)
+			return c->s->eof ? -1 : 0;
+
+		n = c->body_left < (uint64_t) len ? c->body_left : (size_t) len;
+		if (latency && n > c->window_left)
+			n = c->window_left;
+
+		if (rate) {
+			n = server_allow(n);
+			if (!n) {
+				server_wait(c, server_allow_wait());
+				return 0;
+			}
+		}
+
+		ustream_consume(c->s, n);
+		server_body(c, n);
+		if (c->reset)
+			return -1;
+	}
+}
+
+/* the answer is out, the connection goes or takes the next request */
+static int server_written(struct server_conn *c)
+{
+	if (!c->keep_alive)
+		return -1;
+
+	server_conn_reset(c);
+	ustream_set_read_blocked(c->s, false);
+
+	return server_read(c);
+}
+
+static void server_delay_cb(struct uloop_timeout *t)
+{
+	struct server_conn *c = container_of(t, struct server_conn, delay);
+	int rc;
+
+	if (c->responding) {
+		if (!c->out_queued) {
+			ustream_write(c->s, c->out, c->out_len, false);
+			c->out_queued = true;
+		}
+
+		/* answers are small, the socket buffer rarely keeps any of it */
+		if (ustream_pending_data(c->s, true) || ustream_pending_data(&c->sfd.stream, true)) {
+			uloop_timeout_set(&c->delay, 1);
+			return;
+		}
+
+		rc = server_written(c);
+	} else {
+		if (!c->window_left)
+			c->window_left = window;
+		ustream_set_read_blocked(c->s, false);
+		rc = server_read(c);
+	}
+
+	if (rc)
+		server_conn_close(c);
+}
+
+/* with -c every connection speaks TLS, and the stream that calls back is the TLS one */
+static struct server_conn *server_conn(struct ustream *s)
+{
+#ifdef WITH_SSL
+	if (ssl_ctx)
+		return container_of(s, struct server_conn, ssl.stream);
+#endif
+	return container_of(s, struct server_conn, sfd.stream);
+}
+
+static void server_notify_read(struct ustream *s, int bytes)
+{
+	struct server_conn *c = server_conn(s);
+
+	/* waiting for the timer, which reads on from where it stopped */
+	if (c->delay.pending)
+		return;
+
+	if (server_read(c))
+		server_conn_close(c);
+}
+
+static void server_notify_state(struct ustream *s)
+{
+	struct server_conn *c = server_conn(s);
+
+	if (!c->closing && !s->write_error) {
+		/* whatever came in before the end is handled first */
+		if (!s->eof || c->delay.pending || !server_read(c))
+			return;
+	}
+
+	server_conn_free(c);
+}
+
+static void server_accept_cb(struct uloop_fd *ufd, unsigned int events)
+{
+	struct server_conn *c;
+	int fd;
+
+	while ((fd = accept4(ufd->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+		c = calloc(1, sizeof(*c));
+		if (!c) {
+			close(fd);
+			continue;
+		}
+
+		/* bigger buffers than the ustream default, bodies are read in bulk */
+		c->sfd.stream.r.buffer_len = 65536;
+		c->sfd.stream.r.max_buffers = 4;
+		ustream_fd_init(&c->sfd, fd);
+		c->s = &c->sfd.stream;
+
+#ifdef WITH_SSL
+		if (ssl_ctx) {
+			ustream_ssl_init(&c->ssl, &c->sfd.stream, ssl_ctx, true);
+			c->s = &c->ssl.stream;
+		}
+#endif
+
+		c->s->notify_read = server_notify_read;
+		c->s->notify_state = server_notify_state;
+		c->delay.cb = server_delay_cb;
+		c->window_left = window;
+	}
+}
+
+static void server_usage(void)
+{
+	printf("usage: %s [-a address] [-p port] [-l latency] [-w window] [-b rate] [-r bytes] [-c cert -k key] [-v]\n\n%s", SERVER_NAME, \
+		"  -a  address to listen on, 127.0.0.1 by default\n" \
+		"  -p  port to listen on, 8080 by default\n" \
+		"  -l  round trip time to emulate in milliseconds, 0 for none\n" \
+		"  -w  bytes read per connection and round trip in KiB, 64 by default\n" \
+		"  -b  bandwidth of all connections together in kbit/s, 0 for no limit\n" \
+		"  -r  reset a connection every time this many KiB of body came in, 0 for never\n" \
+		"  -c  certificate to serve HTTPS with, together with -k\n" \
+		"  -k  private key of the certificate\n" \
+		"  -v  log every request\n" \
+		"  -h  shows this help\n");
+}
+
+int main(int argc, char *argv[])
+{
+	struct uloop_fd listener = { .cb = server_accept_cb };
+	const char *address = "127.0.0.1";
+	const char *port = "8080";
+	const char *cert = NULL, *key = NULL;
+	int c;
+
+	while ((c = getopt(argc, argv, "a:p:l:w:b:r:c:k:vh")) != -1) {
+		switch (c) {
+			case 'a':
+				address = optarg;
+				break;
+
+			case 'p':
+				port = optarg;
+				break;
+
+			case 'l':
+				latency = atoi(optarg);
+				break;
+
+			case 'w':
+				window = strtoull(optarg, NULL, 10) * 1024;
+				if (!window)
+					window = 1024;
+				break;
+
+			case 'b':
+				rate = strtoull(optarg, NULL, 10) * 1000 / 8;
+				break;
+
+			case 'r':
+				reset_every = strtoull(optarg, NULL, 10) * 1024;
+				break;
+
+			case 'c':
+				cert = optarg;
+				break;
+
+			case 'k':
+				key = optarg;
+				break;
+
+			case 'v':
+				verbose = true;
+				break;
+
+			default:
+				server_usage();
+				return EXIT_FAILURE;
+		}
+	}
+
+	if (cert || key) {
+#ifdef WITH_SSL
+		ssl_ctx = ustream_ssl_context_new(true);
+		if (!ssl_ctx || !cert || !key ||
+		    ustream_ssl_context_set_crt_file(ssl_ctx, cert) ||
+		    ustream_ssl_context_set_key_file(ssl_ctx, key)) {
+			fprintf(stderr, "%s: could not load certificate and key\n", SERVER_NAME);
+			return EXIT_FAILURE;
+		}
+#else
+		fprintf(stderr, "%s: built without ustream-ssl, HTTPS is not available\n", SERVER_NAME);
+		return EXIT_FAILURE;
+#endif
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+
+	listener.fd = usock(USOCK_TCP | USOCK_SERVER | USOCK_NONBLOCK, address, port);
+	if (listener.fd < 0) {
+		fprintf(stderr, "%s: could not listen on %s:%s\n", SERVER_NAME, address, port);
+		return EXIT_FAILURE;
+	}
+
+	uloop_init();
+	uloop_fd_add(&listener, ULOOP_READ);
+
+	bucket_time = server_now();
+
+	printf("listening on %s://%s:%s, %u ms round trip, %lu KiB window, %lu kbit/s\n",
+		cert ? "https" : "http", address, port, latency, (long unsigned int) window / 1024,
+		(long unsigned int) (rate * 8 / 1000));
+	uloop_run();
+
+	uloop_done();
+	close(listener.fd);
+#ifdef WITH_SSL
+	if (ssl_ctx)
+		ustream_ssl_context_free(ssl_ctx);
+#endif
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,256 @@
+/*
+ * Author: Luka Perkov <luka.perkov@sartura.hr>
+ *
+ * Copyright (C) 2014, QA Cafe, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * For more information see the project website [1].
+ *
+ * [1] https://www.cloudshark.org/
+ */
+
+/*
+ * Uploads a file of random data to cshark-server, or any other server taking
+ * the CloudShark upload API, once for every number of parallel connections
+ * asked for. Single connection uploads run through uclient and through
+ * sendfile in turn, on the same file, so the two paths can be compared.
+ * Every run prints one line of key=value pairs.
+ */
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <libubox/uloop.h>
+
+#include "bench.h"
+#include "config.h"
+#include "cshark.h"
+#include "multipart.h"
+#include "uclient.h"
+
+#define BENCH_NAME "cshark-upload-bench"
+
+#define BENCH_PATH_UCLIENT (1 << 0)
+#define BENCH_PATH_SENDFILE (1 << 1)
+
+static int bench_file(const char *filename, uint64_t size)
+{
+	char buf[65536];
+	uint64_t left;
+	size_t i, n;
+	int fd;
+
+	fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (fd < 0)
+		return -1;
+
+	/* random so that nothing on the way can compress it */
+	for (left = size; left; left -= n) {
+		n = left < sizeof(buf) ? left : sizeof(buf);
+		for (i = 0; i < n; i++)
+			buf[i] = random();
+
+		if (write(fd, buf, n) != (ssize_t) n) {
+			close(fd);
+			return -1;
+		}
+	}
+
+	close(fd);
+
+	return 0;
+}
+
+/* the path cshark_uclient_upload() is going to take with the current config */
+static const char *bench_path(uint64_t size)
+{
+	if (config.upload_parts > 1 && size > config.upload_part_size)
+		return "multipart";
+
+	if (config.upload_sendfile && !strncmp(config.url, "http://", 7))
+		return "sendfile";
+
+	return "uclient";
+}
+
+static int bench_paths(const char *paths)
+{
+	char *list, *tok, *save;
+	int rc = 0;
+
+	list = strdup(paths);
+	for (tok = strtok_r(list, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+		if (!strcmp(tok, "uclient")) {
+			rc |= BENCH_PATH_UCLIENT;
+		} else if (!strcmp(tok, "sendfile")) {
+			rc |= BENCH_PATH_SENDFILE;
+		} else {
+			rc = -1;
+			break;
+		}
+	}
+	free(list);
+
+	return rc;
+}
+
+static void bench_usage(void)
+{
+	printf("usage: %s [-u url] [-s size] [-j connections] [-m paths] [-P part size] [-W window] [-n runs]\n\n%s",
+		BENCH_NAME, \
+		"  -u  server to upload to, http://127.0.0.1:8080 by default\n" \
+		"  -s  size of the upload in MiB, 64 by default\n" \
+		"  -j  comma separated list of parallel connections to try, 1,2,4,8 by default\n" \
+		"  -m  comma separated list of upload paths to compare, uclient,sendfile by default\n" \
+		"  -P  part size in KiB, the upload_part_size default if not given\n" \
+		"  -W  upload window in KiB, the upload_window default if not given\n" \
+		"  -n  runs for every number of connections, 3 by default\n" \
+		"  -h  shows this help\n");
+}
+
+int main(int argc, char *argv[])
+{
+	char filename[] = "/tmp/cshark-upload-bench-XXXXXX";
+	const char *url = "http://127.0.0.1:8080";
+	char *connections = "1,2,4,8";
+	uint64_t size = 64 * 1024 * 1024;
+	unsigned int runs = 3, run, parts;
+	int paths = BENCH_PATH_UCLIENT | BENCH_PATH_SENDFILE;
+	char *list, *tok, *save;
+	const char *path;
+	double start, elapsed;
+	int c, i, fd, rc = EXIT_FAILURE;
+
+	memset(&cshark, 0, sizeof(cshark));
+	bench_config();
+
+	/* a failed upload shows as ok=0 rather than being retried */
+	config.upload_retries = 0;
+
+	openlog(BENCH_NAME, LOG_PERROR | LOG_PID, LOG_USER);
+
+	while ((c = getopt(argc, argv, "u:s:j:m:P:W:n:h")) != -1) {
+		switch (c) {
+			case 'u':
+				url = optarg;
+				break;
+
+			case 's':
+				size = strtoull(optarg, NULL, 10) * 1024 * 1024;
+				break;
+
+			case 'j':
+				connections = optarg;
+				break;
+
+			case 'm':
+				paths = bench_paths(optarg);
+				if (paths <= 0) {
+					bench_usage();
+					return EXIT_FAILURE;
+				}
+				break;
+
+			case 'P':
+				config.upload_part_size = strtoull(optarg, NULL, 10) * 1024;
+				break;
+
+			case 'W':
+				config.upload_window = (size_t) atoi(optarg) * 1024;
+				break;
+
+			case 'n':
+				runs = atoi(optarg);
+				break;
+
+			default:
+				bench_usage();
+				return EXIT_FAILURE;
+		}
+	}
+
+	snprintf(config.url, sizeof(config.url), "%s", url);
+	cshark.upload_window = config.upload_window;
+
+	if ((paths & BENCH_PATH_SENDFILE) && strncmp(url, "http://", 7))
+		fprintf(stderr, "%s: sendfile needs a plain http url, '%s' goes through uclient\n",
+			BENCH_NAME, url);
+
+	fd = mkstemp(filename);
+	if (fd < 0 || bench_file(filename, size)) {
+		fprintf(stderr, "%s: could not create '%s'\n", BENCH_NAME, filename);
+		goto exit;
+	}
+	close(fd);
+
+	uloop_init();
+
+	list = strdup(connections);
+	for (tok = strtok_r(list, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+		parts = atoi(tok);
+		config.upload_parts = parts ? parts : 1;
+
+		for (i = 0; i < 2; i++) {
+			if (!(paths & (i ? BENCH_PATH_SENDFILE : BENCH_PATH_UCLIENT)))
+				continue;
+
+			config.upload_sendfile = i;
+			path = bench_path(size);
+
+			/* multipart and https uploads take the same path either way, run them once */
+			if (i && (paths & BENCH_PATH_UCLIENT) && strcmp(path, "sendfile"))
+				continue;
+
+			for (run = 0; run < runs; run++) {
+				cshark.upload_url[0] = 0;
+
+				start = bench_now();
+				if (!cshark_uclient_upload(&cshark, filename))
+					uloop_run();
+				elapsed = bench_now() - start;
+
+				printf("upload path=%s connections=%u bytes=%lu seconds=%.3f mbit_s=%.2f ok=%d\n",
+					path, config.upload_parts, (long unsigned int) size, elapsed,
+					elapsed > 0 ? size * 8 / elapsed / 1e6 : 0,
+					!cshark.upload_failed && cshark.upload_url[0]);
+				fflush(stdout);
+
+				cshark_uclient_done(&cshark);
+			}
+		}
+	}
+	free(list);
+
+	uloop_done();
+	rc = EXIT_SUCCESS;
+
+exit:
+	remove(filename);
+
+	return rc;
+}
@@ -11,11 +11,14 @@ find_path(LIBUBOX_INCLUDE_DIR libubox/uloop.h
 find_library(LIBUBOX_LIBRARY NAMES ubox libubox
 	HINTS ${PC_LIBUBOX_LIBDIR} ${PC_LIBUBOX_LIBRARY_DIRS})
 
-set(LIBUBOX_LIBRARIES ${LIBUBOX_LIBRARY})
+find_library(LIBUBOX_BLOBMSG_JSON_LIBRARY NAMES blobmsg_json libblobmsg_json
+	HINTS ${PC_LIBUBOX_LIBDIR} ${PC_LIBUBOX_LIBRARY_DIRS})
+
+set(LIBUBOX_LIBRARIES ${LIBUBOX_LIBRARY} ${LIBUBOX_BLOBMSG_JSON_LIBRARY})
 set(LIBUBOX_INCLUDE_DIRS ${LIBUBOX_INCLUDE_DIR})
 
 include(FindPackageHandleStandardArgs)
 
-find_package_handle_standard_args(LIBUBOX DEFAULT_MSG LIBUBOX_LIBRARY LIBUBOX_INCLUDE_DIR)
+find_package_handle_standard_args(LIBUBOX DEFAULT_MSG LIBUBOX_LIBRARY LIBUBOX_BLOBMSG_JSON_LIBRARY LIBUBOX_INCLUDE_DIR)
 
-mark_as_advanced(LIBUBOX_INCLUDE_DIR LIBUBOX_LIBRARY)
+mark_as_advanced(LIBUBOX_INCLUDE_DIR LIBUBOX_LIBRARY LIBUBOX_BLOBMSG_JSON_LIBRARY)
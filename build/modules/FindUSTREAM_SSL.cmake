@@ -0,0 +1,21 @@
+# USTREAM_SSL_FOUND - true if library and headers were found
+# USTREAM_SSL_INCLUDE_DIRS - include directories
+# USTREAM_SSL_LIBRARIES - library directories
+
+find_package(PkgConfig)
+pkg_check_modules(PC_USTREAM_SSL QUIET libustream-ssl)
+
+find_path(USTREAM_SSL_INCLUDE_DIR libubox/ustream-ssl.h
+	HINTS ${PC_USTREAM_SSL_INCLUDEDIR} ${PC_USTREAM_SSL_INCLUDE_DIRS})
+
+find_library(USTREAM_SSL_LIBRARY NAMES ustream-ssl libustream-ssl
+	HINTS ${PC_USTREAM_SSL_LIBDIR} ${PC_USTREAM_SSL_LIBRARY_DIRS})
+
+set(USTREAM_SSL_LIBRARIES ${USTREAM_SSL_LIBRARY})
+set(USTREAM_SSL_INCLUDE_DIRS ${USTREAM_SSL_INCLUDE_DIR})
+
+include(FindPackageHandleStandardArgs)
+
+find_package_handle_standard_args(USTREAM_SSL DEFAULT_MSG USTREAM_SSL_LIBRARY USTREAM_SSL_INCLUDE_DIR)
+
+mark_as_advanced(USTREAM_SSL_INCLUDE_DIR USTREAM_SSL_LIBRARY)
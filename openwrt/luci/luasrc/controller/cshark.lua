@@ -35,6 +35,22 @@ function index()
 		page.leaf = true
 end
 
+-- a cshark daemon takes captures over ubus, without one a cshark is started per capture
+function cshark_daemon()
+	local conn = require("ubus").connect()
+	if conn == nil then
+		return nil
+	end
+
+	-- only the daemon answers to status
+	if conn:call("cshark", "status", {}) == nil then
+		conn:close()
+		return nil
+	end
+
+	return conn
+end
+
 function cshark_iface_dump_start(ifname, value, flag, filter)
 	if ifname == nil or ifname == '' then
 		ifname = 'any'
@@ -53,6 +69,27 @@ function cshark_iface_dump_start(ifname, value, flag, filter)
 
 	luci.http.prepare_content("text/plain")
 
+	local conn = cshark_daemon()
+	if conn ~= nil then
+		local args = { interface = ifname }
+		if filter ~= '' then
+			args["filter"] = filter
+		end
+
+		if flag == 'P' then
+			args["packets"] = tonumber(value)
+		elseif flag == 'S' then
+			args["bytes"] = tonumber(value)
+		else
+			args["duration"] = tonumber(value)
+		end
+
+		local res = conn:call("cshark", "start", args)
+		conn:close()
+		luci.http.write(res ~= nil and "0" or "1")
+		return
+	end
+
 	local res = os.execute("(/sbin/cshark -i " .. ifname .. " -" .. flag .. " " .. value .. " -p /tmp/cshark-luci.pid " .. filter .. " > /tmp/cshark-luci.out 2>&1) &")
 	luci.http.write(tostring(res))
 end
@@ -60,6 +97,14 @@ end
 function cshark_iface_dump_stop()
 	luci.http.prepare_content("text/plain")
 
+	local conn = cshark_daemon()
+	if conn ~= nil then
+		local res = conn:call("cshark", "stop", {})
+		conn:close()
+		luci.http.write(res ~= nil and "0" or "1")
+		return
+	end
+
 	local f = io.open("/tmp/cshark-luci.pid", "rb")
 	local pid = f:read("*all")
 	io.close(f)
@@ -69,6 +114,12 @@ function cshark_iface_dump_stop()
 end
 
 function cshark_check_status()
+	local conn = cshark_daemon()
+	if conn ~= nil then
+		cshark_daemon_status(conn)
+		conn:close()
+		return
+	end
 
 	local msg = "";
 	local status;
@@ -95,6 +146,39 @@ function cshark_check_status()
 	res["status"] = status;
 	res["msg"] = msg;
 
+	-- cshark answers from its last sample, asking does not slow the capture down
+	local conn = require("ubus").connect()
+	if conn ~= nil then
+		res["stats"] = conn:call("cshark", "stats", {})
+		conn:close()
+	end
+
+	luci.http.write_json(res)
+end
+
+function cshark_daemon_status(conn)
+	local res = {}
+	local status = conn:call("cshark", "status", {}) or {}
+
+	res["status"] = 0
+	res["msg"] = ""
+	res["stats"] = status
+
+	if status.state == "capturing" or status.state == "uploading" or status.queued then
+		res["status"] = 1
+	else
+		local list = conn:call("cshark", "list", {})
+		local last = list and list.captures and list.captures[1]
+		if last ~= nil then
+			if last.url ~= nil then
+				res["msg"] = "... uploading completed!\n" .. last.url
+			else
+				res["msg"] = "capture " .. last.id .. " " .. last.state
+			end
+		end
+	end
+
+	luci.http.prepare_content("application/json")
 	luci.http.write_json(res)
 end
 
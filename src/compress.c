@@ -0,0 +1,349 @@
+/*
+ * Author: Luka Perkov <luka.perkov@sartura.hr>
+ *
+ * Copyright (C) 2014, QA Cafe, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * For more information see the project website [1].
+ *
+ * [1] https://www.cloudshark.org/
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef WITH_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef WITH_ZSTD
+#include <zstd.h>
+#endif
+
+#include "cshark.h"
+#include "compress.h"
+
+/* hand the output buffer on once it is full, or whenever a batch is done */
+static int cshark_compress_emit(struct cshark_compress *c)
+{
+	int rc;
+
+	if (!c->out_used)
+		return 0;
+
+	rc = c->cb(c->priv, c->out, c->out_used);
+	c->compressed += c->out_used;
+	c->out_used = 0;
+
+	return rc;
+}
+
+#ifdef WITH_ZLIB
+static int cshark_compress_gzip_open(struct cshark_compress *c, int level, int threads)
+{
+	z_stream *z;
+
+	if (threads > 1)
+		LOG("gzip compression runs on a single thread, ignoring %d threads\n", threads);
+
+	z = calloc(1, sizeof(*z));
+	if (!z) {
+		ERROR("compress: not enough memory\n");
+		return -1;
+	}
+	c->ctx = z;
+
+	/* window bits above 15 ask for a gzip header instead of a zlib one */
+	if (deflateInit2(z, level ? level : Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+			 Z_DEFAULT_STRATEGY) != Z_OK) {
+		ERROR("compress: could not initialize gzip\n");
+		free(z);
+		c->ctx = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+static int cshark_compress_gzip_run(struct cshark_compress *c, int flush)
+{
+	z_stream *z = c->ctx;
+	bool more;
+	int rc;
+
+	do {
+		z->next_out = c->out + c->out_used;
+		z->avail_out = COMPRESS_OUT_SIZE - c->out_used;
+
+		rc = deflate(z, flush);
+		if (rc == Z_STREAM_ERROR) {
+			ERROR("compress: gzip failed\n");
+			return -1;
+		}
+
+		/* a flush is only complete once deflate leaves room in the output */
+		if (flush == Z_FINISH)
+			more = rc != Z_STREAM_END;
+		else if (flush == Z_SYNC_FLUSH)
+			more = !z->avail_out;
+		else
+			more = z->avail_in > 0;
+
+		c->out_used = COMPRESS_OUT_SIZE - z->avail_out;
+		if (c->out_used == COMPRESS_OUT_SIZE && cshark_compress_emit(c))
+			return -1;
+	} while (more);
+
+	return 0;
+}
+
+static int cshark_compress_gzip_write(struct cshark_compress *c, const struct iovec *iov, int iovcnt,
+				      enum cshark_compress_mode mode)
+{
+	z_stream *z = c->ctx;
+	int i;
+
+	for (i = 0; i < iovcnt; i++) {
+		z->next_in = iov[i].iov_base;
+		z->avail_in = iov[i].iov_len;
+
+		if (cshark_compress_gzip_run(c, Z_NO_FLUSH))
+			return -1;
+	}
+
+	if (mode == COMPRESS_FLUSH)
+		return cshark_compress_gzip_run(c, Z_SYNC_FLUSH);
+	if (mode == COMPRESS_FINISH)
+		return cshark_compress_gzip_run(c, Z_FINISH);
+
+	return 0;
+}
+
+static size_t cshark_compress_gzip_bound(struct cshark_compress *c, size_t len)
+{
+	return deflateBound(c->ctx, len);
+}
+
+static void cshark_compress_gzip_close(struct cshark_compress *c)
+{
+	deflateEnd(c->ctx);
+	free(c->ctx);
+}
+
+static const struct cshark_compress_ops cshark_compress_gzip = {
+	.name = "gzip",
+	.open = cshark_compress_gzip_open,
+	.write = cshark_compress_gzip_write,
+	.bound = cshark_compress_gzip_bound,
+	.close = cshark_compress_gzip_close,
+};
+#endif
+
+#ifdef WITH_ZSTD
+static int cshark_compress_zstd_open(struct cshark_compress *c, int level, int threads)
+{
+	size_t rc;
+
+	c->ctx = ZSTD_createCCtx();
+	if (!c->ctx) {
+		ERROR("compress: could not initialize zstd\n");
+		return -1;
+	}
+
+	if (level)
+		ZSTD_CCtx_setParameter(c->ctx, ZSTD_c_compressionLevel, level);
+
+	/* zstd compresses on its own threads while capture goes on */
+	if (threads > 1) {
+		rc = ZSTD_CCtx_setParameter(c->ctx, ZSTD_c_nbWorkers, threads);
+		if (ZSTD_isError(rc))
+			LOG("zstd is built without threads, compressing on a single thread\n");
+	}
+
+	return 0;
+}
+
+static int cshark_compress_zstd_run(struct cshark_compress *c, ZSTD_inBuffer *in,
+				    ZSTD_EndDirective mode)
+{
+	ZSTD_outBuffer out;
+	size_t rc;
+
+	do {
+		out.dst = c->out;
+		out.size = COMPRESS_OUT_SIZE;
+		out.pos = c->out_used;
+
+		rc = ZSTD_compressStream2(c->ctx, &out, in, mode);
+		if (ZSTD_isError(rc)) {
+			ERROR("compress: zstd failed: %s\n", ZSTD_getErrorName(rc));
+			return -1;
+		}
+
+		c->out_used = out.pos;
+		if (c->out_used == COMPRESS_OUT_SIZE && cshark_compress_emit(c))
+			return -1;
+	} while (mode == ZSTD_e_continue ? in->pos < in->size : rc != 0);
+
+	return 0;
+}
+
+static int cshark_compress_zstd_write(struct cshark_compress *c, const struct iovec *iov, int iovcnt,
+				      enum cshark_compress_mode mode)
+{
+	ZSTD_inBuffer in;
+	int i;
+
+	for (i = 0; i < iovcnt; i++) {
+		in.src = iov[i].iov_base;
+		in.size = iov[i].iov_len;
+		in.pos = 0;
+
+		if (cshark_compress_zstd_run(c, &in, ZSTD_e_continue))
+			return -1;
+	}
+
+	if (mode == COMPRESS_CONTINUE)
+		return 0;
+
+	in.src = NULL;
+	in.size = in.pos = 0;
+
+	return cshark_compress_zstd_run(c, &in, mode == COMPRESS_FINISH ? ZSTD_e_end : ZSTD_e_flush);
+}
+
+static size_t cshark_compress_zstd_bound(__unused struct cshark_compress *c, size_t len)
+{
+	return ZSTD_compressBound(len);
+}
+
+static void cshark_compress_zstd_close(struct cshark_compress *c)
+{
+	ZSTD_freeCCtx(c->ctx);
+}
+
+static const struct cshark_compress_ops cshark_compress_zstd = {
+	.name = "zstd",
+	.open = cshark_compress_zstd_open,
+	.write = cshark_compress_zstd_write,
+	.bound = cshark_compress_zstd_bound,
+	.close = cshark_compress_zstd_close,
+};
+#endif
+
+static const struct cshark_compress_ops *cshark_compressors[] = {
+#ifdef WITH_ZLIB
+	&cshark_compress_gzip,
+#endif
+#ifdef WITH_ZSTD
+	&cshark_compress_zstd,
+#endif
+};
+
+const struct cshark_compress_ops *cshark_compress_find(const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(cshark_compressors); i++)
+		if (!strcmp(cshark_compressors[i]->name, name))
+			return cshark_compressors[i];
+
+	return NULL;
+}
+
+int cshark_compress_open(struct cshark_compress *c, const struct cshark_compress_ops *ops,
+			 int level, int threads, cshark_compress_out_cb cb, void *priv)
+{
+	memset(c, 0, sizeof(*c));
+
+	c->out = malloc(COMPRESS_OUT_SIZE);
+	if (!c->out) {
+		ERROR("compress: not enough memory\n");
+		return -1;
+	}
+
+	c->cb = cb;
+	c->priv = priv;
+
+	if (ops->open(c, level, threads)) {
+		free(c->out);
+		c->out = NULL;
+		return -1;
+	}
+	c->ops = ops;
+
+	return 0;
+}
+
+int cshark_compress_write(struct cshark_compress *c, const struct iovec *iov, int iovcnt)
+{
+	int i;
+
+	for (i = 0; i < iovcnt; i++) {
+		c->raw += iov[i].iov_len;
+		c->unflushed += iov[i].iov_len;
+	}
+
+	if (c->ops->write(c, iov, iovcnt, COMPRESS_CONTINUE))
+		return -1;
+
+	/* whatever is ready goes out with the batch so streams do not stall */
+	return cshark_compress_emit(c);
+}
+
+/* push out everything taken in so far without ending the stream */
+int cshark_compress_flush(struct cshark_compress *c)
+{
+	if (c->ops->write(c, NULL, 0, COMPRESS_FLUSH))
+		return -1;
+
+	c->unflushed = 0;
+
+	return cshark_compress_emit(c);
+}
+
+int cshark_compress_finish(struct cshark_compress *c)
+{
+	if (c->ops->write(c, NULL, 0, COMPRESS_FINISH))
+		return -1;
+
+	c->unflushed = 0;
+
+	return cshark_compress_emit(c);
+}
+
+/* most output len more input bytes can produce, on top of what was flushed already */
+size_t cshark_compress_bound(struct cshark_compress *c, size_t len)
+{
+	return c->ops->bound(c, c->unflushed + len) + COMPRESS_TRAILER_SIZE;
+}
+
+void cshark_compress_close(struct cshark_compress *c)
+{
+	if (!c->ops)
+		return;
+
+	c->ops->close(c);
+	free(c->out);
+	c->out = NULL;
+	c->ops = NULL;
+}
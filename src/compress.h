@@ -0,0 +1,92 @@
+/*
+ * Author: Luka Perkov <luka.perkov@sartura.hr>
+ *
+ * Copyright (C) 2014, QA Cafe, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * For more information see the project website [1].
+ *
+ * [1] https://www.cloudshark.org/
+ */
+
+#ifndef __CSHARK_COMPRESS_H__
+#define __CSHARK_COMPRESS_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+/* compressed data is handed on in chunks of at most this size */
+#define COMPRESS_OUT_SIZE (256 * 1024)
+
+/* room left for flush markers and the stream trailer when compressing into a budget */
+#define COMPRESS_TRAILER_SIZE 64
+
+enum cshark_compress_mode {
+	COMPRESS_CONTINUE,
+	COMPRESS_FLUSH,
+	COMPRESS_FINISH,
+};
+
+struct cshark_compress;
+
+typedef int (*cshark_compress_out_cb)(void *priv, const void *buf, size_t len);
+
+struct cshark_compress_ops {
+	const char *name;
+
+	int (*open)(struct cshark_compress *c, int level, int threads);
+	int (*write)(struct cshark_compress *c, const struct iovec *iov, int iovcnt,
+		     enum cshark_compress_mode mode);
+	size_t (*bound)(struct cshark_compress *c, size_t len);
+	void (*close)(struct cshark_compress *c);
+};
+
+struct cshark_compress {
+	const struct cshark_compress_ops *ops;
+	void *ctx;
+
+	uint8_t *out;
+	size_t out_used;
+
+	cshark_compress_out_cb cb;
+	void *priv;
+
+	/* bytes before and after compression */
+	uint64_t raw;
+	uint64_t compressed;
+
+	/* bytes taken in since the last flush, the compressor may still hold their output */
+	size_t unflushed;
+};
+
+const struct cshark_compress_ops *cshark_compress_find(const char *name);
+
+int cshark_compress_open(struct cshark_compress *c, const struct cshark_compress_ops *ops,
+			 int level, int threads, cshark_compress_out_cb cb, void *priv);
+int cshark_compress_write(struct cshark_compress *c, const struct iovec *iov, int iovcnt);
+int cshark_compress_flush(struct cshark_compress *c);
+int cshark_compress_finish(struct cshark_compress *c);
+size_t cshark_compress_bound(struct cshark_compress *c, size_t len);
+void cshark_compress_close(struct cshark_compress *c);
+
+#endif /* __CSHARK_COMPRESS_H__ */
@@ -38,6 +38,15 @@
 #include <sys/stat.h>
 
 #include "config.h"
+#include "dedup.h"
+#include "flow.h"
+#include "multipart.h"
+#include "shaper.h"
+#include "slice.h"
+#include "stats.h"
+#include "stream.h"
+#include "uclient.h"
+#include "tpacket.h"
 
 struct config config;
 
@@ -48,6 +57,53 @@ enum cshark_config {
 	CSHARK_CA_VERIFY,
 	CSHARK_DIR,
 	CSHARK_TAGS,
+	CSHARK_BACKEND,
+	CSHARK_RING_BLOCK_SIZE,
+	CSHARK_RING_BLOCK_NR,
+	CSHARK_RING_BLOCK_TIMEOUT,
+	CSHARK_WORKERS,
+	CSHARK_FANOUT,
+	CSHARK_CPUS,
+	CSHARK_WRITER,
+	CSHARK_DISK_BUDGET,
+	CSHARK_STREAM,
+	CSHARK_STREAM_BUFFER,
+	CSHARK_RECORDER_SIZE,
+	CSHARK_RECORDER_SECONDS,
+	CSHARK_UPLOAD_WINDOW,
+	CSHARK_UPLOAD_SENDFILE,
+	CSHARK_UPLOAD_RETRIES,
+	CSHARK_UPLOAD_BACKOFF,
+	CSHARK_UPLOAD_BACKOFF_MAX,
+	CSHARK_UPLOAD_RESUME,
+	CSHARK_UPLOAD_PARTS,
+	CSHARK_UPLOAD_PART_SIZE,
+	CSHARK_UPLOAD_RATE,
+	CSHARK_UPLOAD_BURST,
+	CSHARK_UPLOAD_SCHEDULE,
+	CSHARK_SPOOL,
+	CSHARK_SPOOL_DIR,
+	CSHARK_SPOOL_QUOTA,
+	CSHARK_DEDUP_WINDOW,
+	CSHARK_DEDUP_SIZE,
+	CSHARK_DEDUP_IGNORE_L2,
+	CSHARK_DEDUP_IGNORE_TTL,
+	CSHARK_FLOW_PACKETS,
+	CSHARK_FLOW_BYTES,
+	CSHARK_FLOW_SAMPLE,
+	CSHARK_FLOW_MEMORY,
+	CSHARK_FLOW_IDLE,
+	CSHARK_STATS_INTERVAL,
+	CSHARK_STATS_FILE,
+	CSHARK_SLICE,
+	CSHARK_SLICE_DNS_KEEP,
+	CSHARK_SLICE_HTTP_KEEP,
+	CSHARK_SLICE_TLS_KEEP,
+	CSHARK_SLICE_OTHER_KEEP,
+	CSHARK_FORMAT,
+	CSHARK_COMPRESS,
+	CSHARK_COMPRESS_LEVEL,
+	CSHARK_COMPRESS_THREADS,
 	__CSHARK_MAX
 };
 
@@ -57,7 +113,54 @@ const struct blobmsg_policy cshark_policy[__CSHARK_MAX] = {
 	[CSHARK_CA] = { .name = "ca", .type = BLOBMSG_TYPE_STRING },
 	[CSHARK_CA_VERIFY] = { .name = "ca_verify", .type = BLOBMSG_TYPE_BOOL },
 	[CSHARK_DIR] = { .name = "dir", .type = BLOBMSG_TYPE_STRING },
-	[CSHARK_TAGS] = { .name = "tags", .type = BLOBMSG_TYPE_STRING }
+	[CSHARK_TAGS] = { .name = "tags", .type = BLOBMSG_TYPE_STRING },
+	[CSHARK_BACKEND] = { .name = "backend", .type = BLOBMSG_TYPE_STRING },
+	[CSHARK_RING_BLOCK_SIZE] = { .name = "ring_block_size", .type = BLOBMSG_TYPE_INT32 },
+	[CSHARK_RING_BLOCK_NR] = { .name = "ring_block_nr", .type = BLOBMSG_TYPE_INT32 },
+	[CSHARK_RING_BLOCK_TIMEOUT] = { .name = "ring_block_timeout", .type = BLOBMSG_TYPE_INT32 },
+	[CSHARK_WORKERS] = { .name = "workers", .type = BLOBMSG_TYPE_INT32 },
+	[CSHARK_FANOUT] = { .name = "fanout", .type = BLOBMSG_TYPE_STRING },
+	[CSHARK_CPUS] = { .name = "cpus", .type = BLOBMSG_TYPE_STRING },
+	[CSHARK_WRITER] = { .name = "writer", .type = BLOBMSG_TYPE_STRING },
+	[CSHARK_DISK_BUDGET] = { .name = "disk_budget", .type = BLOBMSG_TYPE_INT32 },
+	[CSHARK_STREAM] = { .name = "stream", .type = BLOBMSG_TYPE_BOOL },
+	[CSHARK_STREAM_BUFFER] = { .name = "stream_buffer", .type = BLOBMSG_TYPE_INT32 },
+	[CSHARK_RECORDER_SIZE] = { .name = "recorder_size", .type = BLOBMSG_TYPE_INT32 },
+	[CSHARK_RECORDER_SECONDS] = { .name = "recorder_seconds", .type = BLOBMSG_TYPE_INT32 },
+	[CSHARK_UPLOAD_WINDOW] = { .name = "upload_window", .type = BLOBMSG_TYPE_INT32 },
+	[CSHARK_UPLOAD_SENDFILE] = { .name = "upload_sendfile", .type = BLOBMSG_TYPE_BOOL },
+	[CSHARK_UPLOAD_RETRIES] = { .name = "upload_retries", .type = BLOBMSG_TYPE_INT32 },
+	[CSHARK_UPLOAD_BACKOFF] = { .name = "upload_backoff", .type = BLOBMSG_TYPE_INT32 },
+	[CSHARK_UPLOAD_BACKOFF_MAX] = { .name = "upload_backoff_max", .type = BLOBMSG_TYPE_INT32 },
+	[CSHARK_UPLOAD_RESUME] = { .name = "upload_resume", .type = BLOBMSG_TYPE_BOOL },
+	[CSHARK_UPLOAD_PARTS] = { .name = "upload_parts", .type = BLOBMSG_TYPE_INT32 },
+	[CSHARK_UPLOAD_PART_SIZE] = { .name = "upload_part_size", .type = BLOBMSG_TYPE_INT32 },
+	[CSHARK_UPLOAD_RATE] = { .name = "upload_rate", .type = BLOBMSG_TYPE_INT32 },
+	[CSHARK_UPLOAD_BURST] = { .name = "upload_burst", .type = BLOBMSG_TYPE_INT32 },
+	[CSHARK_UPLOAD_SCHEDULE] = { .name = "upload_schedule", .type = BLOBMSG_TYPE_STRING },
+	[CSHARK_SPOOL] = { .name = "spool", .type = BLOBMSG_TYPE_BOOL },
+	[CSHARK_SPOOL_DIR] = { .name = "spool_dir", .type = BLOBMSG_TYPE_STRING },
+	[CSHARK_SPOOL_QUOTA] = { .name = "spool_quota", .type = BLOBMSG_TYPE_INT32 },
+	[CSHARK_DEDUP_WINDOW] = { .name = "dedup_window", .type = BLOBMSG_TYPE_INT32 },
+	[CSHARK_DEDUP_SIZE] = { .name = "dedup_size", .type = BLOBMSG_TYPE_INT32 },
+	[CSHARK_DEDUP_IGNORE_L2] = { .name = "dedup_ignore_l2", .type = BLOBMSG_TYPE_BOOL },
+	[CSHARK_DEDUP_IGNORE_TTL] = { .name = "dedup_ignore_ttl", .type = BLOBMSG_TYPE_BOOL },
+	[CSHARK_FLOW_PACKETS] = { .name = "flow_packets", .type = BLOBMSG_TYPE_INT32 },
+	[CSHARK_FLOW_BYTES] = { .name = "flow_bytes", .type = BLOBMSG_TYPE_INT32 },
+	[CSHARK_FLOW_SAMPLE] = { .name = "flow_sample", .type = BLOBMSG_TYPE_INT32 },
+	[CSHARK_FLOW_MEMORY] = { .name = "flow_memory", .type = BLOBMSG_TYPE_INT32 },
+	[CSHARK_FLOW_IDLE] = { .name = "flow_idle", .type = BLOBMSG_TYPE_INT32 },
+	[CSHARK_STATS_INTERVAL] = { .name = "stats_interval", .type = BLOBMSG_TYPE_INT32 },
+	[CSHARK_STATS_FILE] = { .name = "stats_file", .type = BLOBMSG_TYPE_STRING },
+	[CSHARK_SLICE] = { .name = "slice", .type = BLOBMSG_TYPE_BOOL },
+	[CSHARK_SLICE_DNS_KEEP] = { .name = "slice_dns", .type = BLOBMSG_TYPE_INT32 },
+	[CSHARK_SLICE_HTTP_KEEP] = { .name = "slice_http", .type = BLOBMSG_TYPE_INT32 },
+	[CSHARK_SLICE_TLS_KEEP] = { .name = "slice_tls", .type = BLOBMSG_TYPE_INT32 },
+	[CSHARK_SLICE_OTHER_KEEP] = { .name = "slice_other", .type = BLOBMSG_TYPE_INT32 },
+	[CSHARK_FORMAT] = { .name = "format", .type = BLOBMSG_TYPE_STRING },
+	[CSHARK_COMPRESS] = { .name = "compress", .type = BLOBMSG_TYPE_STRING },
+	[CSHARK_COMPRESS_LEVEL] = { .name = "compress_level", .type = BLOBMSG_TYPE_INT32 },
+	[CSHARK_COMPRESS_THREADS] = { .name = "compress_threads", .type = BLOBMSG_TYPE_INT32 }
 };
 
 const struct uci_blob_param_list config_attr_list = {
@@ -65,6 +168,49 @@ const struct uci_blob_param_list config_attr_list = {
 	.params = cshark_policy
 };
 
+/* what an empty config leaves behind, config_load() only overrides the options that are set */
+void config_defaults(void)
+{
+	memset(&config, 0, sizeof(config));
+
+	config.ca_verify = true;
+	snprintf(config.dir, PATH_MAX, "/tmp");
+
+	snprintf(config.backend, sizeof(config.backend), "pcap");
+	config.ring_block_size = TPACKET_BLOCK_SIZE;
+	config.ring_block_nr = TPACKET_BLOCK_NR;
+	config.ring_block_timeout = TPACKET_BLOCK_TIMEOUT;
+	config.workers = 1;
+	snprintf(config.fanout, sizeof(config.fanout), "hash");
+	snprintf(config.writer, sizeof(config.writer), "writev");
+	config.stream_buffer = STREAM_BUFFER * 1024;
+
+	config.upload_window = UPLOAD_WINDOW * 1024;
+	config.upload_retries = UPLOAD_RETRIES;
+	config.upload_backoff = UPLOAD_BACKOFF;
+	config.upload_backoff_max = UPLOAD_BACKOFF_MAX;
+	config.upload_resume = true;
+	config.upload_parts = 1;
+	config.upload_part_size = UPLOAD_PART_SIZE * 1024;
+	config.upload_burst = UPLOAD_BURST * 1024;
+
+	config.dedup_size = DEDUP_SIZE;
+	config.dedup_ignore_l2 = true;
+	config.flow_memory = FLOW_MEMORY;
+	config.flow_idle = FLOW_IDLE;
+	config.stats_interval = STATS_INTERVAL;
+	config.slice_dns = SLICE_DNS;
+	config.slice_http = SLICE_HTTP;
+	config.slice_tls = SLICE_TLS;
+	config.slice_other = SLICE_OTHER;
+
+	snprintf(config.format, sizeof(config.format), "pcap");
+	snprintf(config.compress, sizeof(config.compress), "none");
+	config.compress_threads = 1;
+}
+
+/* benchmarks neither read nor write uci, bench/bench.c stands in for these */
+#ifndef WITH_BENCH
 int config_load(void)
 {
 	int rc;
@@ -86,6 +232,8 @@ int config_load(void)
 
 	blobmsg_parse(cshark_policy, __CSHARK_MAX, tb, blob_data(buf.head), blob_len(buf.head));
 
+	config_defaults();
+
 	if (!(c = tb[CSHARK_URL])) {
 		rc = -1;
 		goto exit;
@@ -104,38 +252,221 @@ int config_load(void)
 	snprintf(config.token, TOKEN_MAX, "%s", blobmsg_get_string(c));
 
 	/* ca option is optional */
-	if (!(c = tb[CSHARK_CA])) {
-		memset(config.ca, 0, PATH_MAX);
-	} else {
+	if ((c = tb[CSHARK_CA]))
 		snprintf(config.ca, PATH_MAX, "%s", blobmsg_get_string(c));
-	}
 
 	/* ca_verify option is optional */
-	if (!(c = tb[CSHARK_CA_VERIFY])) {
-		config.ca_verify = true;
-	} else {
+	if ((c = tb[CSHARK_CA_VERIFY]))
 		config.ca_verify = blobmsg_get_bool(c);
-	}
 
 	/* dir option is optional */
-	if (!(c = tb[CSHARK_DIR])) {
-		snprintf(config.dir, PATH_MAX, "/tmp");
-	} else {
+	if ((c = tb[CSHARK_DIR]))
 		snprintf(config.dir, PATH_MAX, "%s", blobmsg_get_string(c));
-	}
 
 	/* tags option is optional */
-	if (!(c = tb[CSHARK_TAGS])) {
-		memset(config.tags, 0, BUFSIZ);
-	} else {
+	if ((c = tb[CSHARK_TAGS]))
 		snprintf(config.tags, BUFSIZ, "%s", blobmsg_get_string(c));
-	}
+
+	/* backend option is optional */
+	if ((c = tb[CSHARK_BACKEND]))
+		snprintf(config.backend, sizeof(config.backend), "%s", blobmsg_get_string(c));
+
+	/* ring_block_size option is optional, value is in KiB */
+	if ((c = tb[CSHARK_RING_BLOCK_SIZE]))
+		config.ring_block_size = blobmsg_get_u32(c) * 1024;
+
+	/* ring_block_nr option is optional */
+	if ((c = tb[CSHARK_RING_BLOCK_NR]))
+		config.ring_block_nr = blobmsg_get_u32(c);
+
+	/* ring_block_timeout option is optional, value is in milliseconds */
+	if ((c = tb[CSHARK_RING_BLOCK_TIMEOUT]))
+		config.ring_block_timeout = blobmsg_get_u32(c);
+
+	/* workers option is optional */
+	if ((c = tb[CSHARK_WORKERS]))
+		config.workers = blobmsg_get_u32(c);
+
+	/* fanout option is optional */
+	if ((c = tb[CSHARK_FANOUT]))
+		snprintf(config.fanout, sizeof(config.fanout), "%s", blobmsg_get_string(c));
+
+	/* cpus option is optional */
+	if ((c = tb[CSHARK_CPUS]))
+		snprintf(config.cpus, BUFSIZ, "%s", blobmsg_get_string(c));
+
+	/* writer option is optional */
+	if ((c = tb[CSHARK_WRITER]))
+		snprintf(config.writer, sizeof(config.writer), "%s", blobmsg_get_string(c));
+
+	/* disk_budget option is optional, value is in KiB */
+	if ((c = tb[CSHARK_DISK_BUDGET]))
+		config.disk_budget = (uint64_t) blobmsg_get_u32(c) * 1024;
+
+	/* stream option is optional */
+	if ((c = tb[CSHARK_STREAM]))
+		config.stream = blobmsg_get_bool(c);
+
+	/* stream_buffer option is optional, value is in KiB */
+	if ((c = tb[CSHARK_STREAM_BUFFER]) && blobmsg_get_u32(c))
+		config.stream_buffer = (size_t) blobmsg_get_u32(c) * 1024;
+	if (config.stream_buffer < STREAM_BUFFER_MIN)
+		config.stream_buffer = STREAM_BUFFER_MIN;
+
+	/* recorder_size option is optional, value is in KiB */
+	if ((c = tb[CSHARK_RECORDER_SIZE]))
+		config.recorder_size = (size_t) blobmsg_get_u32(c) * 1024;
+
+	/* recorder_seconds option is optional */
+	if ((c = tb[CSHARK_RECORDER_SECONDS]))
+		config.recorder_seconds = blobmsg_get_u32(c);
+
+	/* upload_window option is optional, value is in KiB */
+	if ((c = tb[CSHARK_UPLOAD_WINDOW]) && blobmsg_get_u32(c))
+		config.upload_window = (size_t) blobmsg_get_u32(c) * 1024;
+
+	/* upload_sendfile option is optional, it only applies to plain http urls */
+	if ((c = tb[CSHARK_UPLOAD_SENDFILE]))
+		config.upload_sendfile = blobmsg_get_bool(c);
+
+	/* upload_retries option is optional */
+	if ((c = tb[CSHARK_UPLOAD_RETRIES]))
+		config.upload_retries = blobmsg_get_u32(c);
+
+	/* upload_backoff option is optional, value is in milliseconds */
+	if ((c = tb[CSHARK_UPLOAD_BACKOFF]) && blobmsg_get_u32(c))
+		config.upload_backoff = blobmsg_get_u32(c);
+
+	/* upload_backoff_max option is optional, value is in milliseconds */
+	if ((c = tb[CSHARK_UPLOAD_BACKOFF_MAX]) && blobmsg_get_u32(c))
+		config.upload_backoff_max = blobmsg_get_u32(c);
+
+	/* upload_resume option is optional */
+	if ((c = tb[CSHARK_UPLOAD_RESUME]))
+		config.upload_resume = blobmsg_get_bool(c);
+
+	/* upload_parts option is optional */
+	if ((c = tb[CSHARK_UPLOAD_PARTS]) && blobmsg_get_u32(c))
+		config.upload_parts = blobmsg_get_u32(c);
+
+	/* upload_part_size option is optional, value is in KiB */
+	if ((c = tb[CSHARK_UPLOAD_PART_SIZE]) && blobmsg_get_u32(c))
+		config.upload_part_size = (uint64_t) blobmsg_get_u32(c) * 1024;
+
+	/* upload_rate option is optional, value is in kbit/s */
+	if ((c = tb[CSHARK_UPLOAD_RATE]))
+		config.upload_rate = blobmsg_get_u32(c);
+
+	/* upload_burst option is optional, value is in KiB, a bucket smaller than a quantum never fills */
+	if ((c = tb[CSHARK_UPLOAD_BURST]) && blobmsg_get_u32(c))
+		config.upload_burst = (uint64_t) blobmsg_get_u32(c) * 1024;
+	if (config.upload_burst < SHAPER_QUANTUM)
+		config.upload_burst = SHAPER_QUANTUM;
+
+	/* upload_schedule option is optional */
+	if ((c = tb[CSHARK_UPLOAD_SCHEDULE]))
+		snprintf(config.upload_schedule, BUFSIZ, "%s", blobmsg_get_string(c));
+
+	/* spool option is optional */
+	if ((c = tb[CSHARK_SPOOL]))
+		config.spool = blobmsg_get_bool(c);
+
+	/* spool_dir option is optional, it defaults to a directory in dir */
+	if ((c = tb[CSHARK_SPOOL_DIR]))
+		snprintf(config.spool_dir, PATH_MAX, "%s", blobmsg_get_string(c));
+
+	/* spool_quota option is optional, value is in KiB */
+	if ((c = tb[CSHARK_SPOOL_QUOTA]))
+		config.spool_quota = (uint64_t) blobmsg_get_u32(c) * 1024;
+
+	/* dedup_window option is optional, value is in milliseconds */
+	if ((c = tb[CSHARK_DEDUP_WINDOW]))
+		config.dedup_window = blobmsg_get_u32(c);
+
+	/* dedup_size option is optional */
+	if ((c = tb[CSHARK_DEDUP_SIZE]) && blobmsg_get_u32(c))
+		config.dedup_size = blobmsg_get_u32(c);
+
+	/* dedup_ignore_l2 option is optional */
+	if ((c = tb[CSHARK_DEDUP_IGNORE_L2]))
+		config.dedup_ignore_l2 = blobmsg_get_bool(c);
+
+	/* dedup_ignore_ttl option is optional */
+	if ((c = tb[CSHARK_DEDUP_IGNORE_TTL]))
+		config.dedup_ignore_ttl = blobmsg_get_bool(c);
+
+	/* flow_packets option is optional */
+	if ((c = tb[CSHARK_FLOW_PACKETS]))
+		config.flow_packets = blobmsg_get_u32(c);
+
+	/* flow_bytes option is optional */
+	if ((c = tb[CSHARK_FLOW_BYTES]))
+		config.flow_bytes = blobmsg_get_u32(c);
+
+	/* flow_sample option is optional */
+	if ((c = tb[CSHARK_FLOW_SAMPLE]))
+		config.flow_sample = blobmsg_get_u32(c);
+
+	/* flow_memory option is optional, value is in KiB */
+	if ((c = tb[CSHARK_FLOW_MEMORY]) && blobmsg_get_u32(c))
+		config.flow_memory = blobmsg_get_u32(c);
+
+	/* flow_idle option is optional, value is in seconds */
+	if ((c = tb[CSHARK_FLOW_IDLE]))
+		config.flow_idle = blobmsg_get_u32(c);
+
+	/* stats_interval option is optional, value is in milliseconds */
+	if ((c = tb[CSHARK_STATS_INTERVAL]))
+		config.stats_interval = blobmsg_get_u32(c);
+
+	/* stats_file option is optional */
+	if ((c = tb[CSHARK_STATS_FILE]))
+		snprintf(config.stats_file, PATH_MAX, "%s", blobmsg_get_string(c));
+
+	/* slice option is optional */
+	if ((c = tb[CSHARK_SLICE]))
+		config.slice = blobmsg_get_bool(c);
+
+	/* slice_dns option is optional */
+	if ((c = tb[CSHARK_SLICE_DNS_KEEP]))
+		config.slice_dns = blobmsg_get_u32(c);
+
+	/* slice_http option is optional */
+	if ((c = tb[CSHARK_SLICE_HTTP_KEEP]))
+		config.slice_http = blobmsg_get_u32(c);
+
+	/* slice_tls option is optional */
+	if ((c = tb[CSHARK_SLICE_TLS_KEEP]))
+		config.slice_tls = blobmsg_get_u32(c);
+
+	/* slice_other option is optional */
+	if ((c = tb[CSHARK_SLICE_OTHER_KEEP]))
+		config.slice_other = blobmsg_get_u32(c);
+
+	/* format option is optional */
+	if ((c = tb[CSHARK_FORMAT]))
+		snprintf(config.format, sizeof(config.format), "%s", blobmsg_get_string(c));
+
+	/* compress option is optional */
+	if ((c = tb[CSHARK_COMPRESS]))
+		snprintf(config.compress, sizeof(config.compress), "%s", blobmsg_get_string(c));
+
+	/* compress_level option is optional, 0 picks the default of the compressor */
+	if ((c = tb[CSHARK_COMPRESS_LEVEL]))
+		config.compress_level = blobmsg_get_u32(c);
+
+	/* compress_threads option is optional */
+	if ((c = tb[CSHARK_COMPRESS_THREADS]))
+		config.compress_threads = blobmsg_get_u32(c);
 
 	/* we are adding '/' later in the code */
 	if (config.dir[strlen(config.dir) - 1] == '/') {
 		config.dir[strlen(config.dir) - 1] = 0;
 	}
 
+	if (!config.spool_dir[0])
+		snprintf(config.spool_dir, PATH_MAX, "%s/spool", config.dir);
+
 	rc = 0;
 exit:
 	blob_buf_free(&buf);
@@ -180,3 +511,4 @@ exit:
 
 	return rc;
 }
+#endif /* WITH_BENCH */
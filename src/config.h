@@ -36,6 +36,7 @@
 #define TOKEN_MAX 32 + 1
 #define URL_MAX 8 + HOST_NAME_MAX + 7 + 1
 
+void config_defaults(void);
 int config_load(void);
 int config_save_url(char *url);
 
@@ -46,6 +47,53 @@ struct config {
 	bool ca_verify;
 	char dir[PATH_MAX];
 	char tags[BUFSIZ];
+	char backend[16];
+	unsigned int ring_block_size;
+	unsigned int ring_block_nr;
+	unsigned int ring_block_timeout;
+	unsigned int workers;
+	char fanout[16];
+	char cpus[BUFSIZ];
+	char writer[16];
+	uint64_t disk_budget;
+	bool stream;
+	size_t stream_buffer;
+	size_t recorder_size;
+	uint32_t recorder_seconds;
+	size_t upload_window;
+	bool upload_sendfile;
+	unsigned int upload_retries;
+	unsigned int upload_backoff;
+	unsigned int upload_backoff_max;
+	bool upload_resume;
+	unsigned int upload_parts;
+	uint64_t upload_part_size;
+	uint32_t upload_rate;
+	uint64_t upload_burst;
+	char upload_schedule[BUFSIZ];
+	bool spool;
+	char spool_dir[PATH_MAX];
+	uint64_t spool_quota;
+	uint32_t dedup_window;
+	uint32_t dedup_size;
+	bool dedup_ignore_l2;
+	bool dedup_ignore_ttl;
+	uint32_t flow_packets;
+	uint64_t flow_bytes;
+	uint32_t flow_sample;
+	uint32_t flow_memory;
+	uint32_t flow_idle;
+	uint32_t stats_interval;
+	char stats_file[PATH_MAX];
+	bool slice;
+	uint32_t slice_dns;
+	uint32_t slice_http;
+	uint32_t slice_tls;
+	uint32_t slice_other;
+	char format[16];
+	char compress[16];
+	int compress_level;
+	int compress_threads;
 };
 
 extern struct config config;
@@ -30,6 +30,7 @@
 
 #define _GNU_SOURCE
 
+#include <getopt.h>
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -37,41 +38,80 @@
 #include <pcap.h>
 
 #include <libubox/uloop.h>
-#include <libubox/uclient.h>
 
 #include "config.h"
 #include "cshark.h"
-#include "pcap.h"
-#include "uclient.h"
+#include "daemon.h"
+#include "session.h"
+#include "spool.h"
+#include "ubus.h"
 
 struct cshark cshark;
 
 static void show_help()
 {
-	printf("usage: %s [-iwskTPSpvh] [ expression ]\n\n%s", PROJECT_NAME, \
-		"  -i  listen on interface\n" \
+	printf("usage: %s [-irwskTPSDpbBntjFAWfzZxmuMLEodRUvh] [ expression ]\n\n%s", PROJECT_NAME, \
+		"  -i  listen on interface, or on a comma separated list of interfaces\n" \
+		"  -r  read packets from a capture file instead, uploaded while reading unless -w or -k is given\n" \
 		"  -w  write the raw packets to specific file\n" \
 		"  -s  snarf snaplen bytes of data\n" \
 		"  -k  keep the file after uploading it to cloudshark.org\n" \
 		"  -T  stop capture after this many seconds have passed, use 0 for no timeout\n" \
 		"  -P  stop capture after this many packets have been captured, use 0 for no limit\n" \
 		"  -S  stop capture after this many bytes have been saved, use 0 for no limit\n" \
+		"  -D  disk budget for the capture file in KiB, use 0 for all free space\n" \
 		"  -p  save pid to a file\n" \
+		"  -b  capture backend, 'pcap' or 'tpacket'\n" \
+		"  -B  tpacket ring block size in KiB\n" \
+		"  -n  tpacket ring block count\n" \
+		"  -t  tpacket ring block timeout in milliseconds\n" \
+		"  -j  number of capture workers, requires the tpacket backend\n" \
+		"  -F  fanout mode for workers, 'hash', 'cpu' or 'queue'\n" \
+		"  -A  comma separated list of cpus to pin workers to\n" \
+		"  -W  capture file writer, 'writev', 'mmap' or 'io_uring'\n" \
+		"  -f  capture file format, 'pcap' or 'pcapng'\n" \
+		"  -z  compress the capture, 'none', 'gzip' or 'zstd'\n" \
+		"  -Z  compression level, use 0 for the default\n" \
+		"  -x  slice packets by protocol, keeping headers and a few payload bytes\n" \
+		"  -m  drop duplicate packets seen within this many milliseconds, use 0 to keep them\n" \
+		"  --flow-packets  keep this many packets of every flow, use 0 for no limit\n" \
+		"  --flow-bytes    keep this many bytes of every flow, use 0 for no limit\n" \
+		"  --flow-sample   keep one flow out of this many, picked by a hash of its addresses and ports\n" \
+		"  -u  upload while capturing, without a capture file\n" \
+		"  -M  memory buffer for the upload while capturing in KiB\n" \
+		"  -L  flight recorder size in KiB, keeps the last packets in memory and uploads them on SIGUSR1\n" \
+		"  -E  drop packets older than this many seconds from the flight recorder\n" \
+		"  -o  write live capture and upload statistics as JSON to this file\n" \
+		"  -d  run as a daemon, captures are started and stopped over ubus\n" \
+		"  -R  upload a capture kept after its upload failed, resuming where it stopped\n" \
+		"  -U  upload the captures waiting in the spool and exit\n" \
 		"  -v  shows version\n" \
 		"  -h  shows this help\n");
 }
 
-static void dump_timeout_callback(struct uloop_timeout *t)
-{
-	DEBUG("timeout reached, stopping capture\n");
-	uloop_end();
-}
+enum {
+	OPT_FLOW_PACKETS = 0x100,
+	OPT_FLOW_BYTES,
+	OPT_FLOW_SAMPLE,
+};
+
+static const struct option long_options[] = {
+	{ "flow-packets", required_argument, NULL, OPT_FLOW_PACKETS },
+	{ "flow-bytes", required_argument, NULL, OPT_FLOW_BYTES },
+	{ "flow-sample", required_argument, NULL, OPT_FLOW_SAMPLE },
+	{ NULL, 0, NULL, 0 }
+};
 
 int main(int argc, char *argv[])
 {
 	int rc, c;
-	int keep = 0;
+	bool run_daemon = false;
+	bool run_spool = false;
 	char *pid_filename = NULL;
+	char *resume_filename = NULL;
+	struct cshark_options options;
+
+	memset(&options, 0, sizeof(options));
 
 	/* zero out main struct */
 	memset(&cshark, 0, sizeof(cshark));
@@ -85,15 +125,44 @@ int main(int argc, char *argv[])
 	cshark.limit_packets = 0;
 	cshark.caplen = 0;
 	cshark.limit_caplen = 0;
+	cshark.limit_seconds = 0;
+	cshark.keep = false;
+	cshark.disk_budget = 0;
+	cshark.backend = CSHARK_BACKEND_PCAP;
+	cshark.ring_block_size = 0;
+	cshark.ring_block_nr = 0;
+	cshark.ring_block_timeout = 0;
+	cshark.workers = 0;
+	cshark.fanout = CSHARK_FANOUT_HASH;
+	cshark.cpus = NULL;
+	cshark.stream = false;
+	cshark.stream_buffer = 0;
+	cshark.recorder_size = 0;
+	cshark.recorder_seconds = 0;
+	cshark.format = CSHARK_FORMAT_PCAP;
+	cshark.compress_ops = NULL;
+	cshark.compress_level = 0;
+	cshark.slice = false;
+	cshark.dedup_window = 0;
+	cshark.flow_packets = 0;
+	cshark.flow_bytes = 0;
+	cshark.flow_sample = 0;
+	cshark.state = CSHARK_STATE_IDLE;
+	cshark.stats_file = NULL;
 
 	openlog(PROJECT_NAME, LOG_PERROR | LOG_PID, LOG_DAEMON);
 
-	while ((c = getopt(argc, argv, "i:w:s:T:P:S:p:kvh")) != -1) {
+	while ((c = getopt_long(argc, argv, "i:r:w:s:T:P:S:D:p:b:B:n:t:j:F:A:W:f:z:Z:xm:uM:L:E:o:dR:Ukvh",
+				long_options, NULL)) != -1) {
 		switch (c) {
 			case 'i':
 				cshark.interface = optarg;
 				break;
 
+			case 'r':
+				cshark.input = optarg;
+				break;
+
 			case 'w':
 				cshark.filename = strdup(optarg);
 				if (!cshark.filename) {
@@ -110,13 +179,9 @@ int main(int argc, char *argv[])
 
 			case 'T':
 			{
-				struct uloop_timeout dump_timeout = {
-					.cb = dump_timeout_callback
-				};
-
 				int dump_timeout_s = atoi(optarg);
 				if (dump_timeout_s > 0)
-					uloop_timeout_set(&dump_timeout, dump_timeout_s * 1000);
+					cshark.limit_seconds = dump_timeout_s;
 
 				break;
 			}
@@ -129,6 +194,10 @@ int main(int argc, char *argv[])
 				cshark.limit_caplen = atoi(optarg);
 				break;
 
+			case 'D':
+				cshark.disk_budget = strtoull(optarg, NULL, 10) * 1024;
+				break;
+
 			case 'p':
 			{
 				pid_t pid = getpid();
@@ -148,8 +217,104 @@ int main(int argc, char *argv[])
 				break;
 			}
 
+			case 'b':
+				options.backend = optarg;
+				break;
+
+			case 'B':
+				cshark.ring_block_size = atoi(optarg) * 1024;
+				break;
+
+			case 'n':
+				cshark.ring_block_nr = atoi(optarg);
+				break;
+
+			case 't':
+				cshark.ring_block_timeout = atoi(optarg);
+				break;
+
+			case 'j':
+				cshark.workers = atoi(optarg);
+				break;
+
+			case 'F':
+				options.fanout = optarg;
+				break;
+
+			case 'A':
+				cshark.cpus = optarg;
+				break;
+
+			case 'W':
+				options.writer = optarg;
+				break;
+
+			case 'f':
+				options.format = optarg;
+				break;
+
+			case 'z':
+				options.compress = optarg;
+				break;
+
+			case 'Z':
+				cshark.compress_level = atoi(optarg);
+				break;
+
+			case 'u':
+				cshark.stream = true;
+				break;
+
+			case 'x':
+				cshark.slice = true;
+				break;
+
+			case 'm':
+				cshark.dedup_window = atoi(optarg);
+				break;
+
+			case OPT_FLOW_PACKETS:
+				cshark.flow_packets = atoi(optarg);
+				break;
+
+			case OPT_FLOW_BYTES:
+				cshark.flow_bytes = strtoull(optarg, NULL, 10);
+				break;
+
+			case OPT_FLOW_SAMPLE:
+				cshark.flow_sample = atoi(optarg);
+				break;
+
+			case 'M':
+				cshark.stream_buffer = (size_t) atoi(optarg) * 1024;
+				break;
+
+			case 'L':
+				cshark.recorder_size = (size_t) atoi(optarg) * 1024;
+				break;
+
+			case 'E':
+				cshark.recorder_seconds = atoi(optarg);
+				break;
+
+			case 'o':
+				cshark.stats_file = optarg;
+				break;
+
+			case 'd':
+				run_daemon = true;
+				break;
+
+			case 'R':
+				resume_filename = optarg;
+				break;
+
+			case 'U':
+				run_spool = true;
+				break;
+
 			case 'k':
-				keep = 1;
+				cshark.keep = true;
 				break;
 
 			case 'v':
@@ -178,58 +343,56 @@ int main(int argc, char *argv[])
 		goto exit;
 	}
 
-	if (!cshark.filename) {
-		int len = 0;
-		len = snprintf(cshark.filename, 0, "%s/cshark.pcap-XXXXXX", config.dir);
-
-		cshark.filename = calloc(len + 1, sizeof(char));
-		if (!cshark.filename) {
-			ERROR("not enough memory\n");
-			rc = EXIT_FAILURE;
-			goto exit;
-		}
-		snprintf(cshark.filename, len + 1, "%s/cshark.pcap-XXXXXX", config.dir);
+	if (run_daemon) {
+		rc = cshark_daemon_run(&cshark, &options) ? EXIT_FAILURE : EXIT_SUCCESS;
+		goto exit;
+	}
 
-		int fd = mkstemp(cshark.filename);
-		if (fd == -1) {
-			ERROR("unable to create dump file\n");
-			rc = EXIT_FAILURE;
-			goto exit;
-		}
+	if (run_spool) {
+		rc = cshark_spool_run(&cshark) ? EXIT_FAILURE : EXIT_SUCCESS;
+		goto exit;
 	}
 
 	uloop_init();
 
-	rc = cshark_pcap_init(&cshark);
+	if (resume_filename)
+		rc = cshark_session_resume(&cshark, resume_filename);
+	else
+		rc = cshark_session_setup(&cshark, &options);
 	if (rc) {
 		rc = EXIT_FAILURE;
 		goto exit;
 	}
 
-	printf("capturing traffic to file: '%s' ...\n", cshark.filename);
-	uloop_run();
-
-	cshark_pcap_done(&cshark);
-	printf("\n%lu packets captured\n", (long unsigned int) cshark.packets);
+	if (cshark.stats_interval)
+		cshark_ubus_init(&cshark, false);
 
-	rc = cshark_uclient_init(&cshark);
-	if (rc) {
-		rc = EXIT_FAILURE;
-		goto exit;
+	if (!resume_filename) {
+		rc = cshark_session_start(&cshark);
+		if (!rc) {
+			uloop_run();
+			rc = cshark_session_stop(&cshark);
+		}
+		if (rc) {
+			rc = EXIT_FAILURE;
+			goto exit;
+		}
 	}
 
-	printf("uploading capture ...\n");
 	uloop_run();
 
+	cshark_session_finish(&cshark, true);
+	cshark_ubus_done(&cshark);
+
 	uloop_done();
 
 	rc = EXIT_SUCCESS;
 
 exit:
-	cshark_pcap_done(&cshark);
-	cshark_uclient_done(&cshark);
-	if (!keep) remove(cshark.filename);
-	free(cshark.filename);
+	if (!run_daemon && !run_spool) {
+		cshark_session_finish(&cshark, rc == EXIT_SUCCESS);
+		cshark_ubus_done(&cshark);
+	}
 	if (pid_filename) remove(pid_filename);
 
 	return rc;
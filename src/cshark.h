@@ -36,22 +36,88 @@
 #include <unistd.h>
 
 #include <syslog.h>
+#include <pthread.h>
 
 #include <pcap.h>
 
 #include <libubox/uclient.h>
 
+#include "writer.h"
+
 #define PROJECT_NAME "cshark"
 #define PROJECT_VERSION "v0.1"
 
+enum cshark_backend {
+	CSHARK_BACKEND_PCAP,
+	CSHARK_BACKEND_TPACKET,
+};
+
+enum cshark_fanout {
+	CSHARK_FANOUT_HASH,
+	CSHARK_FANOUT_CPU,
+	CSHARK_FANOUT_QUEUE,
+};
+
+enum cshark_format {
+	CSHARK_FORMAT_PCAP,
+	CSHARK_FORMAT_PCAPNG,
+};
+
+enum cshark_state {
+	CSHARK_STATE_IDLE,
+	CSHARK_STATE_CAPTURING,
+	CSHARK_STATE_UPLOADING,
+	CSHARK_STATE_DONE,
+	CSHARK_STATE_FAILED,
+};
+
+enum cshark_slice_class {
+	CSHARK_SLICE_DNS,
+	CSHARK_SLICE_HTTP,
+	CSHARK_SLICE_TLS,
+	CSHARK_SLICE_OTHER,
+	__CSHARK_SLICE_MAX
+};
+
+struct cshark_iface;
+struct cshark_recorder;
+struct cshark_dedup;
+struct cshark_flow_table;
+
 struct cshark {
 	char *interface;
+	/* capture file read instead of the interface, see offline.c */
+	char *input;
 	char *filename;
 	int snaplen;
 	char *filter;
 
+	enum cshark_backend backend;
+	unsigned int ring_block_size;
+	unsigned int ring_block_nr;
+	unsigned int ring_block_timeout;
+
+	unsigned int workers;
+	enum cshark_fanout fanout;
+	char *cpus;
+
 	pcap_t *p;
-	pcap_dumper_t *p_dumper;
+	int linktype;
+	enum cshark_format format;
+	/* packet header timestamps carry nanoseconds instead of microseconds */
+	bool nano;
+	/* interface capture is bound to, 0 for 'any' */
+	int ifindex;
+	/* set when capturing on a list of interfaces, see merge.c */
+	struct cshark_iface *ifaces;
+	unsigned int ifaces_nr;
+	const struct cshark_writer_ops *writer_ops;
+	struct cshark_writer writer;
+
+	/* optional compression of everything the writer sees, NULL for none */
+	const struct cshark_compress_ops *compress_ops;
+	int compress_level;
+	int compress_threads;
 	struct bpf_program p_bfp;
 
 	uint64_t packets;
@@ -60,7 +126,82 @@ struct cshark {
 	uint64_t caplen;
 	uint64_t limit_caplen;
 
+	unsigned int limit_seconds;
+	/* leave the capture file in place after uploading it */
+	bool keep;
+
+	/* keep headers and this many payload bytes per protocol class, see slice.c */
+	bool slice;
+	uint32_t slice_keep[__CSHARK_SLICE_MAX];
+	uint64_t slice_saved;
+
+	/* drop repeats seen within this many milliseconds, see dedup.c */
+	struct cshark_dedup *dedup;
+	uint32_t dedup_window;
+
+	/* keep the first packets and bytes of every flow, and 1 in flow_sample flows, see flow.c */
+	struct cshark_flow_table *flows;
+	uint32_t flow_packets;
+	uint64_t flow_bytes;
+	uint32_t flow_sample;
+
+	/* kernel counters, collected when capture stops */
+	uint64_t stats_recv;
+	uint64_t stats_drop;
+	uint64_t stats_ifdrop;
+
+	/* bytes the dump file may take on disk, 0 for all of the free space */
+	uint64_t disk_budget;
+
+	/* room taken under the -P and -S limits, shared by all capture workers */
+	uint64_t reserved_packets;
+	uint64_t reserved_caplen;
+
+	/* serializes access to the dump file when capture runs on workers */
+	pthread_mutex_t lock;
+	bool stop;
+	bool paused;
+
+	/* upload while capturing instead of going through a dump file */
+	bool stream;
+	size_t stream_buffer;
+	/* bytes the stream left out because the upload fell behind, the capture is incomplete */
+	uint64_t stream_dropped;
+
+	/* keep the last packets in memory and upload them on SIGUSR1 */
+	struct cshark_recorder *recorder;
+	size_t recorder_size;
+	uint32_t recorder_seconds;
+
 	struct uclient *ucl;
+	/* upper bound for the data queued in uclient while uploading */
+	size_t upload_window;
+	bool upload_failed;
+	/* the server turned the failed upload down, sending it again will not help */
+	bool upload_rejected;
+	/* called instead of ending the main loop when an upload completes */
+	void (*upload_done)(struct cshark *cs);
+
+	/* bytes handed to the connection so far, size is 0 while it is not known yet */
+	uint64_t upload_sent;
+	uint64_t upload_size;
+	/* where the last upload can be looked at */
+	char upload_url[256];
+	/* names the upload to a server that can resume it, and where this attempt starts */
+	char upload_id[33];
+	uint64_t upload_offset;
+	/* current upload rate limit in bytes per second, 0 for none, and ms spent held back by it */
+	uint64_t upload_rate;
+	uint64_t upload_throttled;
+	/* connections opened for uploads and the ms they took until ready, and requests that went out on an open one */
+	uint32_t upload_connections;
+	uint64_t upload_connect_ms;
+	uint32_t upload_reused;
+
+	/* what the stats report, see stats.c */
+	enum cshark_state state;
+	uint32_t stats_interval;
+	char *stats_file;
 };
 
 extern struct cshark cshark;
@@ -0,0 +1,339 @@
+/*
+ * Author: Luka Perkov <luka.perkov@sartura.hr>
+ *
+ * Copyright (C) 2014, QA Cafe, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * For more information see the project website [1].
+ *
+ * [1] https://www.cloudshark.org/
+ */
+
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#include <libubox/uloop.h>
+#include <libubus.h>
+
+#include "config.h"
+#include "cshark.h"
+#include "daemon.h"
+#include "session.h"
+#include "spool.h"
+#include "stats.h"
+#include "ubus.h"
+
+const struct blobmsg_policy cshark_daemon_start_policy[__DAEMON_START_MAX] = {
+	[DAEMON_START_INTERFACE] = { .name = "interface", .type = BLOBMSG_TYPE_STRING },
+	[DAEMON_START_FILTER] = { .name = "filter", .type = BLOBMSG_TYPE_STRING },
+	[DAEMON_START_DURATION] = { .name = "duration", .type = BLOBMSG_TYPE_INT32 },
+	[DAEMON_START_PACKETS] = { .name = "packets", .type = BLOBMSG_TYPE_INT32 },
+	[DAEMON_START_BYTES] = { .name = "bytes", .type = BLOBMSG_TYPE_INT32 },
+	[DAEMON_START_SNAPLEN] = { .name = "snaplen", .type = BLOBMSG_TYPE_INT32 },
+	[DAEMON_START_FORMAT] = { .name = "format", .type = BLOBMSG_TYPE_STRING },
+	[DAEMON_START_KEEP] = { .name = "keep", .type = BLOBMSG_TYPE_BOOL },
+};
+
+/* command line state every capture starts from */
+static struct cshark daemon_cs;
+static struct cshark_options daemon_options;
+
+static struct cshark_daemon_capture history[DAEMON_HISTORY];
+static unsigned int history_nr;
+
+static uint32_t session_id;
+static time_t session_started;
+static char *session_interface;
+static char *session_filter;
+
+/* one start request waits for the running capture, a copy of its arguments */
+static struct blob_attr *pending;
+
+static time_t config_mtime;
+
+/* uci is parsed again only when it changed since the last capture */
+static void cshark_daemon_reload(void)
+{
+	struct stat st;
+
+	if (stat(DAEMON_CONFIG, &st) || st.st_mtime == config_mtime)
+		return;
+
+	config_mtime = st.st_mtime;
+	if (config_load())
+		ERROR("unable to reload configuration\n");
+}
+
+static void cshark_daemon_record(void)
+{
+	struct cshark_daemon_capture *c = &history[history_nr++ % DAEMON_HISTORY];
+
+	memset(c, 0, sizeof(*c));
+	c->id = session_id;
+	c->state = cshark.state == CSHARK_STATE_DONE ? CSHARK_STATE_DONE : CSHARK_STATE_FAILED;
+	snprintf(c->interface, sizeof(c->interface), "%s", cshark.interface);
+	c->started = session_started;
+	c->packets = cshark.packets;
+	c->caplen = cshark.caplen;
+	snprintf(c->url, sizeof(c->url), "%s", cshark.upload_url);
+}
+
+static int cshark_daemon_begin(struct blob_attr *msg);
+
+static void cshark_daemon_end(bool ok)
+{
+	struct blob_attr *next;
+
+	cshark_session_finish(&cshark, ok);
+	cshark_daemon_record();
+
+	/* the last sample stays around for 'status' until the next capture starts */
+	cshark.state = CSHARK_STATE_IDLE;
+
+	free(session_interface);
+	free(session_filter);
+	session_interface = NULL;
+	session_filter = NULL;
+
+	if (!pending)
+		return;
+
+	next = pending;
+	pending = NULL;
+	cshark_daemon_begin(next);
+	free(next);
+}
+
+static int cshark_daemon_begin(struct blob_attr *msg)
+{
+	struct blob_attr *tb[__DAEMON_START_MAX];
+	struct cshark_options o = daemon_options;
+	int rc;
+
+	blobmsg_parse(cshark_daemon_start_policy, __DAEMON_START_MAX, tb, blob_data(msg), blob_len(msg));
+
+	cshark_daemon_reload();
+
+	cshark = daemon_cs;
+	session_id++;
+	session_started = time(NULL);
+
+	if (tb[DAEMON_START_INTERFACE]) {
+		session_interface = strdup(blobmsg_get_string(tb[DAEMON_START_INTERFACE]));
+		cshark.interface = session_interface;
+	}
+
+	if (tb[DAEMON_START_FILTER]) {
+		session_filter = strdup(blobmsg_get_string(tb[DAEMON_START_FILTER]));
+		cshark.filter = session_filter;
+	}
+
+	if ((tb[DAEMON_START_INTERFACE] && !session_interface) ||
+	    (tb[DAEMON_START_FILTER] && !session_filter)) {
+		ERROR("not enough memory\n");
+		rc = -1;
+		goto exit;
+	}
+
+	if (tb[DAEMON_START_DURATION])
+		cshark.limit_seconds = blobmsg_get_u32(tb[DAEMON_START_DURATION]);
+	if (tb[DAEMON_START_PACKETS])
+		cshark.limit_packets = blobmsg_get_u32(tb[DAEMON_START_PACKETS]);
+	if (tb[DAEMON_START_BYTES])
+		cshark.limit_caplen = blobmsg_get_u32(tb[DAEMON_START_BYTES]);
+	if (tb[DAEMON_START_SNAPLEN] && blobmsg_get_u32(tb[DAEMON_START_SNAPLEN]))
+		cshark.snaplen = blobmsg_get_u32(tb[DAEMON_START_SNAPLEN]);
+	if (tb[DAEMON_START_FORMAT])
+		o.format = blobmsg_get_string(tb[DAEMON_START_FORMAT]);
+	if (tb[DAEMON_START_KEEP])
+		cshark.keep = blobmsg_get_bool(tb[DAEMON_START_KEEP]);
+
+	rc = cshark_session_setup(&cshark, &o);
+	if (rc)
+		goto exit;
+
+	rc = cshark_session_start(&cshark);
+
+exit:
+	if (rc)
+		cshark_daemon_end(false);
+
+	return rc;
+}
+
+/* called whenever uloop_run() returns, moves the capture on to its next state */
+static void cshark_daemon_step(void)
+{
+	switch (cshark.state) {
+		case CSHARK_STATE_CAPTURING:
+			if (cshark_session_stop(&cshark))
+				cshark_daemon_end(false);
+			break;
+
+		case CSHARK_STATE_UPLOADING:
+			cshark_daemon_end(true);
+			break;
+
+		default:
+			break;
+	}
+}
+
+int cshark_daemon_start(struct blob_attr *msg, struct blob_buf *b)
+{
+	if (cshark.state == CSHARK_STATE_IDLE) {
+		if (cshark_daemon_begin(msg))
+			return UBUS_STATUS_INVALID_ARGUMENT;
+
+		blobmsg_add_u32(b, "id", session_id);
+		blobmsg_add_u8(b, "queued", false);
+		return UBUS_STATUS_OK;
+	}
+
+	if (pending)
+		return UBUS_STATUS_UNKNOWN_ERROR;
+
+	pending = blob_memdup(msg);
+	if (!pending)
+		return UBUS_STATUS_UNKNOWN_ERROR;
+
+	blobmsg_add_u32(b, "id", session_id + 1);
+	blobmsg_add_u8(b, "queued", true);
+
+	return UBUS_STATUS_OK;
+}
+
+int cshark_daemon_stop(struct blob_buf *b)
+{
+	switch (cshark.state) {
+		/* the main loop stops the capture and starts the upload */
+		case CSHARK_STATE_CAPTURING:
+			uloop_end();
+			break;
+
+		case CSHARK_STATE_UPLOADING:
+			cshark_daemon_end(false);
+			break;
+
+		default:
+			return UBUS_STATUS_NO_DATA;
+	}
+
+	blobmsg_add_u32(b, "id", session_id);
+
+	return UBUS_STATUS_OK;
+}
+
+void cshark_daemon_status(struct blob_buf *b)
+{
+	blobmsg_add_u32(b, "id", session_id);
+	blobmsg_add_u8(b, "queued", pending != NULL);
+	if (cshark.state != CSHARK_STATE_IDLE && cshark.upload_url[0])
+		blobmsg_add_string(b, "url", cshark.upload_url);
+
+	cshark_stats_blob(&cshark, b);
+
+	if (config.spool)
+		cshark_spool_blob(b);
+}
+
+/* most recent capture first */
+void cshark_daemon_list(struct blob_buf *b)
+{
+	struct cshark_daemon_capture *c;
+	unsigned int i, n;
+	void *a, *t;
+
+	n = history_nr < DAEMON_HISTORY ? history_nr : DAEMON_HISTORY;
+
+	a = blobmsg_open_array(b, "captures");
+	for (i = 0; i < n; i++) {
+		c = &history[(history_nr - 1 - i) % DAEMON_HISTORY];
+
+		t = blobmsg_open_table(b, NULL);
+		blobmsg_add_u32(b, "id", c->id);
+		blobmsg_add_string(b, "state", cshark_stats_state(c->state));
+		blobmsg_add_string(b, "interface", c->interface);
+		blobmsg_add_u64(b, "started", c->started);
+		blobmsg_add_u64(b, "packets", c->packets);
+		blobmsg_add_u64(b, "bytes", c->caplen);
+		if (c->url[0])
+			blobmsg_add_string(b, "url", c->url);
+		blobmsg_close_table(b, t);
+	}
+	blobmsg_close_array(b, a);
+}
+
+int cshark_daemon_run(struct cshark *cs, const struct cshark_options *o)
+{
+	struct stat st;
+	int rc;
+
+	if (cs->filename) {
+		ERROR("every capture gets its own file, '-w' can not be used with '-d'\n");
+		return -1;
+	}
+
+	daemon_cs = *cs;
+	daemon_options = *o;
+
+	if (!stat(DAEMON_CONFIG, &st))
+		config_mtime = st.st_mtime;
+
+	cs->state = CSHARK_STATE_IDLE;
+
+	uloop_init();
+
+	rc = cshark_ubus_init(cs, true);
+	if (rc)
+		goto exit;
+
+	/* captures left in the spool by an earlier run */
+	if (config.spool)
+		cshark_spool_kick();
+
+	printf("waiting for captures to be started over ubus ...\n");
+
+	for (;;) {
+		rc = uloop_run();
+		if (rc == SIGINT || rc == SIGTERM)
+			break;
+
+		cshark_daemon_step();
+	}
+
+	rc = 0;
+
+exit:
+	free(pending);
+	pending = NULL;
+	if (cs->state != CSHARK_STATE_IDLE)
+		cshark_daemon_end(false);
+
+	cshark_ubus_done(cs);
+	uloop_done();
+
+	return rc;
+}
@@ -0,0 +1,74 @@
+/*
+ * Author: Luka Perkov <luka.perkov@sartura.hr>
+ *
+ * Copyright (C) 2014, QA Cafe, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * For more information see the project website [1].
+ *
+ * [1] https://www.cloudshark.org/
+ */
+
+#ifndef __CSHARK_DAEMON_H__
+#define __CSHARK_DAEMON_H__
+
+#include <libubox/blobmsg.h>
+
+#include "cshark.h"
+#include "session.h"
+
+#define DAEMON_CONFIG "/etc/config/cshark"
+
+/* finished captures remembered for 'list' */
+#define DAEMON_HISTORY 16
+
+enum {
+	DAEMON_START_INTERFACE,
+	DAEMON_START_FILTER,
+	DAEMON_START_DURATION,
+	DAEMON_START_PACKETS,
+	DAEMON_START_BYTES,
+	DAEMON_START_SNAPLEN,
+	DAEMON_START_FORMAT,
+	DAEMON_START_KEEP,
+	__DAEMON_START_MAX
+};
+
+extern const struct blobmsg_policy cshark_daemon_start_policy[__DAEMON_START_MAX];
+
+struct cshark_daemon_capture {
+	uint32_t id;
+	enum cshark_state state;
+	char interface[64];
+	time_t started;
+	uint64_t packets;
+	uint64_t caplen;
+	char url[256];
+};
+
+int cshark_daemon_run(struct cshark *cs, const struct cshark_options *o);
+int cshark_daemon_start(struct blob_attr *msg, struct blob_buf *b);
+int cshark_daemon_stop(struct blob_buf *b);
+void cshark_daemon_status(struct blob_buf *b);
+void cshark_daemon_list(struct blob_buf *b);
+
+#endif /* __CSHARK_DAEMON_H__ */
@@ -0,0 +1,217 @@
+/*
+ * Author: Luka Perkov <luka.perkov@sartura.hr>
+ *
+ * Copyright (C) 2014, QA Cafe, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * For more information see the project website [1].
+ *
+ * [1] https://www.cloudshark.org/
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cshark.h"
+#include "config.h"
+#include "dedup.h"
+#include "slice.h"
+
+/*
+ * Hardware crc32c where the target has it, two independent lanes keep the
+ * unit busy. Anything else gets a multiply and shift mix of the same shape.
+ */
+#if defined(__SSE4_2__) && defined(__x86_64__)
+#include <nmmintrin.h>
+
+static inline uint64_t cshark_dedup_mix(uint64_t h, uint64_t w)
+{
+	return _mm_crc32_u64(h, w);
+}
+#elif defined(__ARM_FEATURE_CRC32) && defined(__aarch64__)
+#include <arm_acle.h>
+
+static inline uint64_t cshark_dedup_mix(uint64_t h, uint64_t w)
+{
+	return __crc32cd((uint32_t) h, w);
+}
+#else
+static inline uint64_t cshark_dedup_mix(uint64_t h, uint64_t w)
+{
+	h = (h ^ w) * 0x9e3779b97f4a7c15ULL;
+	return h ^ (h >> 29);
+}
+#endif
+
+struct cshark_dedup_hash {
+	uint64_t a;
+	uint64_t b;
+};
+
+static struct cshark_dedup dedup;
+
+static inline uint64_t cshark_dedup_load(const u_char *p)
+{
+	uint64_t w;
+
+	memcpy(&w, p, sizeof(w));
+	return w;
+}
+
+static void cshark_dedup_update(struct cshark_dedup_hash *h, const u_char *p, size_t len)
+{
+	uint64_t w = 0;
+
+	for (; len >= 16; p += 16, len -= 16) {
+		h->a = cshark_dedup_mix(h->a, cshark_dedup_load(p));
+		h->b = cshark_dedup_mix(h->b, cshark_dedup_load(p + 8));
+	}
+
+	if (len >= 8) {
+		h->a = cshark_dedup_mix(h->a, cshark_dedup_load(p));
+		p += 8;
+		len -= 8;
+	}
+
+	if (len) {
+		memcpy(&w, p, len);
+		h->b = cshark_dedup_mix(h->b, w);
+	}
+}
+
+bool cshark_dedup(struct cshark *cs, int linktype, const struct pcap_pkthdr *hdr, const u_char *p)
+{
+	struct cshark_dedup *d = cs->dedup;
+	struct cshark_dedup_hash h;
+	struct cshark_dedup_bucket *b;
+	struct cshark_dedup_entry *e, *victim;
+	u_char ip[40];
+	uint64_t key, ts, age;
+	int off = -1, version = 0, start = 0, hl, i;
+
+	if (d->ignore_l2 || d->ignore_ttl)
+		off = cshark_slice_l3(linktype, p, hdr->caplen, &version);
+
+	/* the same frame crossing a bridge or a vlan device gets a different link layer */
+	if (off >= 0 && d->ignore_l2)
+		start = off;
+
+	h.a = hdr->len - start;
+	h.b = ~h.a;
+
+	if (off >= 0 && d->ignore_ttl) {
+		hl = version == 4 ? 20 : 40;
+		memcpy(ip, p + off, hl);
+
+		/* a routed copy differs in its ttl and, for ipv4, in the checksum over it */
+		if (version == 4) {
+			ip[8] = 0;
+			ip[10] = 0;
+			ip[11] = 0;
+		} else {
+			ip[7] = 0;
+		}
+
+		cshark_dedup_update(&h, p + start, off - start);
+		cshark_dedup_update(&h, ip, hl);
+		cshark_dedup_update(&h, p + off + hl, hdr->caplen - off - hl);
+	} else {
+		cshark_dedup_update(&h, p + start, hdr->caplen - start);
+	}
+
+	key = h.a ^ (h.b << 32 | h.b >> 32);
+	ts = (uint64_t) hdr->ts.tv_sec * 1000000000 + (uint64_t) hdr->ts.tv_usec * (cs->nano ? 1 : 1000);
+
+	/* copies from different interfaces do not have to arrive in order */
+	b = &d->buckets[key & d->mask];
+	victim = &b->e[0];
+	for (i = 0; i < DEDUP_WAYS; i++) {
+		e = &b->e[i];
+
+		if (e->key == key && e->ts) {
+			age = ts > e->ts ? ts - e->ts : e->ts - ts;
+			if (age <= d->window) {
+				d->suppressed++;
+				return true;
+			}
+
+			victim = e;
+			break;
+		}
+
+		if (e->ts < victim->ts)
+			victim = e;
+	}
+
+	victim->key = key;
+	victim->ts = ts;
+
+	return false;
+}
+
+int cshark_dedup_init(struct cshark *cs)
+{
+	struct cshark_dedup *d = &dedup;
+	uint32_t size = DEDUP_WAYS;
+	int rc;
+
+	memset(d, 0, sizeof(*d));
+
+	while (size < config.dedup_size && size < (1U << 24))
+		size <<= 1;
+
+	d->mask = size / DEDUP_WAYS - 1;
+	d->window = (uint64_t) cs->dedup_window * 1000000;
+	d->ignore_l2 = config.dedup_ignore_l2;
+	d->ignore_ttl = config.dedup_ignore_ttl;
+
+	/* the table is sized once, lookups never allocate */
+	rc = posix_memalign((void **) &d->buckets, sizeof(struct cshark_dedup_bucket),
+			    (size / DEDUP_WAYS) * sizeof(struct cshark_dedup_bucket));
+	if (rc) {
+		d->buckets = NULL;
+		ERROR("dedup: unable to allocate %u entries: %s\n", size, strerror(rc));
+		return -1;
+	}
+	memset(d->buckets, 0, (size / DEDUP_WAYS) * sizeof(struct cshark_dedup_bucket));
+
+	DEBUG("dedup: %u entries, %u ms window\n", size, cs->dedup_window);
+
+	cs->dedup = d;
+
+	return 0;
+}
+
+void cshark_dedup_done(struct cshark *cs)
+{
+	struct cshark_dedup *d = &dedup;
+
+	if (!d->buckets)
+		return;
+
+	LOG("suppressed %lu duplicate packets\n", (long unsigned int) d->suppressed);
+
+	free(d->buckets);
+	d->buckets = NULL;
+	cs->dedup = NULL;
+}
@@ -0,0 +1,73 @@
+/*
+ * Author: Luka Perkov <luka.perkov@sartura.hr>
+ *
+ * Copyright (C) 2014, QA Cafe, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * For more information see the project website [1].
+ *
+ * [1] https://www.cloudshark.org/
+ */
+
+#ifndef __CSHARK_DEDUP_H__
+#define __CSHARK_DEDUP_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <pcap.h>
+
+#include "cshark.h"
+
+/* default table size in entries, rounded up to a power of two */
+#define DEDUP_SIZE 4096
+
+/* entries sharing a bucket, one bucket fills one cache line */
+#define DEDUP_WAYS 4
+
+struct cshark_dedup_entry {
+	uint64_t key;
+	uint64_t ts;
+};
+
+struct cshark_dedup_bucket {
+	struct cshark_dedup_entry e[DEDUP_WAYS];
+} __attribute__((aligned(64)));
+
+struct cshark_dedup {
+	struct cshark_dedup_bucket *buckets;
+	uint32_t mask;
+
+	/* packets with the same key closer than this many nanoseconds are repeats */
+	uint64_t window;
+
+	bool ignore_l2;
+	bool ignore_ttl;
+
+	uint64_t suppressed;
+};
+
+int cshark_dedup_init(struct cshark *cs);
+bool cshark_dedup(struct cshark *cs, int linktype, const struct pcap_pkthdr *hdr, const u_char *p);
+void cshark_dedup_done(struct cshark *cs);
+
+#endif /* __CSHARK_DEDUP_H__ */
@@ -0,0 +1,253 @@
+/*
+ * Author: Luka Perkov <luka.perkov@sartura.hr>
+ *
+ * Copyright (C) 2014, QA Cafe, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * For more information see the project website [1].
+ *
+ * [1] https://www.cloudshark.org/
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "cshark.h"
+#include "config.h"
+#include "flow.h"
+#include "slice.h"
+
+static struct cshark_flow_table table;
+
+static inline uint64_t cshark_flow_fnv(uint64_t h, uint8_t b)
+{
+	return (h ^ b) * 0x100000001b3ULL;
+}
+
+/*
+ * Sampling has to pick the same flows on every router, so the hash only
+ * looks at bytes in network order and never depends on the cpu.
+ */
+static uint64_t cshark_flow_hash(const struct cshark_flow_key *key)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+	int i, j;
+
+	for (i = 0; i < 2; i++)
+		for (j = 0; j < 16; j++)
+			h = cshark_flow_fnv(h, key->addr[i][j]);
+
+	for (i = 0; i < 2; i++) {
+		h = cshark_flow_fnv(h, key->port[i] >> 8);
+		h = cshark_flow_fnv(h, key->port[i] & 0xff);
+	}
+
+	h = cshark_flow_fnv(h, key->proto);
+	h = cshark_flow_fnv(h, key->family);
+
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+
+	return h;
+}
+
+static int cshark_flow_key(int linktype, const struct pcap_pkthdr *hdr, const u_char *p,
+			   struct cshark_flow_key *key)
+{
+	const u_char *ip, *l4 = NULL;
+	uint8_t addr[16];
+	uint16_t port;
+	unsigned int ihl;
+	bool ports;
+	int off, version;
+
+	off = cshark_slice_l3(linktype, p, hdr->caplen, &version);
+	if (off < 0)
+		return -1;
+
+	ip = p + off;
+	memset(key, 0, sizeof(*key));
+	key->family = version;
+
+	if (version == 4) {
+		ihl = (ip[0] & 0xf) * 4;
+		key->proto = ip[9];
+		memcpy(key->addr[0], ip + 12, 4);
+		memcpy(key->addr[1], ip + 16, 4);
+
+		/* later fragments carry no ports */
+		if (!((ip[6] << 8 | ip[7]) & 0x1fff) && off + ihl + 4 <= hdr->caplen)
+			l4 = ip + ihl;
+	} else {
+		memcpy(key->addr[0], ip + 8, 16);
+		memcpy(key->addr[1], ip + 24, 16);
+
+		/* extension headers sit between the fixed header and the ports */
+		off = cshark_slice_ipv6_ext(p, hdr->caplen, off, &key->proto, &ports);
+		if (off >= 0 && ports && off + 4 <= hdr->caplen)
+			l4 = p + off;
+	}
+
+	if (l4 && (key->proto == 6 || key->proto == 17 || key->proto == 132)) {
+		key->port[0] = l4[0] << 8 | l4[1];
+		key->port[1] = l4[2] << 8 | l4[3];
+	}
+
+	off = memcmp(key->addr[0], key->addr[1], sizeof(addr));
+	if (off > 0 || (!off && key->port[0] > key->port[1])) {
+		memcpy(addr, key->addr[0], sizeof(addr));
+		memcpy(key->addr[0], key->addr[1], sizeof(addr));
+		memcpy(key->addr[1], addr, sizeof(addr));
+
+		port = key->port[0];
+		key->port[0] = key->port[1];
+		key->port[1] = port;
+	}
+
+	return 0;
+}
+
+bool cshark_flow_admit(struct cshark *cs, int linktype, const struct pcap_pkthdr *hdr, const u_char *p)
+{
+	struct cshark_flow_table *t = cs->flows;
+	struct cshark_flow_key key;
+	struct cshark_flow *f, *victim = NULL;
+	uint64_t h, ts;
+	bool keep;
+	int i;
+
+	/* anything that is not ip is not part of a flow and always kept */
+	if (cshark_flow_key(linktype, hdr, p, &key))
+		return true;
+
+	h = cshark_flow_hash(&key);
+
+	if (cs->flow_sample > 1 && h % cs->flow_sample) {
+		t->sampled_out++;
+		return false;
+	}
+
+	if (!t->flows)
+		return true;
+
+	ts = (uint64_t) hdr->ts.tv_sec * 1000000000 + (uint64_t) hdr->ts.tv_usec * (cs->nano ? 1 : 1000);
+
+	/* entries are replaced in place and never emptied, so the whole window is looked at */
+	for (i = 0; i < FLOW_PROBE; i++) {
+		f = &t->flows[(h + i) & t->mask];
+
+		if (!f->packets) {
+			if (!victim || victim->packets)
+				victim = f;
+			continue;
+		}
+
+		if (f->hash == h && !memcmp(&f->key, &key, sizeof(key)))
+			goto found;
+
+		if (!victim || (victim->packets && f->last < victim->last))
+			victim = f;
+	}
+
+	f = victim;
+	if (!f->packets)
+		t->used++;
+	else if (ts > f->last && ts - f->last > t->idle)
+		t->evicted_idle++;
+	else
+		t->evicted_lru++;
+
+	memset(f, 0, sizeof(*f));
+	f->hash = h;
+	f->key = key;
+	t->seen++;
+
+found:
+	keep = (!cs->flow_packets || f->packets < cs->flow_packets) &&
+	       (!cs->flow_bytes || f->bytes < cs->flow_bytes);
+
+	if (f->packets < UINT32_MAX)
+		f->packets++;
+	f->bytes += hdr->len;
+	f->last = ts;
+
+	if (!keep)
+		t->capped++;
+
+	return keep;
+}
+
+int cshark_flow_init(struct cshark *cs)
+{
+	struct cshark_flow_table *t = &table;
+	size_t size = 1;
+
+	memset(t, 0, sizeof(*t));
+
+	/* sampling alone needs no table */
+	if (cs->flow_packets || cs->flow_bytes) {
+		while (size * 2 * sizeof(struct cshark_flow) <= (size_t) config.flow_memory * 1024)
+			size *= 2;
+		if (size < FLOW_PROBE)
+			size = FLOW_PROBE;
+
+		t->flows = calloc(size, sizeof(struct cshark_flow));
+		if (!t->flows) {
+			ERROR("flow: unable to allocate %lu entries\n", (long unsigned int) size);
+			return -1;
+		}
+
+		t->mask = size - 1;
+		t->idle = (uint64_t) config.flow_idle * 1000000000;
+
+		DEBUG("flow: %lu entries, %u s idle\n", (long unsigned int) size, config.flow_idle);
+	}
+
+	cs->flows = t;
+
+	return 0;
+}
+
+void cshark_flow_done(struct cshark *cs)
+{
+	struct cshark_flow_table *t = &table;
+
+	if (!cs->flows)
+		return;
+
+	if (cs->flow_sample > 1)
+		LOG("flow: %lu packets sampled out\n", (long unsigned int) t->sampled_out);
+
+	if (t->flows) {
+		LOG("flow: %lu flows, %u of %u entries used, %lu idle and %lu active evicted\n",
+			(long unsigned int) t->seen, t->used, t->mask + 1,
+			(long unsigned int) t->evicted_idle, (long unsigned int) t->evicted_lru);
+		LOG("flow: %lu packets over the per flow limit\n", (long unsigned int) t->capped);
+	}
+
+	free(t->flows);
+	t->flows = NULL;
+	cs->flows = NULL;
+}
@@ -0,0 +1,83 @@
+/*
+ * Author: Luka Perkov <luka.perkov@sartura.hr>
+ *
+ * Copyright (C) 2014, QA Cafe, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * For more information see the project website [1].
+ *
+ * [1] https://www.cloudshark.org/
+ */
+
+#ifndef __CSHARK_FLOW_H__
+#define __CSHARK_FLOW_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <pcap.h>
+
+#include "cshark.h"
+
+/* default memory for the flow table in KiB */
+#define FLOW_MEMORY 1024
+
+/* default seconds without a packet before a flow may be evicted */
+#define FLOW_IDLE 60
+
+/* slots looked at from the home slot, also the eviction candidates */
+#define FLOW_PROBE 8
+
+/* addresses are stored lowest first so both directions share one entry */
+struct cshark_flow_key {
+	uint8_t addr[2][16];
+	uint16_t port[2];
+	uint8_t proto;
+	uint8_t family;
+};
+
+struct cshark_flow {
+	uint64_t hash;
+	uint64_t last;
+	uint64_t bytes;
+	uint32_t packets;
+	struct cshark_flow_key key;
+};
+
+struct cshark_flow_table {
+	struct cshark_flow *flows;
+	uint32_t mask;
+	uint64_t idle;
+
+	uint32_t used;
+	uint64_t seen;
+	uint64_t evicted_idle;
+	uint64_t evicted_lru;
+	uint64_t capped;
+	uint64_t sampled_out;
+};
+
+int cshark_flow_init(struct cshark *cs);
+bool cshark_flow_admit(struct cshark *cs, int linktype, const struct pcap_pkthdr *hdr, const u_char *p);
+void cshark_flow_done(struct cshark *cs);
+
+#endif /* __CSHARK_FLOW_H__ */
@@ -0,0 +1,407 @@
+/*
+ * Author: Luka Perkov <luka.perkov@sartura.hr>
+ *
+ * Copyright (C) 2014, QA Cafe, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * For more information see the project website [1].
+ *
+ * [1] https://www.cloudshark.org/
+ */
+
+#include <time.h>
+
+#include <libubox/uloop.h>
+
+#include "cshark.h"
+#include "merge.h"
+#include "pcap.h"
+
+static void cshark_merge_timeout_cb(struct uloop_timeout *t);
+
+static struct uloop_timeout merge_timeout = { .cb = cshark_merge_timeout_cb };
+
+static int cshark_merge_push(struct cshark_merge_queue *q, const struct pcap_pkthdr *hdr,
+			     const u_char *sp)
+{
+	size_t need = sizeof(*hdr) + hdr->caplen;
+
+	/* records never wrap, like in the flight recorder */
+	if (!q->wrap) {
+		if (q->size - q->head < need) {
+			if (q->tail < need)
+				return -1;
+
+			q->wrap = q->head;
+			q->head = 0;
+		}
+	} else if (q->tail - q->head < need) {
+		return -1;
+	}
+
+	memcpy(q->buf + q->head, hdr, sizeof(*hdr));
+	memcpy(q->buf + q->head + sizeof(*hdr), sp, hdr->caplen);
+	q->head += need;
+	q->count++;
+
+	return 0;
+}
+
+static void cshark_merge_peek(struct cshark_merge_queue *q, struct pcap_pkthdr *hdr,
+			      const u_char **sp)
+{
+	memcpy(hdr, q->buf + q->tail, sizeof(*hdr));
+	*sp = q->buf + q->tail + sizeof(*hdr);
+}
+
+static void cshark_merge_pop(struct cshark_merge_queue *q)
+{
+	struct pcap_pkthdr hdr;
+
+	memcpy(&hdr, q->buf + q->tail, sizeof(hdr));
+	q->tail += sizeof(hdr) + hdr.caplen;
+	q->count--;
+
+	if (q->wrap && q->tail == q->wrap) {
+		q->tail = 0;
+		q->wrap = 0;
+	}
+
+	if (!q->count)
+		q->head = q->tail = q->wrap = 0;
+}
+
+static uint64_t cshark_merge_ns(struct cshark *cs, const struct timeval *ts)
+{
+	return (uint64_t) ts->tv_sec * 1000000000 + ts->tv_usec * (cs->nano ? 1 : 1000);
+}
+
+/* each interface delivers in order, so the merge only ever looks at the queue heads */
+static struct cshark_iface *cshark_merge_oldest(struct cshark *cs, bool *all, uint64_t *ts)
+{
+	struct cshark_iface *oldest = NULL;
+	struct pcap_pkthdr hdr;
+	const u_char *sp;
+	unsigned int i;
+	uint64_t t;
+
+	*all = true;
+
+	for (i = 0; i < cs->ifaces_nr; i++) {
+		struct cshark_iface *iface = &cs->ifaces[i];
+
+		if (!iface->q.count) {
+			*all = false;
+			continue;
+		}
+
+		cshark_merge_peek(&iface->q, &hdr, &sp);
+		t = cshark_merge_ns(cs, &hdr.ts);
+		if (!oldest || t < *ts) {
+			oldest = iface;
+			*ts = t;
+		}
+	}
+
+	return oldest;
+}
+
+static void cshark_merge_emit(struct cshark *cs, struct cshark_iface *iface)
+{
+	struct pcap_pkthdr hdr;
+	const u_char *sp;
+
+	cshark_merge_peek(&iface->q, &hdr, &sp);
+	cshark_pcap_capture_packet(cs, &hdr, sp, iface->ifindex);
+	cshark_merge_pop(&iface->q);
+}
+
+/*
+ * A packet can go once every other interface has something newer queued,
+ * otherwise only when it is older than the reorder window.
+ */
+static void cshark_merge_drain(struct cshark *cs, bool force)
+{
+	struct cshark_iface *iface;
+	struct timespec now;
+	uint64_t ts, limit;
+	bool all;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	limit = (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec - MERGE_WINDOW * 1000000ULL;
+
+	while ((iface = cshark_merge_oldest(cs, &all, &ts))) {
+		if (!force && !all && ts > limit)
+			break;
+
+		cshark_merge_emit(cs, iface);
+	}
+}
+
+static void cshark_merge_packet_cb(u_char *user, const struct pcap_pkthdr *header, const u_char *sp)
+{
+	struct cshark_iface *iface = (struct cshark_iface *) user;
+	struct cshark_iface *oldest;
+	struct pcap_pkthdr hdr = *header;
+	uint64_t ts;
+	bool all;
+
+	iface->packets++;
+	iface->bytes += hdr.caplen;
+
+	/* staged before queueing so the bytes dropped do not take up room */
+	if (!cshark_pcap_stage(&cshark, iface->linktype, &hdr, sp))
+		return;
+
+	/* out of room, make some by letting the oldest packets go early */
+	while (cshark_merge_push(&iface->q, &hdr, sp)) {
+		oldest = cshark_merge_oldest(&cshark, &all, &ts);
+		if (!oldest) {
+			iface->queue_drops++;
+			return;
+		}
+
+		cshark_merge_emit(&cshark, oldest);
+	}
+}
+
+static void cshark_merge_handle_cb(struct uloop_fd *ufd, __unused unsigned int events)
+{
+	struct cshark_iface *iface = container_of(ufd, struct cshark_iface, ufd);
+	int rc;
+
+	rc = pcap_dispatch(iface->p, -1, cshark_merge_packet_cb, (u_char *) iface);
+	if (rc < 0) {
+		ERROR("%s: %s\n", iface->name, pcap_geterr(iface->p));
+		uloop_end();
+		return;
+	}
+
+	cshark_merge_drain(&cshark, false);
+
+	if (cshark_writer_flush(&cshark.writer))
+		uloop_end();
+}
+
+/* quiet interfaces must not hold the others back for longer than the window */
+static void cshark_merge_timeout_cb(struct uloop_timeout *t)
+{
+	cshark_merge_drain(&cshark, false);
+
+	if (cshark_writer_flush(&cshark.writer)) {
+		uloop_end();
+		return;
+	}
+
+	uloop_timeout_set(t, MERGE_WINDOW);
+}
+
+int cshark_merge_init(struct cshark *cs)
+{
+	struct cshark_iface *iface;
+	char *list, *name, *save = NULL;
+	unsigned int n = 1, i;
+	size_t size;
+	char *c;
+	int rc = -1;
+
+	for (c = cs->interface; *c; c++)
+		if (*c == ',')
+			n++;
+
+	cs->ifaces = calloc(n, sizeof(*cs->ifaces));
+	list = strdup(cs->interface);
+	if (!cs->ifaces || !list) {
+		ERROR("not enough memory\n");
+		goto exit;
+	}
+
+	size = (size_t) MERGE_BUFFER * 1024 / n;
+	if (size < 2 * (sizeof(struct pcap_pkthdr) + cs->snaplen))
+		size = 2 * (sizeof(struct pcap_pkthdr) + cs->snaplen);
+
+	for (name = strtok_r(list, ",", &save); name; name = strtok_r(NULL, ",", &save)) {
+		iface = &cs->ifaces[cs->ifaces_nr];
+
+		snprintf(iface->name, sizeof(iface->name), "%s", name);
+		iface->ifindex = if_nametoindex(name);
+		if (!iface->ifindex) {
+			ERROR("no such interface '%s'\n", name);
+			goto exit;
+		}
+
+		iface->ufd.fd = -1;
+		iface->ufd.cb = cshark_merge_handle_cb;
+
+		iface->q.size = size;
+		iface->q.buf = malloc(size);
+		if (!iface->q.buf) {
+			ERROR("not enough memory\n");
+			goto exit;
+		}
+		cs->ifaces_nr++;
+
+		iface->p = cshark_pcap_open(cs, name, &iface->bfp, MERGE_TIMEOUT);
+		if (!iface->p)
+			goto exit;
+
+		iface->linktype = pcap_datalink(iface->p);
+		iface->ufd.fd = pcap_get_selectable_fd(iface->p);
+		if (iface->ufd.fd < 0) {
+			ERROR("pcap_get_selectable_fd(): invalid socket received\n");
+			goto exit;
+		}
+	}
+
+	/* the first interface stands for all of them where a single handle is expected */
+	cs->p = cs->ifaces[0].p;
+	cs->nano = pcap_get_tstamp_precision(cs->p) == PCAP_TSTAMP_PRECISION_NANO;
+	cs->linktype = cs->ifaces[0].linktype;
+
+	for (i = 1; i < cs->ifaces_nr; i++) {
+		if (cs->format == CSHARK_FORMAT_PCAP &&
+		    pcap_datalink(cs->ifaces[i].p) != pcap_datalink(cs->p)) {
+			ERROR("'%s' and '%s' have different link types, use pcapng\n",
+				cs->ifaces[0].name, cs->ifaces[i].name);
+			goto exit;
+		}
+
+		if ((pcap_get_tstamp_precision(cs->ifaces[i].p) == PCAP_TSTAMP_PRECISION_NANO) != cs->nano) {
+			ERROR("'%s' and '%s' have different timestamp precision\n",
+				cs->ifaces[0].name, cs->ifaces[i].name);
+			goto exit;
+		}
+	}
+
+	for (i = 0; i < cs->ifaces_nr; i++)
+		uloop_fd_add(&cs->ifaces[i].ufd, ULOOP_READ);
+
+	uloop_timeout_set(&merge_timeout, MERGE_WINDOW);
+
+	rc = 0;
+exit:
+	free(list);
+	return rc;
+}
+
+struct cshark_iface *cshark_merge_iface(struct cshark *cs, int ifindex)
+{
+	unsigned int i;
+
+	for (i = 0; i < cs->ifaces_nr; i++)
+		if (cs->ifaces[i].ifindex == ifindex)
+			return &cs->ifaces[i];
+
+	return NULL;
+}
+
+void cshark_merge_pause(struct cshark *cs, bool pause)
+{
+	unsigned int i;
+
+	for (i = 0; i < cs->ifaces_nr; i++) {
+		if (pause)
+			uloop_fd_delete(&cs->ifaces[i].ufd);
+		else
+			uloop_fd_add(&cs->ifaces[i].ufd, ULOOP_READ);
+	}
+}
+
+/* kernel counters per interface and summed over all of them */
+void cshark_merge_stats(struct cshark *cs)
+{
+	struct pcap_stat ps;
+	uint64_t recv = 0, drop = 0, ifdrop = 0;
+	unsigned int i;
+
+	for (i = 0; i < cs->ifaces_nr; i++) {
+		struct cshark_iface *iface = &cs->ifaces[i];
+
+		if (!iface->p || pcap_stats(iface->p, &ps))
+			continue;
+
+		iface->recv = ps.ps_recv;
+		iface->drops = ps.ps_drop;
+		iface->ifdrops = ps.ps_ifdrop;
+
+		recv += ps.ps_recv;
+		drop += ps.ps_drop;
+		ifdrop += ps.ps_ifdrop;
+	}
+
+	cs->stats_recv = recv;
+	cs->stats_drop = drop;
+	cs->stats_ifdrop = ifdrop;
+}
+
+/* stop capturing, write out whatever is held back and collect the counters */
+void cshark_merge_stop(struct cshark *cs)
+{
+	unsigned int i;
+
+	if (!cs->ifaces)
+		return;
+
+	uloop_timeout_cancel(&merge_timeout);
+
+	for (i = 0; i < cs->ifaces_nr; i++)
+		if (cs->ifaces[i].ufd.registered)
+			uloop_fd_delete(&cs->ifaces[i].ufd);
+
+	if (cs->writer.ops || cs->recorder)
+		cshark_merge_drain(cs, true);
+
+	cshark_merge_stats(cs);
+
+	for (i = 0; i < cs->ifaces_nr; i++) {
+		struct cshark_iface *iface = &cs->ifaces[i];
+
+		LOG("%s: %lu packets, %lu bytes, %lu dropped, %lu by the interface, %lu by the merge\n",
+			iface->name, (long unsigned int) iface->packets, (long unsigned int) iface->bytes,
+			(long unsigned int) iface->drops, (long unsigned int) iface->ifdrops,
+			(long unsigned int) iface->queue_drops);
+	}
+}
+
+void cshark_merge_done(struct cshark *cs)
+{
+	unsigned int i;
+
+	if (!cs->ifaces)
+		return;
+
+	for (i = 0; i < cs->ifaces_nr; i++) {
+		struct cshark_iface *iface = &cs->ifaces[i];
+
+		if (iface->p) {
+			if (cs->filter)
+				pcap_freecode(&iface->bfp);
+			pcap_close(iface->p);
+		}
+		free(iface->q.buf);
+	}
+
+	free(cs->ifaces);
+	cs->ifaces = NULL;
+	cs->ifaces_nr = 0;
+	cs->p = NULL;
+}
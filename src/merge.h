@@ -0,0 +1,88 @@
+/*
+ * Author: Luka Perkov <luka.perkov@sartura.hr>
+ *
+ * Copyright (C) 2014, QA Cafe, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * For more information see the project website [1].
+ *
+ * [1] https://www.cloudshark.org/
+ */
+
+#ifndef __CSHARK_MERGE_H__
+#define __CSHARK_MERGE_H__
+
+#include <stdint.h>
+#include <net/if.h>
+
+#include <pcap.h>
+
+#include <libubox/uloop.h>
+
+#include "cshark.h"
+
+/* packets are held back this long in milliseconds so slower interfaces can catch up */
+#define MERGE_WINDOW 100
+
+/* packets must reach the merge well within the window, this is the read timeout of each handle */
+#define MERGE_TIMEOUT 10
+
+/* memory for held back packets in KiB, shared by all interfaces */
+#define MERGE_BUFFER 1024
+
+/* packets of one interface waiting for the merge, in timestamp order */
+struct cshark_merge_queue {
+	uint8_t *buf;
+	size_t size;
+	size_t head;
+	size_t tail;
+	size_t wrap;
+	unsigned int count;
+};
+
+struct cshark_iface {
+	char name[IF_NAMESIZE];
+	int ifindex;
+
+	pcap_t *p;
+	int linktype;
+	struct bpf_program bfp;
+	struct uloop_fd ufd;
+	struct cshark_merge_queue q;
+
+	uint64_t packets;
+	uint64_t bytes;
+	uint64_t recv;
+	uint64_t drops;
+	uint64_t ifdrops;
+	/* packets that found the merge queue full, the kernel never saw them dropped */
+	uint64_t queue_drops;
+};
+
+int cshark_merge_init(struct cshark *cs);
+struct cshark_iface *cshark_merge_iface(struct cshark *cs, int ifindex);
+void cshark_merge_pause(struct cshark *cs, bool pause);
+void cshark_merge_stats(struct cshark *cs);
+void cshark_merge_stop(struct cshark *cs);
+void cshark_merge_done(struct cshark *cs);
+
+#endif /* __CSHARK_MERGE_H__ */
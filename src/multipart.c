@@ -0,0 +1,509 @@
+/*
+ * Author: Luka Perkov <luka.perkov@sartura.hr>
+ *
+ * Copyright (C) 2014, QA Cafe, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * For more information see the project website [1].
+ *
+ * [1] https://www.cloudshark.org/
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <libubox/uloop.h>
+
+#include "config.h"
+#include "cshark.h"
+#include "multipart.h"
+#include "shaper.h"
+#include "uclient.h"
+
+/*
+ * Big captures are cut into parts that go out over several connections at
+ * once, each one a PUT of its byte range under the upload id. A single
+ * connection over a long link never gets its window open far enough to fill
+ * the uplink, a few of them side by side do. Once the server has all parts
+ * a commit turns them into a capture and is answered like a regular upload.
+ */
+enum cshark_part_state {
+	PART_PENDING,
+	PART_ACTIVE,
+	PART_BACKOFF,
+	PART_DONE,
+};
+
+struct cshark_part {
+	struct uclient *ucl;
+	enum cshark_part_state state;
+	unsigned int index;
+
+	/* bytes [start, end) of the file, offset is the next one handed to uclient */
+	uint64_t start;
+	uint64_t end;
+	uint64_t offset;
+	bool requested;
+
+	unsigned int attempt;
+	struct uloop_timeout backoff;
+	struct cshark_shaper_waiter waiter;
+	struct cshark_uclient_conn conn;
+	/* the server took the part, it is done once the answer is read */
+	bool answered;
+
+	/* uclient can not be freed from its own callbacks, the scheduler does it */
+	bool reap;
+};
+
+struct cshark_multipart {
+	int fd;
+	uint64_t start;
+	uint64_t size;
+
+	struct cshark_part *parts;
+	unsigned int nr;
+	unsigned int active;
+	unsigned int done;
+	bool committed;
+	bool failed;
+
+	struct uloop_timeout schedule;
+	struct timespec begin;
+};
+
+static void cshark_multipart_schedule_cb(struct uloop_timeout *t);
+
+static struct cshark_multipart mp = { .fd = -1, .schedule = { .cb = cshark_multipart_schedule_cb } };
+
+static void cshark_multipart_kick(void)
+{
+	uloop_timeout_set(&mp.schedule, 0);
+}
+
+static void cshark_multipart_abort(void)
+{
+	unsigned int i;
+
+	mp.failed = true;
+
+	for (i = 0; i < mp.nr; i++) {
+		uloop_timeout_cancel(&mp.parts[i].backoff);
+		cshark_shaper_cancel(&mp.parts[i].waiter);
+		if (mp.parts[i].ucl) {
+			uclient_disconnect(mp.parts[i].ucl);
+			mp.parts[i].reap = true;
+		}
+	}
+
+	cshark_multipart_kick();
+	cshark_uclient_complete(false);
+}
+
+static void cshark_part_fail(struct cshark_part *p, bool fatal)
+{
+	unsigned int delay;
+
+	cshark_shaper_cancel(&p->waiter);
+	if (p->ucl) {
+		uclient_disconnect(p->ucl);
+		p->reap = true;
+	}
+	mp.active--;
+
+	/* whatever went out of this part is sent again */
+	cshark.upload_sent -= p->offset - p->start;
+	p->offset = p->start;
+
+	if (fatal || p->attempt >= config.upload_retries) {
+		ERROR("multipart: part %u failed, giving up on the upload\n", p->index);
+		cshark_multipart_abort();
+		return;
+	}
+
+	delay = cshark_uclient_backoff(p->attempt);
+	p->attempt++;
+	p->state = PART_BACKOFF;
+
+	LOG("multipart: part %u failed, trying again in %u ms (%u of %u)\n", p->index, delay,
+		p->attempt, config.upload_retries);
+	uloop_timeout_set(&p->backoff, delay);
+
+	cshark_multipart_kick();
+}
+
+static void cshark_part_backoff_cb(struct uloop_timeout *t)
+{
+	struct cshark_part *p = container_of(t, struct cshark_part, backoff);
+
+	p->state = PART_PENDING;
+	cshark_multipart_kick();
+}
+
+/* the connection stays open for the next part, unless the server does not want it to */
+static void cshark_part_finish(struct cshark_part *p)
+{
+	if (!cshark_uclient_reusable(p->ucl)) {
+		uclient_disconnect(p->ucl);
+		p->reap = true;
+	}
+
+	p->state = PART_DONE;
+	mp.active--;
+	mp.done++;
+
+	cshark_multipart_kick();
+}
+
+/* only the connection a part is currently on gets to report */
+static struct cshark_part *cshark_part_get(struct uclient *ucl)
+{
+	struct cshark_part *p = ucl->priv;
+
+	if (mp.failed || p->state != PART_ACTIVE || p->ucl != ucl || p->reap)
+		return NULL;
+
+	return p;
+}
+
+static int cshark_part_pump(struct cshark *cs, struct cshark_part *p)
+{
+	char buf[BUFSIZ];
+	ssize_t len;
+	size_t n;
+	int pending;
+
+	if (p->requested)
+		return 0;
+
+	/* same window as a single upload, per connection */
+	while (p->offset < p->end) {
+		pending = uclient_pending_bytes(p->ucl, true);
+		if (pending < 0 || (size_t) pending >= cs->upload_window)
+			return 0;
+
+		n = cs->upload_window - pending;
+		if (n > sizeof(buf))
+			n = sizeof(buf);
+		if (n > p->end - p->offset)
+			n = p->end - p->offset;
+
+		n = cshark_shaper_allow(cs, &p->waiter, n);
+		if (!n)
+			return 0;
+
+		len = pread(mp.fd, buf, n, p->offset);
+		if (len <= 0) {
+			ERROR("multipart: could not read capture file\n");
+			return -1;
+		}
+
+		if (uclient_write(p->ucl, buf, len) < 0) {
+			ERROR("multipart: could not write capture data\n");
+			return -1;
+		}
+		cshark_shaper_consume(len);
+		p->offset += len;
+		cs->upload_sent += len;
+	}
+
+	p->requested = true;
+
+	if (uclient_request(p->ucl)) {
+		ERROR("multipart: request failed\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+static void cshark_part_header_done_cb(struct uclient *ucl)
+{
+	struct cshark_part *p = cshark_part_get(ucl);
+
+	if (!p)
+		return;
+
+	cshark_uclient_ready(&cshark, &p->conn);
+
+	if (ucl->status_code < 200 || ucl->status_code >= 300) {
+		ERROR("multipart: part %u received error %d\n", p->index, ucl->status_code);
+		cshark_part_fail(p, cshark_uclient_fatal(ucl->status_code));
+		return;
+	}
+
+	p->answered = true;
+}
+
+/* nothing in the answer to a part is of interest, it is only read to keep the connection */
+static void cshark_part_read_data_cb(struct uclient *ucl)
+{
+	struct cshark_part *p;
+	char buf[BUFSIZ];
+
+	while (uclient_read(ucl, buf, sizeof(buf)) > 0)
+		;
+
+	p = cshark_part_get(ucl);
+	if (p && p->answered && ucl->eof)
+		cshark_part_finish(p);
+}
+
+static void cshark_part_data_sent_cb(struct uclient *ucl)
+{
+	struct cshark_part *p = cshark_part_get(ucl);
+
+	if (!p)
+		return;
+
+	cshark_uclient_ready(&cshark, &p->conn);
+
+	if (cshark_part_pump(&cshark, p))
+		cshark_part_fail(p, false);
+}
+
+static void cshark_part_shaper_cb(struct cshark_shaper_waiter *w)
+{
+	struct cshark_part *p = container_of(w, struct cshark_part, waiter);
+
+	if (mp.failed || p->state != PART_ACTIVE || p->reap)
+		return;
+
+	if (cshark_part_pump(&cshark, p))
+		cshark_part_fail(p, false);
+}
+
+static void cshark_part_eof_cb(struct uclient *ucl)
+{
+	struct cshark_part *p = cshark_part_get(ucl);
+
+	if (!p)
+		return;
+
+	if (p->answered)
+		cshark_part_finish(p);
+	else
+		cshark_part_fail(p, false);
+}
+
+static void cshark_part_error_cb(struct uclient *ucl, int code)
+{
+	struct cshark_part *p = cshark_part_get(ucl);
+
+	if (!p)
+		return;
+
+	ERROR("multipart: part %u: %s\n", p->index, uclient_strerror(code));
+	cshark_part_fail(p, false);
+}
+
+static const struct uclient_cb part_cb = {
+	.header_done = cshark_part_header_done_cb,
+	.data_read = cshark_part_read_data_cb,
+	.data_sent = cshark_part_data_sent_cb,
+	.data_eof = cshark_part_eof_cb,
+	.error = cshark_part_error_cb,
+};
+
+static struct cshark_part *cshark_multipart_idle(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < mp.nr; i++)
+		if (mp.parts[i].state == PART_DONE && mp.parts[i].ucl && !mp.parts[i].reap)
+			return &mp.parts[i];
+
+	return NULL;
+}
+
+static int cshark_part_start(struct cshark *cs, struct cshark_part *p)
+{
+	struct cshark_part *idle;
+	char value[96];
+	int rc;
+
+	p->state = PART_ACTIVE;
+	p->offset = p->start;
+	p->requested = false;
+	p->answered = false;
+	mp.active++;
+
+	/* a connection a finished part left open saves the TCP and TLS handshakes */
+	idle = cshark_multipart_idle();
+	if (idle) {
+		p->ucl = idle->ucl;
+		idle->ucl = NULL;
+		p->ucl->priv = p;
+
+		cshark_uclient_opened(cs, &p->conn, true);
+		if (cshark_uclient_reuse(p->ucl, "PUT"))
+			return -1;
+	} else {
+		p->ucl = cshark_uclient_client("PUT", &part_cb);
+		if (!p->ucl)
+			return -1;
+		p->ucl->priv = p;
+
+		cshark_uclient_opened(cs, &p->conn, false);
+	}
+
+	snprintf(value, sizeof(value), "%lu", (long unsigned int) (p->end - p->start));
+	rc = uclient_http_set_header(p->ucl, "Content-Length", value);
+	if (!rc)
+		rc = uclient_http_set_header(p->ucl, "Upload-Id", cs->upload_id);
+	if (!rc) {
+		snprintf(value, sizeof(value), "bytes %lu-%lu/%lu", (long unsigned int) p->start,
+			(long unsigned int) p->end - 1, (long unsigned int) mp.size);
+		rc = uclient_http_set_header(p->ucl, "Content-Range", value);
+	}
+	if (!rc) {
+		snprintf(value, sizeof(value), "%u", p->index);
+		rc = uclient_http_set_header(p->ucl, "Upload-Part", value);
+	}
+	if (rc) {
+		ERROR("multipart: could not set header\n");
+		return -1;
+	}
+
+	return cshark_part_pump(cs, p);
+}
+
+/* frees finished connections, keeps upload_parts of them busy and commits at the end */
+static void cshark_multipart_schedule_cb(struct uloop_timeout *t)
+{
+	struct cshark_part *p;
+	unsigned int i;
+
+	for (i = 0; i < mp.nr; i++) {
+		p = &mp.parts[i];
+		if (!p->reap)
+			continue;
+
+		uclient_free(p->ucl);
+		p->ucl = NULL;
+		p->reap = false;
+	}
+
+	if (mp.failed)
+		return;
+
+	for (i = 0; i < mp.nr && mp.active < config.upload_parts; i++) {
+		p = &mp.parts[i];
+		if (p->state != PART_PENDING)
+			continue;
+
+		if (cshark_part_start(&cshark, p))
+			cshark_part_fail(p, false);
+		if (mp.failed)
+			return;
+	}
+
+	if (mp.done < mp.nr || mp.committed)
+		return;
+
+	/* connections kept for parts that are no more */
+	for (i = 0; i < mp.nr; i++) {
+		p = &mp.parts[i];
+		if (p->ucl) {
+			uclient_free(p->ucl);
+			p->ucl = NULL;
+		}
+	}
+
+	mp.committed = true;
+	cshark_uclient_throughput("multipart", mp.size - mp.start, &mp.begin);
+
+	if (cshark_uclient_commit(&cshark, mp.size))
+		cshark_uclient_complete(false);
+}
+
+int cshark_multipart_upload(struct cshark *cs, const char *filename, uint64_t start, uint64_t size)
+{
+	uint64_t part = config.upload_part_size;
+	struct cshark_part *p;
+	unsigned int i;
+
+	cshark_multipart_done(cs);
+
+	mp.fd = open(filename, O_RDONLY | O_CLOEXEC);
+	if (mp.fd < 0) {
+		ERROR("multipart: could not open file '%s'\n", filename);
+		return -1;
+	}
+
+	mp.start = start;
+	mp.size = size;
+	mp.nr = (size - start + part - 1) / part;
+	mp.active = mp.done = 0;
+	mp.committed = mp.failed = false;
+
+	mp.parts = calloc(mp.nr, sizeof(*mp.parts));
+	if (!mp.parts) {
+		ERROR("not enough memory\n");
+		mp.nr = 0;
+		return -1;
+	}
+
+	for (i = 0; i < mp.nr; i++) {
+		p = &mp.parts[i];
+		p->index = i;
+		p->start = start + i * part;
+		p->end = p->start + part < size ? p->start + part : size;
+		p->backoff.cb = cshark_part_backoff_cb;
+		p->waiter.cb = cshark_part_shaper_cb;
+	}
+
+	cs->upload_size = size;
+	cs->upload_sent = start;
+	clock_gettime(CLOCK_MONOTONIC, &mp.begin);
+
+	DEBUG("uploading %u parts over %u connections\n", mp.nr, config.upload_parts);
+	cshark_multipart_kick();
+
+	return 0;
+}
+
+void cshark_multipart_done(struct cshark *cs)
+{
+	unsigned int i;
+
+	uloop_timeout_cancel(&mp.schedule);
+
+	for (i = 0; i < mp.nr; i++) {
+		uloop_timeout_cancel(&mp.parts[i].backoff);
+		cshark_shaper_cancel(&mp.parts[i].waiter);
+		if (mp.parts[i].ucl)
+			uclient_free(mp.parts[i].ucl);
+	}
+
+	free(mp.parts);
+	mp.parts = NULL;
+	mp.nr = 0;
+
+	if (mp.fd >= 0) {
+		close(mp.fd);
+		mp.fd = -1;
+	}
+}
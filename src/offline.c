@@ -0,0 +1,343 @@
+/*
+ * Author: Luka Perkov <luka.perkov@sartura.hr>
+ *
+ * Copyright (C) 2014, QA Cafe, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * For more information see the project website [1].
+ *
+ * [1] https://www.cloudshark.org/
+ */
+
+#include <byteswap.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <pcap.h>
+
+#include <libubox/uloop.h>
+
+#include "cshark.h"
+#include "offline.h"
+#include "pcap.h"
+
+/* a record header as it is on disk, struct pcap_pkthdr has a struct timeval instead */
+struct cshark_offline_rec {
+	uint32_t sec;
+	uint32_t frac;
+	uint32_t caplen;
+	uint32_t len;
+};
+
+struct cshark_offline {
+	/* the whole file when it is classic pcap, NULL when libpcap reads it */
+	uint8_t *map;
+	size_t size;
+	size_t pos;
+	/* pages before this were flushed and are given back */
+	size_t released;
+	bool swapped;
+
+	bool compiled;
+	bool paused;
+	bool eof;
+
+	/* bytes read in this round and how many before the main loop gets a turn */
+	size_t batch;
+	size_t batch_max;
+
+	uint64_t read;
+};
+
+static void cshark_offline_cb(struct uloop_timeout *t);
+
+static struct cshark_offline offline;
+static struct uloop_timeout offline_timeout = { .cb = cshark_offline_cb };
+
+/* classic pcap in either byte order, everything else is left to libpcap */
+static bool cshark_offline_magic(uint32_t magic, bool *swapped, bool *nano)
+{
+	switch (magic) {
+		case 0xa1b2c3d4:
+		case 0xd4c3b2a1:
+			*nano = false;
+			break;
+
+		case 0xa1b23c4d:
+		case 0x4d3cb2a1:
+			*nano = true;
+			break;
+
+		default:
+			return false;
+	}
+
+	*swapped = magic == 0xd4c3b2a1 || magic == 0x4d3cb2a1;
+
+	return true;
+}
+
+static void cshark_offline_packet(u_char *user, const struct pcap_pkthdr *header, const u_char *sp)
+{
+	struct cshark *cs = (struct cshark *) user;
+	struct pcap_pkthdr hdr = *header;
+	bpf_u_int32 snap;
+
+	offline.read++;
+	offline.batch += sizeof(struct cshark_offline_rec) + hdr.caplen;
+
+	/* the same filter a live capture would have set on the socket */
+	snap = pcap_offline_filter(&cs->p_bfp, &hdr, sp);
+	if (snap) {
+		if (hdr.caplen > snap)
+			hdr.caplen = snap;
+		if (hdr.caplen > (bpf_u_int32) cs->snaplen)
+			hdr.caplen = cs->snaplen;
+
+		if (cshark_pcap_stage(cs, cs->linktype, &hdr, sp))
+			cshark_pcap_capture_packet(cs, &hdr, sp, 0);
+	}
+
+	/* libpcap reads on until it is told otherwise */
+	if (!offline.map && offline.batch >= offline.batch_max)
+		pcap_breakloop(cs->p);
+}
+
+/* records straight out of the mapping, nothing is copied until the writer needs it */
+static int cshark_offline_walk(struct cshark *cs)
+{
+	struct cshark_offline *o = &offline;
+	struct cshark_offline_rec rec;
+	struct pcap_pkthdr hdr;
+
+	while (!uloop_cancelled && !o->paused && o->batch < o->batch_max) {
+		if (o->size - o->pos < sizeof(rec)) {
+			if (o->size != o->pos)
+				LOG("offline: ignoring %lu bytes at the end of '%s'\n",
+					(long unsigned int) (o->size - o->pos), cs->input);
+			o->eof = true;
+			break;
+		}
+
+		memcpy(&rec, o->map + o->pos, sizeof(rec));
+		if (o->swapped) {
+			rec.sec = bswap_32(rec.sec);
+			rec.frac = bswap_32(rec.frac);
+			rec.caplen = bswap_32(rec.caplen);
+			rec.len = bswap_32(rec.len);
+		}
+
+		if (rec.caplen > OFFLINE_CAPLEN_MAX) {
+			ERROR("offline: '%s' is corrupt at offset %lu\n", cs->input, (long unsigned int) o->pos);
+			return -1;
+		}
+
+		/* a file that was still being written ends in the middle of a record */
+		if (rec.caplen > o->size - o->pos - sizeof(rec)) {
+			LOG("offline: last packet of '%s' is cut short, ignoring it\n", cs->input);
+			o->eof = true;
+			break;
+		}
+
+		hdr.ts.tv_sec = rec.sec;
+		hdr.ts.tv_usec = rec.frac;
+		hdr.caplen = rec.caplen;
+		hdr.len = rec.len;
+
+		cshark_offline_packet((u_char *) cs, &hdr, o->map + o->pos + sizeof(rec));
+		o->pos += sizeof(rec) + rec.caplen;
+	}
+
+	return 0;
+}
+
+static void cshark_offline_cb(struct uloop_timeout *t)
+{
+	struct cshark *cs = &cshark;
+	struct cshark_offline *o = &offline;
+	size_t done;
+	int rc;
+
+	if (uloop_cancelled)
+		return;
+
+	o->batch = 0;
+
+	if (o->map) {
+		rc = cshark_offline_walk(cs);
+	} else {
+		/* a savefile read to its end has nothing left to return */
+		rc = pcap_dispatch(cs->p, -1, cshark_offline_packet, (u_char *) cs);
+		if (rc == PCAP_ERROR) {
+			ERROR("pcap_dispatch(): %s\n", pcap_geterr(cs->p));
+		} else {
+			o->eof = !rc;
+			rc = 0;
+		}
+	}
+
+	if (!rc)
+		rc = cshark_writer_flush(&cs->writer);
+
+	pthread_mutex_lock(&cs->lock);
+	cs->stats_recv = o->read;
+	pthread_mutex_unlock(&cs->lock);
+
+	if (rc) {
+		uloop_end();
+		return;
+	}
+
+	/* the writer let go of everything read so far, the page cache can have it back */
+	if (o->map) {
+		done = o->pos - o->pos % getpagesize();
+		if (done > o->released) {
+			madvise(o->map + o->released, done - o->released, MADV_DONTNEED);
+			o->released = done;
+		}
+	}
+
+	if (o->eof) {
+		LOG("read %lu packets from '%s'\n", (long unsigned int) o->read, cs->input);
+		uloop_end();
+		return;
+	}
+
+	if (!o->paused)
+		uloop_timeout_set(t, 0);
+}
+
+int cshark_offline_init(struct cshark *cs)
+{
+	struct cshark_offline *o = &offline;
+	char e[PCAP_ERRBUF_SIZE];
+	struct stat st;
+	uint32_t magic = 0;
+	bool nano = false;
+	int fd, rc = -1;
+
+	memset(o, 0, sizeof(*o));
+
+	/* a round has to fit the stream buffer next to the one already on its way */
+	o->batch_max = OFFLINE_BATCH * 1024;
+	if (cs->stream && o->batch_max > cs->stream_buffer / 8)
+		o->batch_max = cs->stream_buffer / 8;
+
+	/* a round that can not take a single record would never get anywhere */
+	if (o->batch_max < sizeof(struct cshark_offline_rec) + OFFLINE_CAPLEN_MAX)
+		o->batch_max = sizeof(struct cshark_offline_rec) + OFFLINE_CAPLEN_MAX;
+
+	fd = open(cs->input, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		ERROR("offline: could not open '%s': %s\n", cs->input, strerror(errno));
+		return -1;
+	}
+
+	if (fstat(fd, &st) < 0) {
+		ERROR("offline: could not stat '%s': %s\n", cs->input, strerror(errno));
+		goto exit;
+	}
+
+	/* classic pcap is walked in place, pcapng and the rest go through libpcap */
+	if (pread(fd, &magic, sizeof(magic), 0) == sizeof(magic) &&
+	    cshark_offline_magic(magic, &o->swapped, &nano) &&
+	    (size_t) st.st_size >= sizeof(struct pcap_file_header)) {
+		o->map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (o->map == MAP_FAILED) {
+			DEBUG("offline: could not map '%s', reading it instead\n", cs->input);
+			o->map = NULL;
+		} else {
+			madvise(o->map, st.st_size, MADV_SEQUENTIAL);
+			o->size = st.st_size;
+			o->pos = sizeof(struct pcap_file_header);
+		}
+	} else {
+		nano = cs->format == CSHARK_FORMAT_PCAPNG;
+	}
+
+	/* libpcap knows the link type and snaplen either way, and compiles the filter for it */
+	cs->p = pcap_open_offline_with_tstamp_precision(cs->input,
+							nano ? PCAP_TSTAMP_PRECISION_NANO :
+							       PCAP_TSTAMP_PRECISION_MICRO, e);
+	if (!cs->p) {
+		ERROR("pcap_open_offline(): %s\n", e);
+		goto exit;
+	}
+
+	cs->nano = pcap_get_tstamp_precision(cs->p) == PCAP_TSTAMP_PRECISION_NANO;
+	cs->linktype = pcap_datalink(cs->p);
+
+	rc = pcap_compile(cs->p, &cs->p_bfp, cs->filter ? cs->filter : "", 1, PCAP_NETMASK_UNKNOWN);
+	if (rc == -1) {
+		ERROR("pcap_compile(): could not parse filter\n");
+		goto exit;
+	}
+	o->compiled = true;
+
+	uloop_timeout_set(&offline_timeout, 0);
+	rc = 0;
+
+exit:
+	close(fd);
+
+	return rc;
+}
+
+bool cshark_offline_mapped(void)
+{
+	return offline.map != NULL;
+}
+
+/* the upload is falling behind, nothing more is read until it catches up */
+void cshark_offline_pause(struct cshark *cs, bool pause)
+{
+	offline.paused = pause;
+
+	if (pause) {
+		uloop_timeout_cancel(&offline_timeout);
+		if (!offline.map && cs->p)
+			pcap_breakloop(cs->p);
+	} else if (!offline.eof) {
+		uloop_timeout_set(&offline_timeout, 0);
+	}
+}
+
+void cshark_offline_done(struct cshark *cs)
+{
+	struct cshark_offline *o = &offline;
+
+	uloop_timeout_cancel(&offline_timeout);
+
+	if (o->compiled) {
+		pcap_freecode(&cs->p_bfp);
+		o->compiled = false;
+	}
+
+	if (o->map) {
+		munmap(o->map, o->size);
+		o->map = NULL;
+	}
+}
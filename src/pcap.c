@@ -29,14 +29,31 @@
  */
 
 #include <sys/vfs.h>
+#include <linux/magic.h>
 
 #include <libubox/uloop.h>
 
 #include "cshark.h"
+#include "dedup.h"
+#include "flow.h"
+#include "merge.h"
+#include "offline.h"
 #include "pcap.h"
+#include "pcapng.h"
+#include "recorder.h"
+#include "slice.h"
+#include "stream.h"
+#include "tpacket.h"
+
+/* leave a bit of disk space available for everybody else */
+#define DISK_RESERVE (512 * 1024)
+#define DISK_REFRESH_INTERVAL 1000
+
+static void cshark_pcap_budget_cb(struct uloop_timeout *t);
 
 struct uloop_fd ufd_pcap = { .cb = cshark_pcap_handle_packet_cb };
-static char *filename = NULL;
+static struct uloop_timeout budget_timeout = { .cb = cshark_pcap_budget_cb };
+static bool budget_reserved;
 
 struct pcap_timeval {
 	bpf_int32 tv_sec; /* seconds */
@@ -49,68 +66,82 @@ struct pcap_sf_pkthdr {
 	bpf_u_int32 len; /* length this packet (off wire) */
 };
 
-void cshark_pcap_manage_packet(u_char *user, const struct pcap_pkthdr *header, const u_char *sp)
+bool cshark_pcap_admit(struct cshark *cs, bpf_u_int32 caplen)
 {
-	struct cshark *cs = (struct cshark *) user;
-	static int stop_writing = false;
-	static unsigned long captured_size = 0;
-	struct statfs result;
-
-	if (stop_writing) return;
-
-	/* no need to check on every packet so check on every 10th that comes along */
-	if (cs->packets % 10 == 0) {
-		if (statfs(filename, &result) < 0 ) {
-			ERROR("unable to determine free disk space for '%s'\n", filename);
-			stop_writing = true;
-			uloop_end();
-			return;
-		}
-
-		/* leave a bit less then 512K of disk space available */
-		if ((result.f_bsize * result.f_bfree) < captured_size) {
-			DEBUG("stopping capture due to low disk space\n");
-			stop_writing = true;
-			uloop_end();
-			return;
-		}
-	}
-
-	captured_size += header->len;
+	/* workers share the limits so reserve room atomically, but only when there is a limit */
+	if (cs->limit_packets &&
+	    __atomic_add_fetch(&cs->reserved_packets, 1, __ATOMIC_RELAXED) > cs->limit_packets)
+		return false;
 
-	cs->packets++;
-	if (cs->limit_packets && (cs->limit_packets < cs->packets)) {
-		uloop_end();
-		return;
-	}
-
-	cs->caplen += header->caplen;
-	if (cs->limit_caplen && (cs->limit_caplen < cs->caplen)) {
-		uloop_end();
-		return;
-	}
+	if (cs->limit_caplen &&
+	    __atomic_add_fetch(&cs->reserved_caplen, caplen, __ATOMIC_RELAXED) > cs->limit_caplen)
+		return false;
 
-	/* pcap_dump does not handle errors so make fixes here instead */
+	return true;
+}
 
+int cshark_pcap_dump_packet(struct cshark *cs, const struct pcap_pkthdr *header, const u_char *sp,
+			    int ifindex)
+{
 	struct pcap_sf_pkthdr sf_hdr;
-	size_t num = 0;		
+
+	if (cs->format == CSHARK_FORMAT_PCAPNG)
+		return cshark_pcapng_dump_packet(cs, header, sp, ifindex);
 
 	sf_hdr.ts.tv_sec = header->ts.tv_sec;
 	sf_hdr.ts.tv_usec = header->ts.tv_usec;
 	sf_hdr.caplen = header->caplen;
 	sf_hdr.len = header->len;
 
-	num = fwrite(&sf_hdr, sizeof(sf_hdr), 1, (FILE *) cs->p_dumper);
-	if (num != 1) {
+	if (cs->recorder)
+		return cshark_recorder_append(cs->recorder, header->ts.tv_sec, &sf_hdr, sizeof(sf_hdr),
+					      sp, header->caplen, NULL, 0);
+
+	return cshark_writer_append(&cs->writer, &sf_hdr, sizeof(sf_hdr), sp, header->caplen);
+}
+
+/* duplicates, flow limits and slicing, in that order, false drops the packet */
+bool cshark_pcap_stage(struct cshark *cs, int linktype, struct pcap_pkthdr *header, const u_char *sp)
+{
+	if (cs->dedup && cshark_dedup(cs, linktype, header, sp))
+		return false;
+
+	if (cs->flows && !cshark_flow_admit(cs, linktype, header, sp))
+		return false;
+
+	if (cs->slice)
+		header->caplen = cshark_slice(cs, linktype, sp, header->caplen);
+
+	return true;
+}
+
+void cshark_pcap_capture_packet(struct cshark *cs, const struct pcap_pkthdr *header,
+				const u_char *sp, int ifindex)
+{
+	if (!cshark_pcap_admit(cs, header->caplen)) {
 		uloop_end();
 		return;
 	}
 
-	num = fwrite(sp, header->caplen, 1, (FILE *) cs->p_dumper);
-	if (num != 1) {
+	if (cshark_pcap_dump_packet(cs, header, sp, ifindex)) {
 		uloop_end();
 		return;
 	}
+
+	cs->packets++;
+	cs->caplen += header->caplen;
+}
+
+void cshark_pcap_manage_packet(u_char *user, const struct pcap_pkthdr *header, const u_char *sp)
+{
+	struct cshark *cs = (struct cshark *) user;
+	struct pcap_pkthdr hdr = *header;
+
+	if (!cshark_pcap_stage(cs, cs->linktype, &hdr, sp))
+		return;
+
+	/* libpcap does not tell where a packet came from, it all goes to the capture interface */
+	cshark_pcap_capture_packet(cs, &hdr, sp, 0);
 }
 
 void cshark_pcap_handle_packet_cb(struct uloop_fd *ufd, __unused unsigned int events)
@@ -123,56 +154,291 @@ void cshark_pcap_handle_packet_cb(struct uloop_fd *ufd, __unused unsigned int ev
 		return;
 	}
 
+	/* libpcap may reuse its buffer after dispatch returns, the writer holds copies only */
+	if (cshark_writer_flush(&cshark.writer)) {
+		uloop_end();
+		return;
+	}
+
 	DEBUG("received '%d' packets\n", (int) cshark.packets);
 	DEBUG("received '%d' bytes\n", (int) cshark.caplen);
 }
 
-int cshark_pcap_init(struct cshark *cs)
+static uint64_t cshark_pcap_disk_avail(const char *path, bool *tmpfs)
 {
-	int rc = -1;
+	struct statfs result;
+	uint64_t avail;
+
+	if (statfs(path, &result) < 0) {
+		ERROR("unable to determine free disk space for '%s'\n", path);
+		return 0;
+	}
+
+	if (tmpfs)
+		*tmpfs = result.f_type == TMPFS_MAGIC;
+
+	avail = (uint64_t) result.f_bsize * result.f_bavail;
+
+	return avail > DISK_RESERVE ? avail - DISK_RESERVE : 0;
+}
+
+/* free space is only looked at from here, never from the packet path */
+static void cshark_pcap_budget_cb(struct uloop_timeout *t)
+{
+	uint64_t limit;
+
+	/* preallocated space can not be taken away, otherwise shrink to what is left */
+	if (!budget_reserved) {
+		limit = cshark_pcap_disk_avail(cshark.filename, NULL);
+
+		pthread_mutex_lock(&cshark.lock);
+		limit += cshark.writer.offset;
+		if (limit < cshark.writer.limit)
+			cshark.writer.limit = limit;
+		pthread_mutex_unlock(&cshark.lock);
+	}
+
+	uloop_timeout_set(t, DISK_REFRESH_INTERVAL);
+}
+
+static int cshark_pcap_write_header(struct cshark *cs, struct cshark_writer *w)
+{
+	struct pcap_file_header hdr;
+
+	if (cs->format == CSHARK_FORMAT_PCAPNG)
+		return cshark_pcapng_write_header(cs, w);
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = cs->nano ? 0xa1b23c4d : 0xa1b2c3d4;
+	hdr.version_major = PCAP_VERSION_MAJOR;
+	hdr.version_minor = PCAP_VERSION_MINOR;
+	hdr.snaplen = pcap_snapshot(cs->p);
+	hdr.linktype = pcap_datalink(cs->p);
+	w->keep = true;
+
+	if (cshark_writer_append(w, &hdr, sizeof(hdr), NULL, 0))
+		return EXIT_FAILURE;
+
+	return 0;
+}
+
+static int cshark_pcap_writer_open(struct cshark *cs, struct cshark_writer *w,
+				   const struct cshark_writer_ops *ops, const char *filename, bool pinned)
+{
+	if (cshark_writer_open(w, ops, filename, pinned))
+		return -1;
+
+	if (cs->compress_ops &&
+	    cshark_writer_compress(w, cs->compress_ops, cs->compress_level, cs->compress_threads)) {
+		cshark_writer_close(w);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int cshark_pcap_dump_open(struct cshark *cs)
+{
+	uint64_t budget;
+	bool tmpfs = false;
+	int rc;
+
+	/* the flight recorder keeps packets in memory, files are only written by snapshots */
+	if (cs->recorder)
+		return 0;
+
+	/* tpacket payloads stay in the ring and mapped file ones in the map until the writer is flushed */
+	rc = cshark_pcap_writer_open(cs, &cs->writer, cs->stream ? &cshark_writer_stream : cs->writer_ops,
+				     cs->stream ? NULL : cs->filename,
+				     cs->backend == CSHARK_BACKEND_TPACKET || cshark_offline_mapped());
+	if (rc) {
+		ERROR("pcap: could not open file for storing capture\n");
+		return EXIT_FAILURE;
+	}
+
+	if (cs->stream)
+		return cshark_pcap_write_header(cs, &cs->writer);
+
+	budget = cshark_pcap_disk_avail(cs->filename, &tmpfs);
+	if (cs->disk_budget && cs->disk_budget < budget)
+		budget = cs->disk_budget;
+
+	if (!budget) {
+		ERROR("pcap: not enough disk space for '%s'\n", cs->filename);
+		return EXIT_FAILURE;
+	}
+
+	/*
+	 * only an explicit budget on a real disk is preallocated, reserving all free space
+	 * or tmpfs pages up front would starve everyone else of disk or memory
+	 */
+	if (cs->disk_budget && !tmpfs) {
+		budget_reserved = !cshark_writer_reserve(&cs->writer, budget);
+	} else {
+		cs->writer.limit = budget;
+		budget_reserved = false;
+	}
+	DEBUG("disk budget is %lu bytes%s\n", (long unsigned int) budget,
+		budget_reserved ? "" : ", not preallocated");
+
+	uloop_timeout_set(&budget_timeout, DISK_REFRESH_INTERVAL);
+
+	return cshark_pcap_write_header(cs, &cs->writer);
+}
+
+static int cshark_pcap_snapshot_record(void *priv, const void *rec, size_t len)
+{
+	return cshark_writer_append(priv, NULL, 0, rec, len);
+}
+
+int cshark_pcap_snapshot(struct cshark *cs, const char *filename)
+{
+	struct cshark_recorder copy;
+	struct cshark_writer w;
+	int rc;
+
+	rc = cshark_pcap_writer_open(cs, &w, cs->writer_ops, filename, true);
+	if (rc) {
+		ERROR("pcap: could not open file '%s' for snapshot\n", filename);
+		return rc;
+	}
+
+	/* workers are only held back while the arena is copied, the file is written without the lock */
+	pthread_mutex_lock(&cs->lock);
+	rc = cshark_pcap_write_header(cs, &w);
+	if (!rc)
+		rc = cshark_recorder_copy(cs->recorder, &copy);
+	pthread_mutex_unlock(&cs->lock);
+
+	if (rc) {
+		cshark_writer_close(&w);
+		return rc;
+	}
+
+	/* records stay pinned in the copy until it is released */
+	rc = cshark_recorder_foreach(&copy, cshark_pcap_snapshot_record, &w);
+	if (!rc)
+		rc = cshark_writer_flush(&w);
+
+	cshark_writer_close(&w);
+	cshark_recorder_release(&copy);
+
+	return rc;
+}
+
+pcap_t *cshark_pcap_open(struct cshark *cs, const char *device, struct bpf_program *bfp, int timeout)
+{
+	pcap_t *p;
+	int rc;
 
 	/* potential libpcap errors will end up here*/
 	char e[PCAP_ERRBUF_SIZE];
 	memset(e, 0, PCAP_ERRBUF_SIZE);
 
+	p = pcap_create(device, e);
+	if (p == NULL) {
+		ERROR("pcap_create(): %s\n", e);
+		return NULL;
+	}
+
 	/* open device in promiscuous mode */
-	cs->p = pcap_open_live(cs->interface, cs->snaplen, 1, 0x0400, e);
-	if (cs->p == NULL) {
-		ERROR("pcap_open_live(): %s\n", e);
-		goto exit;
+	pcap_set_snaplen(p, cs->snaplen);
+	pcap_set_promisc(p, 1);
+	pcap_set_timeout(p, timeout);
+
+	/* pcapng records nanoseconds, older kernels and libpcap fall back to microseconds */
+	if (cs->format == CSHARK_FORMAT_PCAPNG &&
+	    pcap_set_tstamp_precision(p, PCAP_TSTAMP_PRECISION_NANO))
+		DEBUG("nanosecond timestamps not supported\n");
+
+	rc = pcap_activate(p);
+	if (rc < 0) {
+		ERROR("pcap_activate(): %s: %s\n", device, pcap_geterr(p));
+		goto error;
 	}
+	if (rc > 0)
+		LOG("pcap_activate(): %s: %s\n", device, pcap_statustostr(rc));
 
 	if (cs->filter) {
-		rc = pcap_compile(cs->p, &cs->p_bfp, cs->filter, 1, PCAP_NETMASK_UNKNOWN);
+		rc = pcap_compile(p, bfp, cs->filter, 1, PCAP_NETMASK_UNKNOWN);
 		if (rc == -1) {
 			ERROR("pcap_compile(): could not parse filter\n");
-			goto exit;
+			goto error;
 		}
 
-		rc = pcap_setfilter(cs->p, &cs->p_bfp);
+		rc = pcap_setfilter(p, bfp);
 		if (rc == -1) {
 			ERROR("pcap_setfilter(): could not parse filter\n");
-			goto exit;
+			pcap_freecode(bfp);
+			goto error;
 		}
 	}
 
-	cs->p_dumper = pcap_dump_open(cs->p, cs->filename);
-	if (cs->p_dumper == NULL) {
-		ERROR("pcap: could not open file for storing capture\n");
-		rc = EXIT_FAILURE;
+	/* set non-blocking state */
+	rc = pcap_setnonblock(p, 1, e);
+	if (rc < 0) {
+		ERROR("pcap_setnonblock(): %s\n", e);
+		if (cs->filter)
+			pcap_freecode(bfp);
+		goto error;
+	}
+
+	return p;
+
+error:
+	pcap_close(p);
+	return NULL;
+}
+
+int cshark_pcap_init(struct cshark *cs)
+{
+	int rc = -1;
+
+	/* workers and the budget timer share the writer */
+	pthread_mutex_init(&cs->lock, NULL);
+
+	if (cs->backend == CSHARK_BACKEND_TPACKET) {
+		rc = cshark_tpacket_init(cs);
+		if (rc)
+			goto exit;
+
+		rc = cshark_pcap_dump_open(cs);
 		goto exit;
 	}
 
-	/* we need to access this value in one of the callbacks */
-	filename = cs->filename;
+	/* packets come from a capture file, at whatever speed the disk reads it */
+	if (cs->input) {
+		rc = cshark_offline_init(cs);
+		if (rc)
+			goto exit;
 
-	/* set non-blocking state */
-	rc = pcap_setnonblock(cs->p, 1, e);
-	if (rc < 0) {
-		ERROR("pcap_setnonblock(): %s\n", e);
+		rc = cshark_pcap_dump_open(cs);
 		goto exit;
 	}
 
+	/* a list of interfaces gets one handle each, merged into one capture */
+	if (strchr(cs->interface, ',')) {
+		rc = cshark_merge_init(cs);
+		if (rc)
+			goto exit;
+
+		rc = cshark_pcap_dump_open(cs);
+		goto exit;
+	}
+
+	cs->p = cshark_pcap_open(cs, cs->interface, &cs->p_bfp, 0x0400);
+	if (!cs->p) {
+		rc = -1;
+		goto exit;
+	}
+
+	cs->nano = pcap_get_tstamp_precision(cs->p) == PCAP_TSTAMP_PRECISION_NANO;
+	cs->linktype = pcap_datalink(cs->p);
+
+	rc = cshark_pcap_dump_open(cs);
+	if (rc)
+		goto exit;
+
 	int socket;
 	socket = pcap_get_selectable_fd(cs->p);
 	if (socket < 0) {
@@ -189,12 +455,94 @@ exit:
 	return rc;
 }
 
-void cshark_pcap_done(struct cshark *cs)
+/* a handle opened elsewhere, an offline one when a capture file is replayed */
+int cshark_pcap_attach(struct cshark *cs, pcap_t *p)
+{
+	pthread_mutex_init(&cs->lock, NULL);
+
+	cs->p = p;
+	cs->nano = pcap_get_tstamp_precision(p) == PCAP_TSTAMP_PRECISION_NANO;
+	cs->linktype = pcap_datalink(p);
+
+	return cshark_pcap_dump_open(cs);
+}
+
+void cshark_pcap_pause(struct cshark *cs, bool pause)
 {
-	if (cs->p_dumper) {
-		pcap_dump_close(cs->p_dumper);
-		cs->p_dumper = NULL;
+	if (cs->input) {
+		cshark_offline_pause(cs, pause);
+		return;
+	}
+
+	if (cs->backend == CSHARK_BACKEND_TPACKET) {
+		cshark_tpacket_pause(cs, pause);
+		return;
+	}
+
+	if (cs->ifaces) {
+		cshark_merge_pause(cs, pause);
+		return;
+	}
+
+	/* no pcap_breakloop(), the dispatch in progress finishes and the next one never starts */
+	if (pause) {
+		uloop_fd_delete(&ufd_pcap);
+	} else {
+		uloop_fd_add(&ufd_pcap, ULOOP_READ);
 	}
+}
+
+static void cshark_pcap_kernel_stats(struct cshark *cs)
+{
+	struct pcap_stat ps;
+
+	if (!cs->p || pcap_stats(cs->p, &ps))
+		return;
+
+	cs->stats_recv = ps.ps_recv;
+	cs->stats_drop = ps.ps_drop;
+	cs->stats_ifdrop = ps.ps_ifdrop;
+}
+
+/* live counters for the stats, caller holds cs->lock, the kernel ones end up in cs->stats_* */
+void cshark_pcap_stats(struct cshark *cs, uint64_t *packets, uint64_t *caplen)
+{
+	*packets = cs->packets;
+	*caplen = cs->caplen;
+
+	if (cs->backend == CSHARK_BACKEND_TPACKET)
+		cshark_tpacket_stats(cs, packets, caplen);
+	else if (cs->ifaces)
+		cshark_merge_stats(cs);
+	else
+		cshark_pcap_kernel_stats(cs);
+}
+
+void cshark_pcap_done(struct cshark *cs)
+{
+	cshark_tpacket_done(cs);
+	cshark_merge_stop(cs);
+
+	uloop_timeout_cancel(&budget_timeout);
+
+	if (cs->slice_saved)
+		LOG("slicing saved %lu bytes\n", (long unsigned int) cs->slice_saved);
+
+	if (cs->writer.full)
+		LOG("disk budget of %lu bytes used up, capture stopped\n",
+			(long unsigned int) cs->writer.limit);
+
+	if (cs->backend == CSHARK_BACKEND_PCAP && !cs->ifaces)
+		cshark_pcap_kernel_stats(cs);
+
+	if (cs->format == CSHARK_FORMAT_PCAPNG && cs->writer.ops && !cs->writer.full &&
+	    cshark_pcapng_write_stats(cs, &cs->writer))
+		ERROR("pcapng: could not write interface statistics\n");
+
+	cshark_writer_close(&cs->writer);
+	cshark_offline_done(cs);
+	cshark_merge_done(cs);
+	cshark_pcapng_done(cs);
 
 	if (cs->p) {
 		pcap_close(cs->p);
@@ -35,10 +35,21 @@
 
 #include "cshark.h"
 
+bool cshark_pcap_admit(struct cshark *cs, bpf_u_int32 caplen);
+int cshark_pcap_dump_packet(struct cshark *cs, const struct pcap_pkthdr *header, const u_char *sp,
+			    int ifindex);
+bool cshark_pcap_stage(struct cshark *cs, int linktype, struct pcap_pkthdr *header, const u_char *sp);
+void cshark_pcap_capture_packet(struct cshark *cs, const struct pcap_pkthdr *header,
+				const u_char *sp, int ifindex);
 void cshark_pcap_manage_packet(u_char *user, const struct pcap_pkthdr *header, const u_char *sp);
 void cshark_pcap_handle_packet_cb(struct uloop_fd *ufd, __unused unsigned int events);
 
+pcap_t *cshark_pcap_open(struct cshark *cs, const char *device, struct bpf_program *bfp, int timeout);
 int cshark_pcap_init(struct cshark *cs);
+int cshark_pcap_attach(struct cshark *cs, pcap_t *p);
+void cshark_pcap_pause(struct cshark *cs, bool pause);
+int cshark_pcap_snapshot(struct cshark *cs, const char *filename);
+void cshark_pcap_stats(struct cshark *cs, uint64_t *packets, uint64_t *caplen);
 void cshark_pcap_done(struct cshark *cs);
 
 extern struct uloop_fd ufd_pcap;
@@ -0,0 +1,302 @@
+/*
+ * Author: Luka Perkov <luka.perkov@sartura.hr>
+ *
+ * Copyright (C) 2014, QA Cafe, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * For more information see the project website [1].
+ *
+ * [1] https://www.cloudshark.org/
+ */
+
+#include <net/if.h>
+#include <time.h>
+
+#include "cshark.h"
+#include "merge.h"
+#include "pcapng.h"
+#include "recorder.h"
+
+#define PCAPNG_SHB 0x0a0d0d0a
+#define PCAPNG_IDB 0x00000001
+#define PCAPNG_ISB 0x00000005
+#define PCAPNG_EPB 0x00000006
+#define PCAPNG_BOM 0x1a2b3c4d
+
+#define PCAPNG_OPT_END 0
+#define PCAPNG_OPT_SHB_USERAPPL 4
+#define PCAPNG_OPT_IF_NAME 2
+#define PCAPNG_OPT_IF_TSRESOL 9
+#define PCAPNG_OPT_ISB_IFRECV 4
+#define PCAPNG_OPT_ISB_IFDROP 5
+#define PCAPNG_OPT_ISB_OSDROP 7
+#define PCAPNG_OPT_ISB_USRDELIV 8
+
+#define PCAPNG_PAD(x) (((x) + 3) & ~3)
+
+struct pcapng_epb {
+	uint32_t type;
+	uint32_t len;
+	uint32_t iface;
+	uint32_t ts_high;
+	uint32_t ts_low;
+	uint32_t caplen;
+	uint32_t origlen;
+};
+
+struct pcapng_idb {
+	uint16_t linktype;
+	uint16_t reserved;
+	uint32_t snaplen;
+};
+
+/* everything but packet blocks is small and built in one of these */
+struct cshark_pcapng_block {
+	uint8_t data[256];
+	size_t len;
+};
+
+static struct cshark_pcapng_iface idbs[PCAPNG_IFACE_MAX];
+static unsigned int idbs_nr;
+static unsigned int idb_last;
+
+static void cshark_pcapng_put(struct cshark_pcapng_block *b, const void *p, size_t len)
+{
+	memcpy(b->data + b->len, p, len);
+	memset(b->data + b->len + len, 0, PCAPNG_PAD(len) - len);
+	b->len += PCAPNG_PAD(len);
+}
+
+static void cshark_pcapng_opt(struct cshark_pcapng_block *b, uint16_t code, const void *p,
+			      uint16_t len)
+{
+	uint16_t opt[2] = { code, len };
+
+	cshark_pcapng_put(b, opt, sizeof(opt));
+	if (len)
+		cshark_pcapng_put(b, p, len);
+}
+
+static void cshark_pcapng_begin(struct cshark_pcapng_block *b)
+{
+	/* room for block type and length, filled in by cshark_pcapng_write_block() */
+	b->len = 2 * sizeof(uint32_t);
+}
+
+/* the block is staged by the writer, so it may live on the stack */
+static int cshark_pcapng_write_block(struct cshark_writer *w, uint32_t type,
+				     struct cshark_pcapng_block *b)
+{
+	uint32_t len = b->len + sizeof(len);
+
+	memcpy(b->data, &type, sizeof(type));
+	memcpy(b->data + sizeof(type), &len, sizeof(len));
+	w->keep = true;
+
+	return cshark_writer_append_block(w, b->data, b->len, NULL, 0, &len, sizeof(len));
+}
+
+static uint64_t cshark_pcapng_ts(struct cshark *cs, uint64_t sec, uint64_t frac)
+{
+	return sec * (cs->nano ? 1000000000 : 1000000) + frac;
+}
+
+static int cshark_pcapng_write_idb(struct cshark *cs, struct cshark_writer *w, int ifindex)
+{
+	struct cshark_iface *iface = cshark_merge_iface(cs, ifindex);
+	pcap_t *p = iface ? iface->p : cs->p;
+	struct cshark_pcapng_block b;
+	struct pcapng_idb idb;
+	char name[IF_NAMESIZE];
+	uint8_t tsresol = 9;
+
+	if (!ifindex || !if_indextoname(ifindex, name))
+		snprintf(name, sizeof(name), "%s", ifindex ? "unknown" : cs->interface);
+
+	/* merged interfaces keep their own link type */
+	idb.linktype = pcap_datalink(p);
+	idb.reserved = 0;
+	idb.snaplen = pcap_snapshot(p);
+
+	cshark_pcapng_begin(&b);
+	cshark_pcapng_put(&b, &idb, sizeof(idb));
+	cshark_pcapng_opt(&b, PCAPNG_OPT_IF_NAME, name, strlen(name));
+	if (cs->nano)
+		cshark_pcapng_opt(&b, PCAPNG_OPT_IF_TSRESOL, &tsresol, sizeof(tsresol));
+	cshark_pcapng_opt(&b, PCAPNG_OPT_END, NULL, 0);
+
+	return cshark_pcapng_write_block(w, PCAPNG_IDB, &b);
+}
+
+/* interface ids are handed out in the order interfaces are first seen */
+static int cshark_pcapng_iface(struct cshark *cs, int ifindex)
+{
+	unsigned int i;
+
+	if (idb_last < idbs_nr && idbs[idb_last].ifindex == ifindex)
+		return idb_last;
+
+	for (i = 0; i < idbs_nr; i++) {
+		if (idbs[i].ifindex == ifindex) {
+			idb_last = i;
+			return i;
+		}
+	}
+
+	if (idbs_nr == PCAPNG_IFACE_MAX)
+		return 0;
+
+	/* the recorder has no file yet, its snapshots describe all interfaces up front */
+	if (!cs->recorder && cshark_pcapng_write_idb(cs, &cs->writer, ifindex))
+		return -1;
+
+	i = idbs_nr++;
+	idbs[i].ifindex = ifindex;
+	idbs[i].packets = 0;
+	idb_last = i;
+
+	return i;
+}
+
+int cshark_pcapng_write_header(struct cshark *cs, struct cshark_writer *w)
+{
+	struct cshark_pcapng_block b;
+	uint32_t bom = PCAPNG_BOM;
+	uint16_t version[2] = { 1, 0 };
+	int64_t section_len = -1;
+	const char *appl = PROJECT_NAME " " PROJECT_VERSION;
+	unsigned int i;
+
+	cshark_pcapng_begin(&b);
+	cshark_pcapng_put(&b, &bom, sizeof(bom));
+	cshark_pcapng_put(&b, version, sizeof(version));
+	cshark_pcapng_put(&b, &section_len, sizeof(section_len));
+	cshark_pcapng_opt(&b, PCAPNG_OPT_SHB_USERAPPL, appl, strlen(appl));
+	cshark_pcapng_opt(&b, PCAPNG_OPT_END, NULL, 0);
+
+	if (cshark_pcapng_write_block(w, PCAPNG_SHB, &b))
+		return -1;
+
+	/* capture interfaces are known up front, 'any' on tpacket learns them per packet */
+	if (!idbs_nr && cs->ifaces) {
+		for (i = 0; i < cs->ifaces_nr && i < PCAPNG_IFACE_MAX; i++)
+			idbs[i].ifindex = cs->ifaces[i].ifindex;
+		idbs_nr = i;
+	} else if (!idbs_nr && (cs->backend != CSHARK_BACKEND_TPACKET || cs->ifindex)) {
+		idbs[0].ifindex = cs->ifindex;
+		idbs_nr = 1;
+	}
+
+	for (i = 0; i < idbs_nr; i++)
+		if (cshark_pcapng_write_idb(cs, w, idbs[i].ifindex))
+			return -1;
+
+	return 0;
+}
+
+int cshark_pcapng_dump_packet(struct cshark *cs, const struct pcap_pkthdr *header,
+			      const u_char *sp, int ifindex)
+{
+	struct pcapng_epb epb;
+	uint8_t tail[3 + sizeof(uint32_t)] = { 0 };
+	size_t pad = PCAPNG_PAD(header->caplen) - header->caplen;
+	uint64_t ts;
+	int id, rc;
+
+	id = cshark_pcapng_iface(cs, ifindex);
+	if (id < 0)
+		return -1;
+
+	ts = cshark_pcapng_ts(cs, header->ts.tv_sec, header->ts.tv_usec);
+
+	epb.type = PCAPNG_EPB;
+	epb.len = sizeof(epb) + header->caplen + pad + sizeof(uint32_t);
+	epb.iface = id;
+	epb.ts_high = ts >> 32;
+	epb.ts_low = ts & 0xffffffff;
+	epb.caplen = header->caplen;
+	epb.origlen = header->len;
+
+	/* padding and the trailing block length follow the packet data */
+	memcpy(tail + pad, &epb.len, sizeof(epb.len));
+
+	if (cs->recorder)
+		rc = cshark_recorder_append(cs->recorder, header->ts.tv_sec, &epb, sizeof(epb),
+					    sp, header->caplen, tail, pad + sizeof(uint32_t));
+	else
+		rc = cshark_writer_append_block(&cs->writer, &epb, sizeof(epb), sp, header->caplen,
+						tail, pad + sizeof(uint32_t));
+
+	if (!rc)
+		idbs[id].packets++;
+
+	return rc;
+}
+
+/* kernel counters are per socket, without a handle per interface they go with the first one */
+int cshark_pcapng_write_stats(struct cshark *cs, struct cshark_writer *w)
+{
+	struct cshark_pcapng_block b;
+	struct timespec now;
+	uint32_t id, ts[2];
+	uint64_t t;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	t = cshark_pcapng_ts(cs, now.tv_sec, cs->nano ? now.tv_nsec : now.tv_nsec / 1000);
+	ts[0] = t >> 32;
+	ts[1] = t & 0xffffffff;
+
+	for (id = 0; id < idbs_nr; id++) {
+		struct cshark_iface *iface = cshark_merge_iface(cs, idbs[id].ifindex);
+
+		cshark_pcapng_begin(&b);
+		cshark_pcapng_put(&b, &id, sizeof(id));
+		cshark_pcapng_put(&b, ts, sizeof(ts));
+
+		if (iface) {
+			cshark_pcapng_opt(&b, PCAPNG_OPT_ISB_IFRECV, &iface->recv, sizeof(iface->recv));
+			cshark_pcapng_opt(&b, PCAPNG_OPT_ISB_IFDROP, &iface->ifdrops, sizeof(iface->ifdrops));
+			cshark_pcapng_opt(&b, PCAPNG_OPT_ISB_OSDROP, &iface->drops, sizeof(iface->drops));
+		} else if (!id) {
+			cshark_pcapng_opt(&b, PCAPNG_OPT_ISB_IFRECV, &cs->stats_recv,
+					  sizeof(cs->stats_recv));
+			cshark_pcapng_opt(&b, PCAPNG_OPT_ISB_IFDROP, &cs->stats_ifdrop,
+					  sizeof(cs->stats_ifdrop));
+			cshark_pcapng_opt(&b, PCAPNG_OPT_ISB_OSDROP, &cs->stats_drop,
+					  sizeof(cs->stats_drop));
+		}
+		cshark_pcapng_opt(&b, PCAPNG_OPT_ISB_USRDELIV, &idbs[id].packets,
+				  sizeof(idbs[id].packets));
+		cshark_pcapng_opt(&b, PCAPNG_OPT_END, NULL, 0);
+
+		if (cshark_pcapng_write_block(w, PCAPNG_ISB, &b))
+			return -1;
+	}
+
+	return 0;
+}
+
+void cshark_pcapng_done(struct cshark *cs)
+{
+	idbs_nr = 0;
+	idb_last = 0;
+}
@@ -0,0 +1,341 @@
+/*
+ * Author: Luka Perkov <luka.perkov@sartura.hr>
+ *
+ * Copyright (C) 2014, QA Cafe, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * For more information see the project website [1].
+ *
+ * [1] https://www.cloudshark.org/
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+
+#include <libubox/uloop.h>
+
+#include "cshark.h"
+#include "config.h"
+#include "pcap.h"
+#include "recorder.h"
+#include "uclient.h"
+
+static void cshark_recorder_signal_cb(struct uloop_fd *ufd, __unused unsigned int events);
+static void cshark_recorder_cleanup_cb(struct uloop_timeout *t);
+
+static struct cshark_recorder recorder;
+static struct uloop_fd ufd_signal = { .cb = cshark_recorder_signal_cb, .fd = -1 };
+static struct uloop_timeout cleanup_timeout = { .cb = cshark_recorder_cleanup_cb };
+static char *snapshot_filename;
+
+static size_t cshark_recorder_reclen(struct cshark_recorder *r, size_t off)
+{
+	struct cshark_record rec;
+
+	memcpy(&rec, r->buf + off, sizeof(rec));
+	return sizeof(rec) + rec.len;
+}
+
+static uint32_t cshark_recorder_oldest(struct cshark_recorder *r)
+{
+	struct cshark_record rec;
+
+	memcpy(&rec, r->buf + r->tail, sizeof(rec));
+	return rec.ts;
+}
+
+static void cshark_recorder_evict(struct cshark_recorder *r)
+{
+	r->tail += cshark_recorder_reclen(r, r->tail);
+	r->count--;
+	r->overwritten++;
+
+	/* end of the wrapped part, the oldest records continue at the start */
+	if (r->wrap && r->tail == r->wrap) {
+		r->tail = 0;
+		r->wrap = 0;
+	}
+
+	if (!r->count)
+		r->head = r->tail = r->wrap = 0;
+}
+
+int cshark_recorder_append(struct cshark_recorder *r, uint32_t ts, const void *hdr, size_t hlen,
+			   const void *data, size_t len, const void *tail, size_t tlen)
+{
+	struct cshark_record rec = { .len = hlen + len + tlen, .ts = ts };
+	size_t need = sizeof(rec) + hlen + len + tlen;
+	uint8_t *p;
+
+	if (need > r->size)
+		return 0;
+
+	while (r->seconds && r->count && cshark_recorder_oldest(r) + r->seconds < ts)
+		cshark_recorder_evict(r);
+
+	/* data lives in [tail, head) or, once wrapped, in [tail, wrap) and [0, head) */
+	for (;;) {
+		if (!r->wrap) {
+			if (r->size - r->head >= need)
+				break;
+
+			r->wrap = r->head;
+			r->head = 0;
+		}
+
+		if (r->tail - r->head >= need)
+			break;
+
+		cshark_recorder_evict(r);
+	}
+
+	p = r->buf + r->head;
+	memcpy(p, &rec, sizeof(rec));
+	memcpy(p + sizeof(rec), hdr, hlen);
+	memcpy(p + sizeof(rec) + hlen, data, len);
+	if (tlen)
+		memcpy(p + sizeof(rec) + hlen + len, tail, tlen);
+
+	r->head += need;
+	r->count++;
+
+	return 0;
+}
+
+int cshark_recorder_foreach(struct cshark_recorder *r, cshark_recorder_cb cb, void *priv)
+{
+	struct cshark_record rec;
+	size_t off = r->tail;
+	uint64_t i;
+	int rc;
+
+	for (i = 0; i < r->count; i++) {
+		if (r->wrap && off == r->wrap)
+			off = 0;
+
+		memcpy(&rec, r->buf + off, sizeof(rec));
+
+		rc = cb(priv, r->buf + off + sizeof(rec), rec.len);
+		if (rc)
+			return rc;
+
+		off += sizeof(rec) + rec.len;
+	}
+
+	return 0;
+}
+
+/* copies the records into an arena of their own so they can be written without cs->lock */
+int cshark_recorder_copy(const struct cshark_recorder *r, struct cshark_recorder *copy)
+{
+	size_t first = (r->wrap ? r->wrap : r->head) - r->tail;
+	size_t used = first + (r->wrap ? r->head : 0);
+
+	memset(copy, 0, sizeof(*copy));
+	if (!r->count || !used)
+		return 0;
+
+	copy->buf = mmap(NULL, used, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (copy->buf == MAP_FAILED) {
+		copy->buf = NULL;
+		ERROR("recorder: unable to allocate %lu bytes for snapshot: %s\n",
+			(long unsigned int) used, strerror(errno));
+		return -1;
+	}
+
+	/* the copy starts at the oldest record and never wraps */
+	memcpy(copy->buf, r->buf + r->tail, first);
+	if (r->wrap)
+		memcpy(copy->buf + first, r->buf, r->head);
+
+	copy->size = used;
+	copy->head = used;
+	copy->count = r->count;
+
+	return 0;
+}
+
+void cshark_recorder_release(struct cshark_recorder *copy)
+{
+	if (copy->buf)
+		munmap(copy->buf, copy->size);
+	copy->buf = NULL;
+}
+
+/* only async-signal-safe calls in here, the snapshot itself runs from uloop */
+static void cshark_recorder_signal(__unused int signo)
+{
+	uint64_t v = 1;
+
+	if (write(ufd_signal.fd, &v, sizeof(v)) < 0)
+		return;
+}
+
+static void cshark_recorder_signal_cb(struct uloop_fd *ufd, __unused unsigned int events)
+{
+	uint64_t v;
+
+	if (read(ufd->fd, &v, sizeof(v)) < 0)
+		return;
+
+	cshark_recorder_snapshot(&cshark);
+}
+
+static void cshark_recorder_cleanup(struct cshark *cs)
+{
+	cshark_uclient_done(cs);
+	cs->upload_done = NULL;
+
+	if (snapshot_filename) {
+		remove(snapshot_filename);
+		free(snapshot_filename);
+		snapshot_filename = NULL;
+	}
+
+	recorder.uploading = false;
+}
+
+/* uclient can not be freed from its own callback so clean up on the next loop iteration */
+static void cshark_recorder_cleanup_cb(struct uloop_timeout *t)
+{
+	cshark_recorder_cleanup(&cshark);
+}
+
+static void cshark_recorder_upload_done(struct cshark *cs)
+{
+	if (cs->upload_failed)
+		ERROR("snapshot upload failed\n");
+
+	uloop_timeout_set(&cleanup_timeout, 0);
+}
+
+int cshark_recorder_snapshot(struct cshark *cs)
+{
+	struct cshark_recorder *r = &recorder;
+	int fd, len;
+	int rc;
+
+	if (r->uploading) {
+		LOG("snapshot upload still in progress, try again later\n");
+		return -1;
+	}
+
+	len = snprintf(NULL, 0, "%s/cshark.pcap-XXXXXX", config.dir);
+	snapshot_filename = calloc(len + 1, sizeof(char));
+	if (!snapshot_filename) {
+		ERROR("not enough memory\n");
+		return -1;
+	}
+	snprintf(snapshot_filename, len + 1, "%s/cshark.pcap-XXXXXX", config.dir);
+
+	fd = mkstemp(snapshot_filename);
+	if (fd == -1) {
+		ERROR("unable to create snapshot file\n");
+		free(snapshot_filename);
+		snapshot_filename = NULL;
+		return -1;
+	}
+	close(fd);
+
+	rc = cshark_pcap_snapshot(cs, snapshot_filename);
+	if (rc)
+		goto exit;
+
+	LOG("uploading snapshot of %lu packets ...\n", (long unsigned int) r->count);
+
+	r->uploading = true;
+	cs->upload_done = cshark_recorder_upload_done;
+
+	rc = cshark_uclient_upload(cs, snapshot_filename);
+
+exit:
+	if (rc)
+		cshark_recorder_cleanup(cs);
+
+	return rc;
+}
+
+int cshark_recorder_init(struct cshark *cs)
+{
+	struct cshark_recorder *r = &recorder;
+	struct sigaction sa;
+
+	memset(r, 0, sizeof(*r));
+	r->size = cs->recorder_size;
+	r->seconds = cs->recorder_seconds;
+
+	/* the whole arena is committed up front, capture never allocates */
+	r->buf = mmap(NULL, r->size, PROT_READ | PROT_WRITE,
+		      MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+	if (r->buf == MAP_FAILED) {
+		r->buf = NULL;
+		ERROR("recorder: unable to allocate %lu bytes: %s\n",
+			(long unsigned int) r->size, strerror(errno));
+		return -1;
+	}
+
+	ufd_signal.fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (ufd_signal.fd < 0) {
+		ERROR("recorder: unable to create eventfd: %s\n", strerror(errno));
+		return -1;
+	}
+	uloop_fd_add(&ufd_signal, ULOOP_READ);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = cshark_recorder_signal;
+	sa.sa_flags = SA_RESTART;
+	sigaction(SIGUSR1, &sa, NULL);
+
+	cs->recorder = r;
+
+	return 0;
+}
+
+void cshark_recorder_done(struct cshark *cs)
+{
+	struct cshark_recorder *r = &recorder;
+
+	if (!r->buf)
+		return;
+
+	signal(SIGUSR1, SIG_DFL);
+
+	if (ufd_signal.registered)
+		uloop_fd_delete(&ufd_signal);
+	if (ufd_signal.fd >= 0)
+		close(ufd_signal.fd);
+	ufd_signal.fd = -1;
+
+	uloop_timeout_cancel(&cleanup_timeout);
+	if (r->uploading) {
+		LOG("capture stopped, cancelling snapshot upload\n");
+		cshark_recorder_cleanup(cs);
+	}
+
+	DEBUG("%lu packets overwritten\n", (long unsigned int) r->overwritten);
+
+	munmap(r->buf, r->size);
+	r->buf = NULL;
+	cs->recorder = NULL;
+}
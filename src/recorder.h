@@ -0,0 +1,75 @@
+/*
+ * Author: Luka Perkov <luka.perkov@sartura.hr>
+ *
+ * Copyright (C) 2014, QA Cafe, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * For more information see the project website [1].
+ *
+ * [1] https://www.cloudshark.org/
+ */
+
+#ifndef __CSHARK_RECORDER_H__
+#define __CSHARK_RECORDER_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "cshark.h"
+
+/*
+ * Every record in the arena is a small prefix followed by the record exactly
+ * as the capture format writes it, records never wrap around the arena end.
+ */
+struct cshark_record {
+	uint32_t len;
+	uint32_t ts;
+};
+
+struct cshark_recorder {
+	uint8_t *buf;
+	size_t size;
+
+	size_t head;
+	size_t tail;
+	size_t wrap;
+	uint64_t count;
+
+	/* records older than this many seconds are dropped, 0 keeps what fits */
+	uint32_t seconds;
+
+	uint64_t overwritten;
+	bool uploading;
+};
+
+typedef int (*cshark_recorder_cb)(void *priv, const void *rec, size_t len);
+
+int cshark_recorder_init(struct cshark *cs);
+int cshark_recorder_append(struct cshark_recorder *r, uint32_t ts, const void *hdr, size_t hlen,
+			   const void *data, size_t len, const void *tail, size_t tlen);
+int cshark_recorder_foreach(struct cshark_recorder *r, cshark_recorder_cb cb, void *priv);
+int cshark_recorder_copy(const struct cshark_recorder *r, struct cshark_recorder *copy);
+void cshark_recorder_release(struct cshark_recorder *copy);
+int cshark_recorder_snapshot(struct cshark *cs);
+void cshark_recorder_done(struct cshark *cs);
+
+#endif /* __CSHARK_RECORDER_H__ */
@@ -0,0 +1,367 @@
+/*
+ * Author: Luka Perkov <luka.perkov@sartura.hr>
+ *
+ * Copyright (C) 2014, QA Cafe, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * For more information see the project website [1].
+ *
+ * [1] https://www.cloudshark.org/
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#include <libubox/uloop.h>
+#include <libubox/usock.h>
+
+#include <json-c/json.h>
+
+#include "cshark.h"
+#include "config.h"
+#include "sendfile.h"
+#include "shaper.h"
+#include "uclient.h"
+
+/*
+ * Plain http uploads do not need anything from uclient but the response
+ * handling, so the capture file is handed to the socket with sendfile()
+ * and never copied through userspace.
+ */
+struct cshark_sendfile {
+	struct uloop_fd ufd;
+	int file;
+	uint64_t size;
+	off_t offset;
+	off_t start_offset;
+
+	char head[2 * BUFSIZ];
+	size_t head_len;
+	size_t head_sent;
+
+	char resp[SENDFILE_RESPONSE_MAX];
+	size_t resp_len;
+
+	bool connected;
+	struct timespec start;
+};
+
+static void cshark_sendfile_cb(struct uloop_fd *ufd, unsigned int events);
+
+static struct cshark_sendfile sf = { .ufd = { .cb = cshark_sendfile_cb, .fd = -1 }, .file = -1 };
+
+static void cshark_sendfile_shaper_cb(struct cshark_shaper_waiter *w);
+
+static struct cshark_shaper_waiter sf_waiter = { .cb = cshark_sendfile_shaper_cb };
+
+static void cshark_sendfile_close(void)
+{
+	cshark_shaper_cancel(&sf_waiter);
+
+	if (sf.ufd.registered)
+		uloop_fd_delete(&sf.ufd);
+	if (sf.ufd.fd >= 0)
+		close(sf.ufd.fd);
+	sf.ufd.fd = -1;
+
+	if (sf.file >= 0)
+		close(sf.file);
+	sf.file = -1;
+}
+
+static void cshark_sendfile_finish(bool ok)
+{
+	cshark_sendfile_close();
+	cshark_uclient_complete(ok);
+}
+
+/* decode a chunked body in place, the response is small and complete by now */
+static size_t cshark_sendfile_dechunk(char *body, size_t len)
+{
+	char *src = body, *dst = body, *end = body + len;
+	unsigned long n;
+	char *p;
+
+	while (src < end) {
+		n = strtoul(src, &p, 16);
+		if (p == src || !n)
+			break;
+
+		p = memmem(p, end - p, "\r\n", 2);
+		if (!p || (size_t) (end - p - 2) < n)
+			break;
+
+		memmove(dst, p + 2, n);
+		dst += n;
+		src = p + 2 + n + 2;
+	}
+
+	return dst - body;
+}
+
+static bool cshark_sendfile_response(void)
+{
+	json_object *json_obj;
+	char *body;
+	size_t len;
+	int status = 0;
+	bool ok;
+
+	sf.resp[sf.resp_len] = 0;
+
+	if (sscanf(sf.resp, "HTTP/%*d.%*d %d", &status) != 1 || status != 200) {
+		ERROR("%s: received error, please double check your config file\n", PROJECT_NAME);
+		return false;
+	}
+
+	body = strstr(sf.resp, "\r\n\r\n");
+	if (!body) {
+		ERROR("sendfile: incomplete response\n");
+		return false;
+	}
+	*body = 0;
+	body += 4;
+	len = sf.resp + sf.resp_len - body;
+
+	if (strcasestr(sf.resp, "\r\nTransfer-Encoding: chunked"))
+		len = cshark_sendfile_dechunk(body, len);
+	body[len] = 0;
+
+	json_obj = json_tokener_parse(body);
+	if (!json_obj) {
+		ERROR("json stream contains invalid data\n");
+		return false;
+	}
+
+	ok = cshark_uclient_response(json_obj);
+	json_object_put(json_obj);
+
+	return ok;
+}
+
+/* failures return -errno, taken right where they happen before anything else can change it */
+static int cshark_sendfile_write(void)
+{
+	ssize_t len;
+	size_t n;
+
+	while (sf.head_sent < sf.head_len) {
+		len = send(sf.ufd.fd, sf.head + sf.head_sent, sf.head_len - sf.head_sent, MSG_NOSIGNAL);
+		if (len < 0)
+			return errno == EAGAIN ? 0 : -errno;
+		sf.head_sent += len;
+	}
+
+	while ((uint64_t) sf.offset < sf.size) {
+		/* no interest in the socket until the shaper has tokens again */
+		n = cshark_shaper_allow(&cshark, &sf_waiter, sf.size - sf.offset);
+		if (!n) {
+			uloop_fd_delete(&sf.ufd);
+			return 0;
+		}
+
+		len = sendfile(sf.ufd.fd, sf.file, &sf.offset, n);
+		if (len < 0)
+			return errno == EAGAIN ? 0 : -errno;
+		if (!len) {
+			ERROR("sendfile: capture file got shorter while uploading\n");
+			return -EIO;
+		}
+		cshark_shaper_consume(len);
+		cshark.upload_sent = sf.offset;
+	}
+
+	cshark_uclient_throughput("sendfile", sf.size - sf.start_offset, &sf.start);
+
+	/* everything is out, wait for the response */
+	uloop_fd_delete(&sf.ufd);
+	uloop_fd_add(&sf.ufd, ULOOP_READ);
+
+	return 0;
+}
+
+static void cshark_sendfile_shaper_cb(struct cshark_shaper_waiter *w)
+{
+	if (sf.ufd.fd >= 0)
+		uloop_fd_add(&sf.ufd, ULOOP_WRITE);
+}
+
+static int cshark_sendfile_read(void)
+{
+	ssize_t len;
+
+	for (;;) {
+		if (sf.resp_len == sizeof(sf.resp) - 1) {
+			ERROR("sendfile: response too big\n");
+			return -EMSGSIZE;
+		}
+
+		len = recv(sf.ufd.fd, sf.resp + sf.resp_len, sizeof(sf.resp) - 1 - sf.resp_len, 0);
+		if (len < 0)
+			return errno == EAGAIN ? 0 : -errno;
+
+		/* the request asked for the connection to be closed after the response */
+		if (!len) {
+			DEBUG("done reading response\n");
+			cshark_sendfile_finish(cshark_sendfile_response());
+			return 0;
+		}
+
+		sf.resp_len += len;
+	}
+}
+
+static void cshark_sendfile_cb(struct uloop_fd *ufd, unsigned int events)
+{
+	int err = 0;
+	socklen_t err_len = sizeof(err);
+	int rc;
+
+	if (!sf.connected) {
+		if (getsockopt(ufd->fd, SOL_SOCKET, SO_ERROR, &err, &err_len) < 0 || err) {
+			ERROR("%s: connection failed\n", PROJECT_NAME);
+			cshark_sendfile_finish(false);
+			return;
+		}
+		sf.connected = true;
+	}
+
+	if (events & ULOOP_WRITE)
+		rc = cshark_sendfile_write();
+	else
+		rc = cshark_sendfile_read();
+
+	if (rc) {
+		ERROR("sendfile: upload failed: %s\n", strerror(-rc));
+		cshark_sendfile_finish(false);
+	}
+}
+
+int cshark_sendfile_upload(struct cshark *cs, const char *filename)
+{
+	char url[BUFSIZ+35];
+	char authority[BUFSIZ];
+	char host[BUFSIZ];
+	char range[96] = "";
+	const char *port = "80";
+	const char *path;
+	char *p;
+	struct stat st;
+	int rc = -1;
+
+	cshark_sendfile_close();
+	sf.head_len = sf.head_sent = sf.resp_len = 0;
+	sf.offset = 0;
+	sf.connected = false;
+
+	if (cshark_uclient_url(url, sizeof(url)))
+		goto exit;
+
+	/* http://host[:port]/path, the Host header gets the authority as it is in the url */
+	snprintf(authority, sizeof(authority), "%s", url + strlen("http://"));
+	p = strchr(authority, '/');
+	if (p)
+		*p = 0;
+	path = url + strlen("http://") + strlen(authority);
+	if (!*path)
+		path = "/";
+
+	/* only the connect needs the port split off and an ipv6 literal out of its brackets */
+	snprintf(host, sizeof(host), "%s", authority);
+	p = strrchr(host, ':');
+	if (p && !strchr(p, ']')) {
+		*p = 0;
+		port = p + 1;
+	}
+
+	if (host[0] == '[') {
+		p = strchr(host, ']');
+		if (!p) {
+			ERROR("url is invalid or too big\n");
+			goto exit;
+		}
+		*p = 0;
+		memmove(host, host + 1, p - host);
+	}
+
+	sf.file = open(filename, O_RDONLY | O_CLOEXEC);
+	if (sf.file < 0 || fstat(sf.file, &st) < 0) {
+		ERROR("sendfile: could not open file '%s'\n", filename);
+		goto exit;
+	}
+	sf.size = st.st_size;
+	sf.offset = cs->upload_offset < sf.size ? cs->upload_offset : 0;
+	cshark.upload_size = sf.size;
+	cshark.upload_sent = sf.offset;
+
+	/* a resumed upload only sends what the server does not have yet */
+	if (sf.offset)
+		snprintf(range, sizeof(range), "Content-Range: bytes %lu-%lu/%lu\r\n",
+			(long unsigned int) sf.offset, (long unsigned int) sf.size - 1,
+			(long unsigned int) sf.size);
+
+	rc = snprintf(sf.head, sizeof(sf.head),
+		"PUT %s HTTP/1.1\r\n"
+		"Host: %s\r\n"
+		"User-Agent: %s/%s\r\n"
+		"Content-Length: %lu\r\n"
+		"Upload-Id: %s\r\n"
+		"%s"
+		"Connection: close\r\n"
+		"\r\n",
+		path, authority, PROJECT_NAME, PROJECT_VERSION, (long unsigned int) (sf.size - sf.offset),
+		cs->upload_id, range);
+	if (rc < 0 || (size_t) rc >= sizeof(sf.head)) {
+		ERROR("url is invalid or too big\n");
+		rc = -1;
+		goto exit;
+	}
+	sf.head_len = rc;
+
+	sf.ufd.fd = usock(USOCK_TCP | USOCK_NONBLOCK, host, port);
+	if (sf.ufd.fd < 0) {
+		ERROR("%s: could not connect to '%s'\n", PROJECT_NAME, url);
+		rc = -1;
+		goto exit;
+	}
+
+	sf.start_offset = sf.offset;
+	clock_gettime(CLOCK_MONOTONIC, &sf.start);
+	uloop_fd_add(&sf.ufd, ULOOP_WRITE);
+
+	rc = 0;
+exit:
+	if (rc)
+		cshark_sendfile_close();
+
+	return rc;
+}
+
+void cshark_sendfile_done(struct cshark *cs)
+{
+	cshark_sendfile_close();
+}
@@ -0,0 +1,367 @@
+/*
+ * Author: Luka Perkov <luka.perkov@sartura.hr>
+ *
+ * Copyright (C) 2014, QA Cafe, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * For more information see the project website [1].
+ *
+ * [1] https://www.cloudshark.org/
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <libubox/uloop.h>
+
+#include "config.h"
+#include "cshark.h"
+#include "dedup.h"
+#include "flow.h"
+#include "pcap.h"
+#include "recorder.h"
+#include "session.h"
+#include "spool.h"
+#include "stats.h"
+#include "stream.h"
+#include "uclient.h"
+
+/*
+ * One capture from start to uploaded file. The command line runs a single
+ * session, the daemon runs them back to back; both end a step by leaving
+ * the main loop with uloop_end().
+ */
+
+static void cshark_session_timeout_cb(struct uloop_timeout *t)
+{
+	DEBUG("timeout reached, stopping capture\n");
+	uloop_end();
+}
+
+static struct uloop_timeout session_timeout = { .cb = cshark_session_timeout_cb };
+
+static void cshark_session_spooled_cb(struct uloop_timeout *t)
+{
+	uloop_end();
+}
+
+/* a spooled capture has nothing to wait for, the main loop ends right away */
+static struct uloop_timeout session_spooled = { .cb = cshark_session_spooled_cb };
+
+int cshark_session_setup(struct cshark *cs, const struct cshark_options *o)
+{
+	const char *backend = o->backend;
+	const char *fanout = o->fanout;
+	const char *writer = o->writer;
+	const char *compress = o->compress;
+	const char *format = o->format;
+	int rc = -1;
+
+	/* command line options take precedence over uci */
+	if (!backend) backend = config.backend;
+	if (!cs->ring_block_size) cs->ring_block_size = config.ring_block_size;
+	if (!cs->ring_block_nr) cs->ring_block_nr = config.ring_block_nr;
+	if (!cs->ring_block_timeout) cs->ring_block_timeout = config.ring_block_timeout;
+
+	if (!cs->workers) cs->workers = config.workers;
+	if (!fanout) fanout = config.fanout;
+	if (!cs->cpus && config.cpus[0]) cs->cpus = config.cpus;
+	if (!writer) writer = config.writer;
+	if (!cs->disk_budget) cs->disk_budget = config.disk_budget;
+	if (!cs->stream) cs->stream = config.stream;
+	if (!cs->stream_buffer) cs->stream_buffer = config.stream_buffer;
+	if (cs->stream_buffer < STREAM_BUFFER_MIN) cs->stream_buffer = STREAM_BUFFER_MIN;
+	if (!cs->recorder_size) cs->recorder_size = config.recorder_size;
+	if (!cs->recorder_seconds) cs->recorder_seconds = config.recorder_seconds;
+	cs->upload_window = config.upload_window;
+	if (!format) format = config.format;
+	if (!compress) compress = config.compress;
+	if (!cs->compress_level) cs->compress_level = config.compress_level;
+	cs->compress_threads = config.compress_threads;
+	if (!cs->slice) cs->slice = config.slice;
+	if (!cs->dedup_window) cs->dedup_window = config.dedup_window;
+	if (!cs->flow_packets) cs->flow_packets = config.flow_packets;
+	if (!cs->flow_bytes) cs->flow_bytes = config.flow_bytes;
+	if (!cs->flow_sample) cs->flow_sample = config.flow_sample;
+	cs->stats_interval = config.stats_interval;
+	if (!cs->stats_file && config.stats_file[0]) cs->stats_file = config.stats_file;
+	cs->slice_keep[CSHARK_SLICE_DNS] = config.slice_dns;
+	cs->slice_keep[CSHARK_SLICE_HTTP] = config.slice_http;
+	cs->slice_keep[CSHARK_SLICE_TLS] = config.slice_tls;
+	cs->slice_keep[CSHARK_SLICE_OTHER] = config.slice_other;
+
+	/* a capture file read from disk goes straight into the upload unless a copy is asked for */
+	if (cs->input && !cs->filename && !cs->keep && !config.spool && !cs->recorder_size)
+		cs->stream = true;
+
+	if (!strcmp(backend, "tpacket")) {
+		cs->backend = CSHARK_BACKEND_TPACKET;
+	} else if (strcmp(backend, "pcap")) {
+		ERROR("unknown capture backend '%s'\n", backend);
+		goto exit;
+	}
+
+	if (!strcmp(fanout, "cpu")) {
+		cs->fanout = CSHARK_FANOUT_CPU;
+	} else if (!strcmp(fanout, "queue")) {
+		cs->fanout = CSHARK_FANOUT_QUEUE;
+	} else if (strcmp(fanout, "hash")) {
+		ERROR("unknown fanout mode '%s'\n", fanout);
+		goto exit;
+	}
+
+	cs->writer_ops = cshark_writer_find(writer);
+	if (!cs->writer_ops) {
+		ERROR("unknown or unsupported writer '%s'\n", writer);
+		goto exit;
+	}
+
+	if (!strcmp(format, "pcapng")) {
+		cs->format = CSHARK_FORMAT_PCAPNG;
+	} else if (strcmp(format, "pcap")) {
+		ERROR("unknown capture file format '%s'\n", format);
+		goto exit;
+	}
+
+	if (strcmp(compress, "none")) {
+		cs->compress_ops = cshark_compress_find(compress);
+		if (!cs->compress_ops) {
+			ERROR("unknown or unsupported compression '%s'\n", compress);
+			goto exit;
+		}
+	}
+
+	if (cs->input && cs->backend != CSHARK_BACKEND_PCAP) {
+		ERROR("reading a capture file requires the pcap backend\n");
+		goto exit;
+	}
+
+	if (strchr(cs->interface, ',') && cs->backend != CSHARK_BACKEND_PCAP) {
+		ERROR("a list of interfaces requires the pcap backend\n");
+		goto exit;
+	}
+
+	if (cs->workers > 1 && cs->backend != CSHARK_BACKEND_TPACKET) {
+		ERROR("capture workers require the tpacket backend\n");
+		goto exit;
+	}
+
+	if (cs->stream && cs->recorder_size) {
+		ERROR("flight recorder can not be used while uploading during capture\n");
+		goto exit;
+	}
+
+	if (cs->stream && cs->filename) {
+		ERROR("capture is uploaded while capturing, ignoring '-w %s'\n", cs->filename);
+		free(cs->filename);
+		cs->filename = NULL;
+	}
+
+	if (!cs->filename && !cs->stream) {
+		int len = 0;
+		len = snprintf(cs->filename, 0, "%s/cshark.pcap-XXXXXX", config.dir);
+
+		cs->filename = calloc(len + 1, sizeof(char));
+		if (!cs->filename) {
+			ERROR("not enough memory\n");
+			goto exit;
+		}
+		snprintf(cs->filename, len + 1, "%s/cshark.pcap-XXXXXX", config.dir);
+
+		int fd = mkstemp(cs->filename);
+		if (fd == -1) {
+			ERROR("unable to create dump file\n");
+			goto exit;
+		}
+		close(fd);
+	}
+
+	rc = 0;
+exit:
+	return rc;
+}
+
+int cshark_session_start(struct cshark *cs)
+{
+	int rc;
+
+	cs->state = CSHARK_STATE_CAPTURING;
+
+	if (cs->stats_interval)
+		cshark_stats_init(cs);
+
+	if (cs->stream) {
+		rc = cshark_stream_init(cs);
+		if (rc)
+			goto exit;
+	}
+
+	if (cs->recorder_size) {
+		rc = cshark_recorder_init(cs);
+		if (rc)
+			goto exit;
+	}
+
+	if (cs->dedup_window) {
+		rc = cshark_dedup_init(cs);
+		if (rc)
+			goto exit;
+	}
+
+	if (cs->flow_packets || cs->flow_bytes || cs->flow_sample > 1) {
+		rc = cshark_flow_init(cs);
+		if (rc)
+			goto exit;
+	}
+
+	rc = cshark_pcap_init(cs);
+	if (rc)
+		goto exit;
+
+	if (cs->limit_seconds)
+		uloop_timeout_set(&session_timeout, cs->limit_seconds * 1000);
+
+	if (cs->input)
+		printf("reading packets from '%s'%s ...\n", cs->input, cs->stream ? " and uploading them" : "");
+	else if (cs->stream)
+		printf("capturing and uploading traffic ...\n");
+	else if (cs->recorder)
+		printf("recording traffic, send SIGUSR1 to %d to upload a snapshot ...\n", (int) getpid());
+	else
+		printf("capturing traffic to file: '%s' ...\n", cs->filename);
+
+exit:
+	return rc;
+}
+
+/* the background uploader takes the capture from here */
+static int cshark_session_spool(struct cshark *cs)
+{
+	int rc;
+
+	rc = cshark_spool_add(cs);
+	if (rc)
+		return rc;
+
+	cshark_spool_kick();
+	cs->state = CSHARK_STATE_UPLOADING;
+	uloop_timeout_set(&session_spooled, 0);
+
+	return 0;
+}
+
+int cshark_session_stop(struct cshark *cs)
+{
+	int rc;
+
+	uloop_timeout_cancel(&session_timeout);
+
+	/* whatever the flight recorder still holds becomes the capture file */
+	if (cs->recorder) {
+		rc = cshark_pcap_snapshot(cs, cs->filename);
+		if (rc)
+			goto exit;
+	}
+
+	/* workers may still write into the recorder until capture is done */
+	cshark_pcap_done(cs);
+	cshark_recorder_done(cs);
+	cshark_dedup_done(cs);
+	cshark_flow_done(cs);
+	printf("\n%lu packets captured\n", (long unsigned int) cs->packets);
+
+	if (config.spool && !cs->stream)
+		rc = cshark_session_spool(cs);
+	else
+		rc = cshark_session_upload(cs);
+
+exit:
+	return rc;
+}
+
+int cshark_session_upload(struct cshark *cs)
+{
+	int rc;
+
+	if (cs->stream)
+		rc = cshark_stream_finish(cs);
+	else
+		rc = cshark_uclient_init(cs);
+	if (rc)
+		return rc;
+
+	cs->state = CSHARK_STATE_UPLOADING;
+	cshark_stats_update(cs);
+
+	printf("uploading capture ...\n");
+
+	return 0;
+}
+
+/* a capture kept after its upload failed, uploaded again without capturing anything */
+int cshark_session_resume(struct cshark *cs, const char *filename)
+{
+	free(cs->filename);
+	cs->filename = strdup(filename);
+	if (!cs->filename) {
+		ERROR("not enough memory\n");
+		return -1;
+	}
+
+	cs->stream = false;
+	cs->upload_window = config.upload_window;
+	cs->stats_interval = config.stats_interval;
+	if (!cs->stats_file && config.stats_file[0]) cs->stats_file = config.stats_file;
+
+	if (cs->stats_interval)
+		cshark_stats_init(cs);
+
+	return cshark_session_upload(cs);
+}
+
+/* safe to call more than once, and at any point after setup */
+void cshark_session_finish(struct cshark *cs, bool ok)
+{
+	uloop_timeout_cancel(&session_timeout);
+	uloop_timeout_cancel(&session_spooled);
+
+	if (cs->state == CSHARK_STATE_CAPTURING || cs->state == CSHARK_STATE_UPLOADING)
+		cs->state = ok && !cs->upload_failed && !cs->stream_dropped ?
+			CSHARK_STATE_DONE : CSHARK_STATE_FAILED;
+
+	cshark_stats_done(cs);
+	cshark_pcap_done(cs);
+	cshark_recorder_done(cs);
+	cshark_dedup_done(cs);
+	cshark_flow_done(cs);
+	cshark_stream_done(cs);
+	cshark_uclient_done(cs);
+
+	if (!cs->keep && cs->filename) {
+		remove(cs->filename);
+		cshark_uclient_state_remove(cs->filename);
+	}
+	free(cs->filename);
+	cs->filename = NULL;
+}
@@ -0,0 +1,289 @@
+/*
+ * Author: Luka Perkov <luka.perkov@sartura.hr>
+ *
+ * Copyright (C) 2014, QA Cafe, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * For more information see the project website [1].
+ *
+ * [1] https://www.cloudshark.org/
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <libubox/uloop.h>
+
+#include "config.h"
+#include "cshark.h"
+#include "shaper.h"
+
+/*
+ * Uploads from a router share the uplink with the traffic it is there for,
+ * so they can be held to a rate with a token bucket. Tokens come in at the
+ * rate, up to the burst, and every byte handed to a connection takes one.
+ * A writer that finds the bucket empty is put on a list and called back
+ * from a timer once enough came in, nothing ever sleeps. The rate can
+ * follow a schedule of local time windows, to upload at full speed at night.
+ */
+struct cshark_shaper_window {
+	/* minutes after midnight, a window that ends before it starts goes over midnight */
+	unsigned int from;
+	unsigned int to;
+	/* bytes per second, 0 for no limit */
+	uint64_t rate;
+};
+
+struct cshark_shaper {
+	uint64_t rate;
+	uint64_t burst;
+	double tokens;
+	struct timespec last;
+
+	struct cshark_shaper_window windows[SHAPER_WINDOWS];
+	unsigned int windows_nr;
+	time_t checked;
+
+	bool throttled;
+	struct timespec throttled_since;
+
+	struct list_head waiters;
+	struct uloop_timeout timeout;
+};
+
+static void cshark_shaper_timeout_cb(struct uloop_timeout *t);
+
+static struct cshark_shaper shaper = {
+	.waiters = LIST_HEAD_INIT(shaper.waiters),
+	.timeout = { .cb = cshark_shaper_timeout_cb },
+};
+
+static uint64_t cshark_shaper_kbit(unsigned int kbit)
+{
+	return (uint64_t) kbit * 1000 / 8;
+}
+
+/* 'HH:MM-HH:MM=kbit' windows separated by spaces */
+static void cshark_shaper_schedule(const char *schedule)
+{
+	struct cshark_shaper_window *w;
+	unsigned int h1, m1, h2, m2, kbit;
+	const char *p = schedule;
+	int n;
+
+	shaper.windows_nr = 0;
+
+	while (*p) {
+		while (*p == ' ' || *p == ',')
+			p++;
+		if (!*p)
+			break;
+
+		if (sscanf(p, "%u:%u-%u:%u=%u%n", &h1, &m1, &h2, &m2, &kbit, &n) != 5 ||
+				h1 > 23 || h2 > 24 || m1 > 59 || m2 > 59) {
+			ERROR("shaper: could not parse upload schedule at '%s'\n", p);
+			return;
+		}
+		p += n;
+
+		if (shaper.windows_nr == SHAPER_WINDOWS) {
+			ERROR("shaper: only %u upload schedule windows are used\n", SHAPER_WINDOWS);
+			return;
+		}
+
+		w = &shaper.windows[shaper.windows_nr++];
+		w->from = h1 * 60 + m1;
+		w->to = h2 * 60 + m2;
+		w->rate = cshark_shaper_kbit(kbit);
+	}
+}
+
+/* the limit for this time of day, looked up at most once a second */
+static uint64_t cshark_shaper_rate(void)
+{
+	struct cshark_shaper_window *w;
+	unsigned int minute, i;
+	time_t now;
+	struct tm tm;
+	bool in;
+
+	if (!shaper.windows_nr)
+		return cshark_shaper_kbit(config.upload_rate);
+
+	now = time(NULL);
+	if (now == shaper.checked)
+		return shaper.rate;
+	shaper.checked = now;
+
+	localtime_r(&now, &tm);
+	minute = tm.tm_hour * 60 + tm.tm_min;
+
+	for (i = 0; i < shaper.windows_nr; i++) {
+		w = &shaper.windows[i];
+		if (w->from <= w->to)
+			in = minute >= w->from && minute < w->to;
+		else
+			in = minute >= w->from || minute < w->to;
+
+		if (in)
+			return w->rate;
+	}
+
+	return cshark_shaper_kbit(config.upload_rate);
+}
+
+static void cshark_shaper_unthrottle(struct cshark *cs, const struct timespec *now)
+{
+	if (!shaper.throttled)
+		return;
+
+	shaper.throttled = false;
+	cs->upload_throttled += (now->tv_sec - shaper.throttled_since.tv_sec) * 1000 +
+		(now->tv_nsec - shaper.throttled_since.tv_nsec) / 1000000;
+}
+
+static void cshark_shaper_timeout_cb(struct uloop_timeout *t)
+{
+	struct cshark_shaper_waiter *w;
+	LIST_HEAD(waiters);
+
+	/* a waiter that is still short of tokens queues up again, behind the others */
+	list_splice_init(&shaper.waiters, &waiters);
+
+	while (!list_empty(&waiters)) {
+		w = list_first_entry(&waiters, struct cshark_shaper_waiter, list);
+		list_del(&w->list);
+		w->queued = false;
+		w->cb(w);
+	}
+}
+
+/* how much of want can be written now, 0 puts the writer on the list to be called back */
+size_t cshark_shaper_allow(struct cshark *cs, struct cshark_shaper_waiter *w, size_t want)
+{
+	struct timespec now;
+	double need;
+	unsigned int wait;
+
+	shaper.rate = cshark_shaper_rate();
+	cs->upload_rate = shaper.rate;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	if (!shaper.rate) {
+		cshark_shaper_unthrottle(cs, &now);
+		return want;
+	}
+
+	shaper.tokens += ((now.tv_sec - shaper.last.tv_sec) +
+		(now.tv_nsec - shaper.last.tv_nsec) / 1e9) * shaper.rate;
+	if (shaper.tokens > shaper.burst)
+		shaper.tokens = shaper.burst;
+	shaper.last = now;
+
+	if (shaper.tokens >= 1) {
+		cshark_shaper_unthrottle(cs, &now);
+		return want < shaper.tokens ? want : (size_t) shaper.tokens;
+	}
+
+	if (!shaper.throttled) {
+		shaper.throttled = true;
+		shaper.throttled_since = now;
+	}
+
+	if (w && !w->queued) {
+		list_add_tail(&w->list, &shaper.waiters);
+		w->queued = true;
+	}
+
+	/* waking up for every few bytes would only cost cpu */
+	need = want;
+	if (need > SHAPER_QUANTUM)
+		need = SHAPER_QUANTUM;
+	if (need > shaper.burst)
+		need = shaper.burst;
+
+	wait = (need - shaper.tokens) * 1000 / shaper.rate + 1;
+	if (!shaper.timeout.pending)
+		uloop_timeout_set(&shaper.timeout, wait);
+
+	return 0;
+}
+
+void cshark_shaper_consume(size_t len)
+{
+	if (shaper.rate)
+		shaper.tokens -= len;
+}
+
+void cshark_shaper_cancel(struct cshark_shaper_waiter *w)
+{
+	if (!w->queued)
+		return;
+
+	list_del(&w->list);
+	w->queued = false;
+}
+
+void cshark_shaper_report(struct cshark *cs)
+{
+	if (!config.upload_rate && !shaper.windows_nr)
+		return;
+
+	if (cs->upload_rate)
+		LOG("upload held to %lu kbit/s, throttled for %.2f s\n",
+			(long unsigned int) (cs->upload_rate * 8 / 1000), cs->upload_throttled / 1e3);
+	else
+		LOG("upload not limited, throttled for %.2f s\n", cs->upload_throttled / 1e3);
+}
+
+void cshark_shaper_init(struct cshark *cs)
+{
+	cshark_shaper_done(cs);
+
+	cshark_shaper_schedule(config.upload_schedule);
+	shaper.checked = 0;
+	/* with less than a quantum in the bucket a waiting writer would be woken up forever */
+	shaper.burst = config.upload_burst;
+	if (shaper.burst < SHAPER_QUANTUM)
+		shaper.burst = SHAPER_QUANTUM;
+	shaper.tokens = shaper.burst;
+	shaper.throttled = false;
+	clock_gettime(CLOCK_MONOTONIC, &shaper.last);
+
+	shaper.rate = cshark_shaper_rate();
+	cs->upload_rate = shaper.rate;
+	cs->upload_throttled = 0;
+}
+
+void cshark_shaper_done(struct cshark *cs)
+{
+	struct cshark_shaper_waiter *w, *tmp;
+
+	uloop_timeout_cancel(&shaper.timeout);
+
+	list_for_each_entry_safe(w, tmp, &shaper.waiters, list) {
+		list_del(&w->list);
+		w->queued = false;
+	}
+}
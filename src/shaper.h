@@ -0,0 +1,60 @@
+/*
+ * Author: Luka Perkov <luka.perkov@sartura.hr>
+ *
+ * Copyright (C) 2014, QA Cafe, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * For more information see the project website [1].
+ *
+ * [1] https://www.cloudshark.org/
+ */
+
+#ifndef __CSHARK_SHAPER_H__
+#define __CSHARK_SHAPER_H__
+
+#include <libubox/list.h>
+
+#include "cshark.h"
+
+/* default burst of the upload rate limit, in KiB */
+#define UPLOAD_BURST 64
+
+/* windows an upload schedule can have */
+#define SHAPER_WINDOWS 8
+
+/* a writer out of tokens is called back once a write of this size is allowed again */
+#define SHAPER_QUANTUM 4096
+
+struct cshark_shaper_waiter {
+	struct list_head list;
+	bool queued;
+	void (*cb)(struct cshark_shaper_waiter *w);
+};
+
+void cshark_shaper_init(struct cshark *cs);
+size_t cshark_shaper_allow(struct cshark *cs, struct cshark_shaper_waiter *w, size_t want);
+void cshark_shaper_consume(size_t len);
+void cshark_shaper_cancel(struct cshark_shaper_waiter *w);
+void cshark_shaper_report(struct cshark *cs);
+void cshark_shaper_done(struct cshark *cs);
+
+#endif /* __CSHARK_SHAPER_H__ */
@@ -0,0 +1,452 @@
+/*
+ * Author: Luka Perkov <luka.perkov@sartura.hr>
+ *
+ * Copyright (C) 2014, QA Cafe, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * For more information see the project website [1].
+ *
+ * [1] https://www.cloudshark.org/
+ */
+
+#include "cshark.h"
+#include "slice.h"
+
+/*
+ * Finds where the payload starts by walking the headers, without allocating
+ * and without trusting any length field past the captured bytes. Every
+ * parser returns the payload offset, or -1 when the packet is kept whole.
+ */
+
+#define ETH_P_IP 0x0800
+#define ETH_P_IPV6 0x86dd
+#define ETH_P_8021Q 0x8100
+#define ETH_P_8021AD 0x88a8
+#define ETH_P_QINQ 0x9100
+#define ETH_P_PPP_SES 0x8864
+#define ETH_P_MPLS_UC 0x8847
+#define ETH_P_MPLS_MC 0x8848
+#define ETH_P_TEB 0x6558
+
+#define UDP_PORT_VXLAN 4789
+#define UDP_PORT_GENEVE 6081
+
+#ifndef DLT_LINUX_SLL2
+#define DLT_LINUX_SLL2 276
+#endif
+
+struct cshark_slice_pkt {
+	const u_char *p;
+	bpf_u_int32 len;
+	enum cshark_slice_class cls;
+	int depth;
+};
+
+static int cshark_slice_ether(struct cshark_slice_pkt *k, bpf_u_int32 off);
+static int cshark_slice_ethertype(struct cshark_slice_pkt *k, bpf_u_int32 off, uint16_t type);
+
+static inline uint16_t cshark_slice_get16(const u_char *p)
+{
+	return p[0] << 8 | p[1];
+}
+
+static enum cshark_slice_class cshark_slice_port(uint16_t port, bool tcp)
+{
+	switch (port) {
+		case 53:
+		case 5353:
+		case 5355:
+			return CSHARK_SLICE_DNS;
+		case 80:
+		case 3128:
+		case 8000:
+		case 8080:
+			return tcp ? CSHARK_SLICE_HTTP : CSHARK_SLICE_OTHER;
+		case 443:
+		case 853:
+			/* udp 443 is QUIC, its handshake is TLS as well */
+			return CSHARK_SLICE_TLS;
+		case 465:
+		case 993:
+		case 995:
+		case 5061:
+		case 8443:
+			return tcp ? CSHARK_SLICE_TLS : CSHARK_SLICE_OTHER;
+		default:
+			return CSHARK_SLICE_OTHER;
+	}
+}
+
+static void cshark_slice_classify(struct cshark_slice_pkt *k, const u_char *ports, bool tcp)
+{
+	k->cls = cshark_slice_port(cshark_slice_get16(ports + 2), tcp);
+	if (k->cls == CSHARK_SLICE_OTHER)
+		k->cls = cshark_slice_port(cshark_slice_get16(ports), tcp);
+}
+
+static int cshark_slice_ipv4(struct cshark_slice_pkt *k, bpf_u_int32 off);
+static int cshark_slice_ipv6(struct cshark_slice_pkt *k, bpf_u_int32 off);
+
+static int cshark_slice_l4(struct cshark_slice_pkt *k, bpf_u_int32 off, uint8_t proto)
+{
+	const u_char *p = k->p + off;
+	uint16_t flags, type, hl;
+
+	switch (proto) {
+		case 4:
+			return ++k->depth > SLICE_DEPTH ? (int) off : cshark_slice_ipv4(k, off);
+
+		case 41:
+			return ++k->depth > SLICE_DEPTH ? (int) off : cshark_slice_ipv6(k, off);
+
+		case 47:
+			if (off + 4 > k->len)
+				return -1;
+
+			/* only version 0, PPTP uses version 1 for its own payload */
+			flags = cshark_slice_get16(p);
+			if (flags & 0x7)
+				return off;
+
+			type = cshark_slice_get16(p + 2);
+			hl = 4 + (flags & 0x8000 ? 4 : 0) + (flags & 0x2000 ? 4 : 0) + (flags & 0x1000 ? 4 : 0);
+
+			if (++k->depth > SLICE_DEPTH)
+				return off;
+			if (type == ETH_P_TEB)
+				return cshark_slice_ether(k, off + hl);
+			return cshark_slice_ethertype(k, off + hl, type);
+
+		case 6:
+			/* a data offset below the fixed header is as broken as a cut one */
+			if (off + 20 > k->len || (p[12] >> 4) < 5)
+				return -1;
+
+			cshark_slice_classify(k, p, true);
+			return off + (p[12] >> 4) * 4;
+
+		case 17:
+			if (off + 8 > k->len)
+				return -1;
+
+			if (cshark_slice_get16(p + 2) == UDP_PORT_VXLAN && ++k->depth <= SLICE_DEPTH)
+				return cshark_slice_ether(k, off + 8 + 8);
+
+			if (cshark_slice_get16(p + 2) == UDP_PORT_GENEVE && ++k->depth <= SLICE_DEPTH) {
+				if (off + 16 > k->len)
+					return -1;
+
+				hl = 8 + (p[8] & 0x3f) * 4;
+				type = cshark_slice_get16(p + 10);
+				if (type == ETH_P_TEB)
+					return cshark_slice_ether(k, off + 8 + hl);
+				return cshark_slice_ethertype(k, off + 8 + hl, type);
+			}
+
+			cshark_slice_classify(k, p, false);
+			return off + 8;
+
+		/* icmp is small and its errors quote the offending headers */
+		case 1:
+		case 58:
+			return -1;
+
+		default:
+			return off;
+	}
+}
+
+static int cshark_slice_ipv4(struct cshark_slice_pkt *k, bpf_u_int32 off)
+{
+	const u_char *p = k->p + off;
+	unsigned int ihl;
+
+	if (off + 20 > k->len || (p[0] >> 4) != 4)
+		return -1;
+
+	ihl = (p[0] & 0xf) * 4;
+	if (ihl < 20)
+		return -1;
+
+	/* later fragments carry no transport header */
+	if (cshark_slice_get16(p + 6) & 0x1fff)
+		return off + ihl;
+
+	return cshark_slice_l4(k, off + ihl, p[9]);
+}
+
+/*
+ * skips the extension headers behind the ipv6 header at off, returns the offset of the
+ * upper layer header with its protocol in nh, l4 is false when there is none to look at
+ * such as in later fragments, or -1 when the packet ends first
+ */
+int cshark_slice_ipv6_ext(const u_char *pkt, bpf_u_int32 len, bpf_u_int32 off, uint8_t *nh, bool *l4)
+{
+	const u_char *p = pkt + off;
+	int i;
+
+	*l4 = false;
+	*nh = p[6];
+	off += 40;
+
+	for (i = 0; i < 8; i++) {
+		p = pkt + off;
+
+		switch (*nh) {
+			case 0:
+			case 43:
+			case 60:
+				if (off + 2 > len)
+					return -1;
+				*nh = p[0];
+				off += (p[1] + 1) * 8;
+				break;
+
+			case 44:
+				if (off + 8 > len)
+					return -1;
+				*nh = p[0];
+				off += 8;
+				if (cshark_slice_get16(p + 2) & 0xfff8)
+					return off;
+				break;
+
+			case 51:
+				if (off + 2 > len)
+					return -1;
+				*nh = p[0];
+				off += (p[1] + 2) * 4;
+				break;
+
+			case 59:
+				return off;
+
+			default:
+				*l4 = true;
+				return off;
+		}
+	}
+
+	return off;
+}
+
+static int cshark_slice_ipv6(struct cshark_slice_pkt *k, bpf_u_int32 off)
+{
+	const u_char *p = k->p + off;
+	uint8_t nh;
+	bool l4;
+	int rc;
+
+	if (off + 40 > k->len || (p[0] >> 4) != 6)
+		return -1;
+
+	rc = cshark_slice_ipv6_ext(k->p, k->len, off, &nh, &l4);
+	if (rc < 0 || !l4)
+		return rc;
+
+	return cshark_slice_l4(k, rc, nh);
+}
+
+static int cshark_slice_ethertype(struct cshark_slice_pkt *k, bpf_u_int32 off, uint16_t type)
+{
+	const u_char *p;
+	uint16_t ppp;
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		p = k->p + off;
+
+		switch (type) {
+			case ETH_P_8021Q:
+			case ETH_P_8021AD:
+			case ETH_P_QINQ:
+				if (off + 4 > k->len)
+					return -1;
+				type = cshark_slice_get16(p + 2);
+				off += 4;
+				break;
+
+			case ETH_P_PPP_SES:
+				if (off + 8 > k->len)
+					return -1;
+				ppp = cshark_slice_get16(p + 6);
+				off += 8;
+				if (ppp == 0x0021)
+					type = ETH_P_IP;
+				else if (ppp == 0x0057)
+					type = ETH_P_IPV6;
+				else
+					return -1;
+				break;
+
+			case ETH_P_MPLS_UC:
+			case ETH_P_MPLS_MC:
+				/* no protocol field, guess from the version after the bottom label */
+				for (;;) {
+					if (off + 4 > k->len)
+						return -1;
+					off += 4;
+					if (p[2] & 0x1)
+						break;
+					p += 4;
+				}
+				if (off + 1 > k->len)
+					return -1;
+				type = (k->p[off] >> 4) == 6 ? ETH_P_IPV6 : ETH_P_IP;
+				break;
+
+			case ETH_P_IP:
+				return cshark_slice_ipv4(k, off);
+
+			case ETH_P_IPV6:
+				return cshark_slice_ipv6(k, off);
+
+			default:
+				return -1;
+		}
+	}
+
+	return -1;
+}
+
+static int cshark_slice_ether(struct cshark_slice_pkt *k, bpf_u_int32 off)
+{
+	if (off + 14 > k->len)
+		return -1;
+
+	return cshark_slice_ethertype(k, off + 14, cshark_slice_get16(k->p + off + 12));
+}
+
+/* offset of the ip header behind the link layer, tags and pppoe, or -1 */
+int cshark_slice_l3(int linktype, const u_char *p, bpf_u_int32 len, int *version)
+{
+	bpf_u_int32 off;
+	uint16_t type, ppp;
+	int i;
+
+	switch (linktype) {
+		case DLT_EN10MB:
+			if (len < 14)
+				return -1;
+			off = 14;
+			type = cshark_slice_get16(p + 12);
+			break;
+		case DLT_LINUX_SLL:
+			if (len < 16)
+				return -1;
+			off = 16;
+			type = cshark_slice_get16(p + 14);
+			break;
+		case DLT_LINUX_SLL2:
+			if (len < 20)
+				return -1;
+			off = 20;
+			type = cshark_slice_get16(p);
+			break;
+		case DLT_RAW:
+		case DLT_IPV4:
+		case DLT_IPV6:
+			if (!len)
+				return -1;
+			off = 0;
+			type = (p[0] >> 4) == 6 ? ETH_P_IPV6 : ETH_P_IP;
+			break;
+		default:
+			return -1;
+	}
+
+	for (i = 0; i < 4; i++) {
+		switch (type) {
+			case ETH_P_8021Q:
+			case ETH_P_8021AD:
+			case ETH_P_QINQ:
+				if (off + 4 > len)
+					return -1;
+				type = cshark_slice_get16(p + off + 2);
+				off += 4;
+				break;
+
+			case ETH_P_PPP_SES:
+				if (off + 8 > len)
+					return -1;
+				ppp = cshark_slice_get16(p + off + 6);
+				off += 8;
+				type = ppp == 0x0021 ? ETH_P_IP : ppp == 0x0057 ? ETH_P_IPV6 : 0;
+				break;
+
+			case ETH_P_IP:
+				if (off + 20 > len || (p[off] >> 4) != 4)
+					return -1;
+				*version = 4;
+				return off;
+
+			case ETH_P_IPV6:
+				if (off + 40 > len || (p[off] >> 4) != 6)
+					return -1;
+				*version = 6;
+				return off;
+
+			default:
+				return -1;
+		}
+	}
+
+	return -1;
+}
+
+bpf_u_int32 cshark_slice(struct cshark *cs, int linktype, const u_char *p, bpf_u_int32 caplen)
+{
+	struct cshark_slice_pkt k = { .p = p, .len = caplen, .cls = CSHARK_SLICE_OTHER };
+	uint64_t keep;
+	int off;
+
+	switch (linktype) {
+		case DLT_EN10MB:
+			off = cshark_slice_ether(&k, 0);
+			break;
+		case DLT_LINUX_SLL:
+			off = caplen < 16 ? -1 : cshark_slice_ethertype(&k, 16, cshark_slice_get16(p + 14));
+			break;
+		case DLT_LINUX_SLL2:
+			off = caplen < 20 ? -1 : cshark_slice_ethertype(&k, 20, cshark_slice_get16(p));
+			break;
+		case DLT_RAW:
+		case DLT_IPV4:
+		case DLT_IPV6:
+			off = !caplen ? -1 : (p[0] >> 4) == 6 ? cshark_slice_ipv6(&k, 0) : cshark_slice_ipv4(&k, 0);
+			break;
+		default:
+			off = -1;
+			break;
+	}
+
+	if (off < 0)
+		return caplen;
+
+	keep = (uint64_t) off + cs->slice_keep[k.cls];
+	if (keep >= caplen)
+		return caplen;
+
+	cs->slice_saved += caplen - keep;
+
+	return keep;
+}
@@ -0,0 +1,54 @@
+/*
+ * Author: Luka Perkov <luka.perkov@sartura.hr>
+ *
+ * Copyright (C) 2014, QA Cafe, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * For more information see the project website [1].
+ *
+ * [1] https://www.cloudshark.org/
+ */
+
+#ifndef __CSHARK_SLICE_H__
+#define __CSHARK_SLICE_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <pcap.h>
+
+#include "cshark.h"
+
+/* payload bytes kept per protocol class by default, anything above the snaplen keeps it all */
+#define SLICE_DNS 65535
+#define SLICE_HTTP 1024
+#define SLICE_TLS 512
+#define SLICE_OTHER 64
+
+/* tunnels are followed this deep before the rest counts as payload */
+#define SLICE_DEPTH 4
+
+int cshark_slice_l3(int linktype, const u_char *p, bpf_u_int32 len, int *version);
+int cshark_slice_ipv6_ext(const u_char *pkt, bpf_u_int32 len, bpf_u_int32 off, uint8_t *nh, bool *l4);
+bpf_u_int32 cshark_slice(struct cshark *cs, int linktype, const u_char *p, bpf_u_int32 caplen);
+
+#endif /* __CSHARK_SLICE_H__ */
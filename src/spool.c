@@ -0,0 +1,603 @@
+/*
+ * Author: Luka Perkov <luka.perkov@sartura.hr>
+ *
+ * Copyright (C) 2014, QA Cafe, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * For more information see the project website [1].
+ *
+ * [1] https://www.cloudshark.org/
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <libubox/uloop.h>
+
+#include "config.h"
+#include "cshark.h"
+#include "spool.h"
+#include "uclient.h"
+
+/*
+ * With the spool on, a finished capture is not uploaded by the process
+ * that took it. It is moved into spool_dir under a name of its own and
+ * a background uploader, a 'cshark -U' started for the purpose, sends
+ * the spooled captures oldest first over one connection and exits once
+ * the spool is empty. A capture shows up in the spool only once it is
+ * complete on disk, and the upload id kept next to it lets an interrupted
+ * upload go on where it stopped, so nothing in the spool is lost to a
+ * crash or a reboot; the next uploader picks it up.
+ *
+ * The manifest lists the captures with their size, when they were spooled
+ * and whether the server turned them down. The directory is what counts,
+ * the manifest is brought in line with it every time it is read, and it
+ * is only ever replaced in one rename under the manifest lock.
+ */
+struct cshark_spool {
+	struct cshark_spool_entry *entries;
+	unsigned int nr;
+};
+
+/* the one uploader that may run, and the capture it is on */
+struct cshark_uploader {
+	int lock;
+	char name[32];
+	bool stop;
+	unsigned int uploaded;
+	struct uloop_timeout next;
+};
+
+static void cshark_spool_next_cb(struct uloop_timeout *t);
+
+static struct cshark_uploader uploader = { .lock = -1, .next = { .cb = cshark_spool_next_cb } };
+
+static void cshark_spool_path(char *path, size_t len, const char *name)
+{
+	snprintf(path, len, "%s/%s", config.spool_dir, name);
+}
+
+/* only names the spool gave out, not upload state files or what else is in there */
+static bool cshark_spool_name(const char *name, time_t *created)
+{
+	long unsigned int t;
+	unsigned int seq;
+	int n = 0;
+
+	if (sscanf(name, "cshark-%10lu-%4u%n", &t, &seq, &n) != 2 || name[n] ||
+			strlen(name) != strlen("cshark-0000000000-0000"))
+		return false;
+
+	if (created)
+		*created = t;
+
+	return true;
+}
+
+static int cshark_spool_entry_cmp(const void *a, const void *b)
+{
+	return strcmp(((const struct cshark_spool_entry *) a)->name,
+		((const struct cshark_spool_entry *) b)->name);
+}
+
+static struct cshark_spool_entry *cshark_spool_find(struct cshark_spool *sp, const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < sp->nr; i++)
+		if (!strcmp(sp->entries[i].name, name))
+			return &sp->entries[i];
+
+	return NULL;
+}
+
+static struct cshark_spool_entry *cshark_spool_append(struct cshark_spool *sp)
+{
+	struct cshark_spool_entry *entries;
+
+	entries = realloc(sp->entries, (sp->nr + 1) * sizeof(*entries));
+	if (!entries) {
+		ERROR("not enough memory\n");
+		return NULL;
+	}
+	sp->entries = entries;
+
+	memset(&entries[sp->nr], 0, sizeof(*entries));
+
+	return &entries[sp->nr++];
+}
+
+static void cshark_spool_drop(struct cshark_spool *sp, struct cshark_spool_entry *e)
+{
+	char path[PATH_MAX];
+
+	cshark_spool_path(path, sizeof(path), e->name);
+	remove(path);
+	cshark_uclient_state_remove(path);
+
+	sp->nr--;
+	memmove(e, e + 1, (sp->entries + sp->nr - e) * sizeof(*e));
+}
+
+/* every change of the spool holds this, the lock goes away with the process */
+static int cshark_spool_lock(void)
+{
+	char path[PATH_MAX];
+	int fd;
+
+	if (mkdir(config.spool_dir, 0700) && errno != EEXIST) {
+		ERROR("spool: could not create '%s'\n", config.spool_dir);
+		return -1;
+	}
+
+	cshark_spool_path(path, sizeof(path), SPOOL_MANIFEST ".lock");
+	fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (fd < 0 || flock(fd, LOCK_EX)) {
+		ERROR("spool: could not lock '%s'\n", path);
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static void cshark_spool_unlock(int lock)
+{
+	close(lock);
+}
+
+static int cshark_spool_load(struct cshark_spool *sp)
+{
+	struct cshark_spool_entry *e;
+	struct cshark_spool_entry entry;
+	char path[PATH_MAX];
+	char line[128];
+	char state[16];
+	long unsigned int created;
+	long long unsigned int size;
+	struct dirent *d;
+	struct stat st;
+	unsigned int i;
+	DIR *dir;
+	FILE *f;
+
+	memset(sp, 0, sizeof(*sp));
+
+	cshark_spool_path(path, sizeof(path), SPOOL_MANIFEST);
+	f = fopen(path, "r");
+	while (f && fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "%31s %llu %lu %15s", entry.name, &size, &created, state) != 4 ||
+				!cshark_spool_name(entry.name, NULL))
+			continue;
+
+		e = cshark_spool_append(sp);
+		if (!e)
+			break;
+
+		memcpy(e->name, entry.name, sizeof(e->name));
+		e->size = size;
+		e->created = created;
+		e->failed = !strcmp(state, "failed");
+	}
+	if (f)
+		fclose(f);
+
+	/* whatever was spooled but did not make it into the manifest before a crash */
+	dir = opendir(config.spool_dir);
+	if (!dir) {
+		ERROR("spool: could not read '%s'\n", config.spool_dir);
+		return -1;
+	}
+
+	while ((d = readdir(dir))) {
+		if (!cshark_spool_name(d->d_name, &entry.created) || cshark_spool_find(sp, d->d_name))
+			continue;
+
+		cshark_spool_path(path, sizeof(path), d->d_name);
+		if (stat(path, &st))
+			continue;
+
+		e = cshark_spool_append(sp);
+		if (!e)
+			break;
+
+		snprintf(e->name, sizeof(e->name), "%s", d->d_name);
+		e->size = st.st_size;
+		e->created = entry.created;
+	}
+	closedir(dir);
+
+	/* and the other way round, captures that are gone */
+	for (i = 0; i < sp->nr; ) {
+		cshark_spool_path(path, sizeof(path), sp->entries[i].name);
+		if (access(path, F_OK))
+			cshark_spool_drop(sp, &sp->entries[i]);
+		else
+			i++;
+	}
+
+	/* names sort by the time they were spooled */
+	qsort(sp->entries, sp->nr, sizeof(*sp->entries), cshark_spool_entry_cmp);
+
+	return 0;
+}
+
+static int cshark_spool_save(struct cshark_spool *sp)
+{
+	char path[PATH_MAX];
+	char tmp[PATH_MAX];
+	unsigned int i;
+	FILE *f;
+	int rc;
+
+	cshark_spool_path(path, sizeof(path), SPOOL_MANIFEST);
+	cshark_spool_path(tmp, sizeof(tmp), SPOOL_MANIFEST ".tmp");
+
+	f = fopen(tmp, "w");
+	if (!f) {
+		ERROR("spool: could not write '%s'\n", tmp);
+		return -1;
+	}
+
+	for (i = 0; i < sp->nr; i++)
+		fprintf(f, "%s %llu %lu %s\n", sp->entries[i].name,
+			(long long unsigned int) sp->entries[i].size,
+			(long unsigned int) sp->entries[i].created,
+			sp->entries[i].failed ? "failed" : "queued");
+
+	rc = fflush(f) || fsync(fileno(f));
+	rc |= fclose(f);
+	if (rc || rename(tmp, path)) {
+		ERROR("spool: could not write '%s'\n", path);
+		remove(tmp);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* oldest captures go first, the newest one stays even if it alone is over the quota */
+static void cshark_spool_quota(struct cshark_spool *sp)
+{
+	uint64_t total = 0;
+	unsigned int i;
+
+	if (!config.spool_quota)
+		return;
+
+	for (i = 0; i < sp->nr; i++)
+		total += sp->entries[i].size;
+
+	while (total > config.spool_quota && sp->nr > 1) {
+		LOG("spool: over quota, dropping '%s'\n", sp->entries[0].name);
+		total -= sp->entries[0].size;
+		cshark_spool_drop(sp, &sp->entries[0]);
+	}
+}
+
+/* hands cs->filename over to the spool, it is moved unless the capture is to be kept */
+int cshark_spool_add(struct cshark *cs)
+{
+	struct cshark_spool sp = { 0 };
+	struct cshark_spool_entry *e;
+	char name[sizeof(e->name)];
+	char path[PATH_MAX];
+	time_t now = time(NULL);
+	unsigned int seq;
+	struct stat st;
+	int fd, lock, rc = -1;
+
+	/* a capture is complete on disk before its name shows up in the spool */
+	fd = open(cs->filename, O_RDONLY | O_CLOEXEC);
+	if (fd < 0 || fstat(fd, &st) || fsync(fd)) {
+		ERROR("spool: could not open file '%s'\n", cs->filename);
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+	close(fd);
+
+	lock = cshark_spool_lock();
+	if (lock < 0)
+		return -1;
+
+	rc = cshark_spool_load(&sp);
+	if (rc)
+		goto exit;
+
+	/* link() never takes the name of a capture that is already there */
+	for (seq = 0; ; seq++) {
+		snprintf(name, sizeof(name), "cshark-%010lu-%04u", (long unsigned int) now, seq);
+		cshark_spool_path(path, sizeof(path), name);
+		if (!link(cs->filename, path))
+			break;
+
+		if (errno != EEXIST || seq == SPOOL_SEQ_MAX) {
+			ERROR("spool: could not add '%s' as '%s': %s\n", cs->filename, path, strerror(errno));
+			rc = -1;
+			goto exit;
+		}
+	}
+
+	if (!cs->keep)
+		remove(cs->filename);
+	free(cs->filename);
+	cs->filename = NULL;
+
+	e = cshark_spool_append(&sp);
+	if (!e) {
+		rc = -1;
+		goto exit;
+	}
+	memcpy(e->name, name, sizeof(e->name));
+	e->size = st.st_size;
+	e->created = now;
+
+	cshark_spool_quota(&sp);
+	rc = cshark_spool_save(&sp);
+
+	LOG("capture spooled as '%s'\n", path);
+
+exit:
+	cshark_spool_unlock(lock);
+	free(sp.entries);
+
+	return rc;
+}
+
+/* starts an uploader, one that finds another one running goes away again */
+void cshark_spool_kick(void)
+{
+	pid_t pid;
+
+	pid = fork();
+	if (pid < 0) {
+		ERROR("spool: could not start the uploader\n");
+		return;
+	}
+
+	if (pid) {
+		waitpid(pid, NULL, 0);
+		return;
+	}
+
+	/* the uploader is orphaned right away, nobody has to reap it */
+	if (!fork()) {
+		setsid();
+		execl("/proc/self/exe", PROJECT_NAME, "-U", (char *) NULL);
+	}
+
+	_exit(EXIT_SUCCESS);
+}
+
+/* the oldest capture that is still to be uploaded, false if there is none */
+static bool cshark_spool_next(char *name, size_t len)
+{
+	struct cshark_spool sp;
+	bool found = false;
+	unsigned int i;
+	int lock;
+
+	lock = cshark_spool_lock();
+	if (lock < 0)
+		return false;
+
+	if (!cshark_spool_load(&sp)) {
+		for (i = 0; i < sp.nr && !found; i++) {
+			if (sp.entries[i].failed)
+				continue;
+
+			found = true;
+			if (name)
+				snprintf(name, len, "%s", sp.entries[i].name);
+		}
+	}
+
+	cshark_spool_unlock(lock);
+	free(sp.entries);
+
+	return found;
+}
+
+static void cshark_spool_settle(const char *name, bool ok, bool rejected)
+{
+	struct cshark_spool sp;
+	struct cshark_spool_entry *e;
+	int lock;
+
+	lock = cshark_spool_lock();
+	if (lock < 0)
+		return;
+
+	if (!cshark_spool_load(&sp)) {
+		e = cshark_spool_find(&sp, name);
+		if (e && ok)
+			cshark_spool_drop(&sp, e);
+		else if (e && rejected)
+			e->failed = true;
+
+		cshark_spool_save(&sp);
+	}
+
+	cshark_spool_unlock(lock);
+	free(sp.entries);
+}
+
+static int cshark_spool_upload(struct cshark *cs)
+{
+	char path[PATH_MAX];
+
+	if (!cshark_spool_next(uploader.name, sizeof(uploader.name)))
+		return -1;
+
+	cshark_spool_path(path, sizeof(path), uploader.name);
+
+	/* the spool removes the capture once it is in */
+	free(cs->filename);
+	cs->filename = strdup(path);
+	cs->keep = true;
+	if (!cs->filename) {
+		ERROR("not enough memory\n");
+		goto error;
+	}
+
+	printf("uploading spooled capture '%s' ...\n", uploader.name);
+
+	if (!cshark_uclient_upload(cs, path))
+		return 0;
+
+error:
+	uploader.stop = true;
+	return -1;
+}
+
+static void cshark_spool_done_cb(struct cshark *cs)
+{
+	bool ok = !cs->upload_failed;
+
+	cshark_spool_settle(uploader.name, ok, cs->upload_rejected);
+
+	if (ok) {
+		uploader.uploaded++;
+	} else if (cs->upload_rejected) {
+		ERROR("spool: '%s' was turned down, it stays in the spool for '-R'\n", uploader.name);
+	} else {
+		LOG("spool: upload failed, the rest waits for the next uploader\n");
+		uploader.stop = true;
+		uloop_end();
+		return;
+	}
+
+	/* the upload completes from a uclient callback, the next one starts outside of it */
+	uloop_timeout_set(&uploader.next, 0);
+}
+
+static void cshark_spool_next_cb(struct uloop_timeout *t)
+{
+	if (cshark_spool_upload(&cshark))
+		uloop_end();
+}
+
+/* the only uploader holds this for as long as it runs */
+static int cshark_spool_claim(void)
+{
+	char path[PATH_MAX];
+	int fd;
+
+	cshark_spool_path(path, sizeof(path), "uploader.lock");
+	fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (fd < 0)
+		return -1;
+
+	if (flock(fd, LOCK_EX | LOCK_NB)) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+int cshark_spool_run(struct cshark *cs)
+{
+	bool again;
+	int lock;
+
+	lock = cshark_spool_lock();
+	if (lock < 0)
+		return -1;
+	cshark_spool_unlock(lock);
+
+	cs->upload_window = config.upload_window;
+	cs->upload_done = cshark_spool_done_cb;
+
+	uloop_init();
+
+	do {
+		uploader.lock = cshark_spool_claim();
+		if (uploader.lock < 0) {
+			DEBUG("spool: another uploader is running\n");
+			break;
+		}
+
+		uploader.stop = false;
+		if (!cshark_spool_upload(cs) && uloop_run())
+			uploader.stop = true;
+
+		uloop_timeout_cancel(&uploader.next);
+		cshark_uclient_done(cs);
+
+		close(uploader.lock);
+		uploader.lock = -1;
+
+		/* a capture spooled while this uploader was on its way out is not left behind */
+		again = !uploader.stop && cshark_spool_next(NULL, 0);
+	} while (again);
+
+	if (uploader.uploaded)
+		LOG("spool: %u captures uploaded\n", uploader.uploaded);
+
+	free(cs->filename);
+	cs->filename = NULL;
+
+	uloop_done();
+
+	return 0;
+}
+
+void cshark_spool_blob(struct blob_buf *b)
+{
+	struct cshark_spool sp;
+	unsigned int i, failed = 0;
+	uint64_t bytes = 0;
+	int lock;
+	void *t;
+
+	lock = cshark_spool_lock();
+	if (lock < 0)
+		return;
+
+	if (!cshark_spool_load(&sp)) {
+		for (i = 0; i < sp.nr; i++) {
+			bytes += sp.entries[i].size;
+			if (sp.entries[i].failed)
+				failed++;
+		}
+
+		t = blobmsg_open_table(b, "spool");
+		blobmsg_add_u32(b, "captures", sp.nr);
+		blobmsg_add_u32(b, "failed", failed);
+		blobmsg_add_u64(b, "bytes", bytes);
+		blobmsg_close_table(b, t);
+	}
+
+	cshark_spool_unlock(lock);
+	free(sp.entries);
+}
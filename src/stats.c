@@ -0,0 +1,310 @@
+/*
+ * Author: Luka Perkov <luka.perkov@sartura.hr>
+ *
+ * Copyright (C) 2014, QA Cafe, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * For more information see the project website [1].
+ *
+ * [1] https://www.cloudshark.org/
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <libubox/uloop.h>
+#include <libubox/blobmsg_json.h>
+
+#include "cshark.h"
+#include "config.h"
+#include "dedup.h"
+#include "flow.h"
+#include "merge.h"
+#include "pcap.h"
+#include "stats.h"
+
+static void cshark_stats_timeout_cb(struct uloop_timeout *t);
+
+static struct cshark_stats stats;
+static struct uloop_timeout stats_timeout = { .cb = cshark_stats_timeout_cb };
+static struct blob_buf stats_buf;
+static bool stats_running;
+static bool stats_failed;
+
+static const char *states[] = {
+	[CSHARK_STATE_IDLE] = "idle",
+	[CSHARK_STATE_CAPTURING] = "capturing",
+	[CSHARK_STATE_UPLOADING] = "uploading",
+	[CSHARK_STATE_DONE] = "done",
+	[CSHARK_STATE_FAILED] = "failed",
+};
+
+const char *cshark_stats_state(enum cshark_state state)
+{
+	return states[state];
+}
+
+static uint64_t cshark_stats_rate(uint64_t now, uint64_t then, double elapsed)
+{
+	return now > then ? (now - then) / elapsed : 0;
+}
+
+/* merged interfaces are only read from the main loop, the kernel counters were just refreshed */
+static void cshark_stats_ifaces(struct cshark *cs, struct cshark_stats *s)
+{
+	struct cshark_stats_iface *si;
+	struct cshark_iface *iface;
+	unsigned int i;
+
+	if (!cs->ifaces)
+		return;
+
+	for (i = 0; i < cs->ifaces_nr && i < STATS_IFACES; i++) {
+		iface = &cs->ifaces[i];
+		si = &s->ifaces[i];
+
+		snprintf(si->name, sizeof(si->name), "%s", iface->name);
+		si->packets = iface->packets;
+		si->bytes = iface->bytes;
+		si->drops = iface->drops;
+		si->ifdrops = iface->ifdrops;
+		si->queue_drops = iface->queue_drops;
+	}
+	s->ifaces_nr = i;
+}
+
+static void cshark_stats_sample(struct cshark *cs)
+{
+	struct cshark_stats *s = &stats;
+	struct timespec now;
+	uint64_t packets, caplen;
+	double elapsed;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	elapsed = (now.tv_sec - s->last.tv_sec) + (now.tv_nsec - s->last.tv_nsec) / 1e9;
+
+	/* workers update all of these under the lock, once per block */
+	pthread_mutex_lock(&cs->lock);
+	cshark_pcap_stats(cs, &packets, &caplen);
+	if (cs->writer.ops)
+		s->written = cs->writer.offset;
+	if (cs->dedup)
+		s->suppressed = cs->dedup->suppressed;
+	if (cs->flows) {
+		s->flow_capped = cs->flows->capped;
+		s->flow_sampled_out = cs->flows->sampled_out;
+		s->flow_used = cs->flows->used;
+		s->flow_size = cs->flows->mask + 1;
+		s->flow_seen = cs->flows->seen;
+		s->flow_evicted_idle = cs->flows->evicted_idle;
+		s->flow_evicted_lru = cs->flows->evicted_lru;
+	}
+	pthread_mutex_unlock(&cs->lock);
+
+	cshark_stats_ifaces(cs, s);
+
+	if (elapsed > 0) {
+		s->pps = cshark_stats_rate(packets, s->packets, elapsed);
+		s->bps = cshark_stats_rate(caplen, s->caplen, elapsed) * 8;
+		s->drop_rate = cshark_stats_rate(cs->stats_drop, s->drop, elapsed);
+		s->upload_bps = cshark_stats_rate(cs->upload_sent, s->upload_sent, elapsed) * 8;
+	}
+
+	s->packets = packets;
+	s->caplen = caplen;
+	s->recv = cs->stats_recv;
+	s->drop = cs->stats_drop;
+	s->ifdrop = cs->stats_ifdrop;
+	s->upload_sent = cs->upload_sent;
+	s->last = now;
+}
+
+void cshark_stats_blob(struct cshark *cs, struct blob_buf *b)
+{
+	struct cshark_stats *s = &stats;
+	unsigned int i;
+	void *t, *a;
+
+	blobmsg_add_string(b, "state", cshark_stats_state(cs->state));
+	blobmsg_add_string(b, "interface", cs->interface);
+	blobmsg_add_u32(b, "pid", getpid());
+	blobmsg_add_u64(b, "uptime", s->last.tv_sec - s->start.tv_sec);
+
+	t = blobmsg_open_table(b, "capture");
+	blobmsg_add_u64(b, "packets", s->packets);
+	blobmsg_add_u64(b, "bytes", s->caplen);
+	blobmsg_add_u64(b, "pps", s->pps);
+	blobmsg_add_u64(b, "bps", s->bps);
+	blobmsg_add_u64(b, "written", s->written);
+	if (cs->dedup_window)
+		blobmsg_add_u64(b, "suppressed", s->suppressed);
+	if (cs->flow_packets || cs->flow_bytes)
+		blobmsg_add_u64(b, "flow_capped", s->flow_capped);
+	if (cs->flow_sample > 1)
+		blobmsg_add_u64(b, "flow_sampled_out", s->flow_sampled_out);
+	if (cs->slice)
+		blobmsg_add_u64(b, "sliced", cs->slice_saved);
+	blobmsg_close_table(b, t);
+
+	if (s->flow_size) {
+		t = blobmsg_open_table(b, "flows");
+		blobmsg_add_u64(b, "seen", s->flow_seen);
+		blobmsg_add_u32(b, "used", s->flow_used);
+		blobmsg_add_u32(b, "size", s->flow_size);
+		blobmsg_add_u64(b, "evicted_idle", s->flow_evicted_idle);
+		blobmsg_add_u64(b, "evicted_active", s->flow_evicted_lru);
+		blobmsg_close_table(b, t);
+	}
+
+	if (s->ifaces_nr) {
+		a = blobmsg_open_array(b, "interfaces");
+		for (i = 0; i < s->ifaces_nr; i++) {
+			t = blobmsg_open_table(b, NULL);
+			blobmsg_add_string(b, "name", s->ifaces[i].name);
+			blobmsg_add_u64(b, "packets", s->ifaces[i].packets);
+			blobmsg_add_u64(b, "bytes", s->ifaces[i].bytes);
+			blobmsg_add_u64(b, "dropped", s->ifaces[i].drops);
+			blobmsg_add_u64(b, "ifdropped", s->ifaces[i].ifdrops);
+			blobmsg_add_u64(b, "merge_dropped", s->ifaces[i].queue_drops);
+			blobmsg_close_table(b, t);
+		}
+		blobmsg_close_array(b, a);
+	}
+
+	t = blobmsg_open_table(b, "kernel");
+	blobmsg_add_u64(b, "received", s->recv);
+	blobmsg_add_u64(b, "dropped", s->drop);
+	blobmsg_add_u64(b, "ifdropped", s->ifdrop);
+	blobmsg_add_u64(b, "drop_rate", s->drop_rate);
+	blobmsg_close_table(b, t);
+
+	t = blobmsg_open_table(b, "upload");
+	blobmsg_add_u64(b, "sent", s->upload_sent);
+	blobmsg_add_u64(b, "size", cs->upload_size);
+	blobmsg_add_u64(b, "bps", s->upload_bps);
+	if (cs->upload_size)
+		blobmsg_add_u32(b, "progress", s->upload_sent * 100 / cs->upload_size);
+	if (cs->upload_rate)
+		blobmsg_add_u64(b, "rate_limit", cs->upload_rate * 8);
+	if (cs->upload_throttled)
+		blobmsg_add_u64(b, "throttled_ms", cs->upload_throttled);
+	if (cs->upload_connections) {
+		blobmsg_add_u32(b, "connections", cs->upload_connections);
+		blobmsg_add_u64(b, "connect_ms", cs->upload_connect_ms / cs->upload_connections);
+	}
+	if (cs->upload_reused)
+		blobmsg_add_u32(b, "reused", cs->upload_reused);
+	blobmsg_close_table(b, t);
+}
+
+/* readers only ever see a whole file, the new one replaces the old in one rename */
+static void cshark_stats_write(struct cshark *cs)
+{
+	char tmp[PATH_MAX + 5];
+	char *json;
+	ssize_t len, done = 0;
+	int fd;
+
+	if (!cs->stats_file || !cs->stats_file[0])
+		return;
+
+	blob_buf_init(&stats_buf, 0);
+	cshark_stats_blob(cs, &stats_buf);
+
+	json = blobmsg_format_json(stats_buf.head, true);
+	if (!json)
+		return;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", cs->stats_file);
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0)
+		goto fail;
+
+	len = strlen(json);
+	while (done < len) {
+		ssize_t n = write(fd, json + done, len - done);
+		if (n < 0) {
+			close(fd);
+			unlink(tmp);
+			goto fail;
+		}
+		done += n;
+	}
+	close(fd);
+
+	if (rename(tmp, cs->stats_file) < 0) {
+		unlink(tmp);
+		goto fail;
+	}
+
+	free(json);
+	return;
+
+fail:
+	if (!stats_failed)
+		ERROR("stats: could not write '%s': %s\n", cs->stats_file, strerror(errno));
+	stats_failed = true;
+	free(json);
+}
+
+void cshark_stats_update(struct cshark *cs)
+{
+	if (!cs->stats_interval)
+		return;
+
+	cshark_stats_sample(cs);
+	cshark_stats_write(cs);
+}
+
+static void cshark_stats_timeout_cb(struct uloop_timeout *t)
+{
+	cshark_stats_update(&cshark);
+	uloop_timeout_set(t, cshark.stats_interval);
+}
+
+int cshark_stats_init(struct cshark *cs)
+{
+	memset(&stats, 0, sizeof(stats));
+	clock_gettime(CLOCK_MONOTONIC, &stats.start);
+	stats.last = stats.start;
+	stats_failed = false;
+	stats_running = true;
+
+	uloop_timeout_set(&stats_timeout, cs->stats_interval);
+
+	return 0;
+}
+
+void cshark_stats_done(struct cshark *cs)
+{
+	if (!stats_running)
+		return;
+	stats_running = false;
+
+	uloop_timeout_cancel(&stats_timeout);
+
+	/* the last sample keeps the final state around for whoever polls the file */
+	cshark_stats_update(cs);
+	blob_buf_free(&stats_buf);
+}
@@ -0,0 +1,95 @@
+/*
+ * Author: Luka Perkov <luka.perkov@sartura.hr>
+ *
+ * Copyright (C) 2014, QA Cafe, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * For more information see the project website [1].
+ *
+ * [1] https://www.cloudshark.org/
+ */
+
+#ifndef __CSHARK_STATS_H__
+#define __CSHARK_STATS_H__
+
+#include <net/if.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <libubox/blobmsg.h>
+
+#include "cshark.h"
+
+/* default milliseconds between two samples */
+#define STATS_INTERVAL 1000
+
+/* merged interfaces reported one by one, the totals cover all of them */
+#define STATS_IFACES 16
+
+struct cshark_stats_iface {
+	char name[IF_NAMESIZE];
+	uint64_t packets;
+	uint64_t bytes;
+	uint64_t drops;
+	uint64_t ifdrops;
+	uint64_t queue_drops;
+};
+
+struct cshark_stats {
+	struct timespec start;
+	struct timespec last;
+
+	uint64_t packets;
+	uint64_t caplen;
+	uint64_t written;
+	uint64_t recv;
+	uint64_t drop;
+	uint64_t ifdrop;
+	uint64_t suppressed;
+	uint64_t flow_capped;
+	uint64_t flow_sampled_out;
+	uint64_t upload_sent;
+
+	/* flow table occupancy, kept once the table is gone */
+	uint32_t flow_used;
+	uint32_t flow_size;
+	uint64_t flow_seen;
+	uint64_t flow_evicted_idle;
+	uint64_t flow_evicted_lru;
+
+	struct cshark_stats_iface ifaces[STATS_IFACES];
+	unsigned int ifaces_nr;
+
+	/* per second over the last interval */
+	uint64_t pps;
+	uint64_t bps;
+	uint64_t drop_rate;
+	uint64_t upload_bps;
+};
+
+int cshark_stats_init(struct cshark *cs);
+void cshark_stats_update(struct cshark *cs);
+void cshark_stats_blob(struct cshark *cs, struct blob_buf *b);
+const char *cshark_stats_state(enum cshark_state state);
+void cshark_stats_done(struct cshark *cs);
+
+#endif /* __CSHARK_STATS_H__ */
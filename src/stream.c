@@ -0,0 +1,250 @@
+/*
+ * Author: Luka Perkov <luka.perkov@sartura.hr>
+ *
+ * Copyright (C) 2014, QA Cafe, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * For more information see the project website [1].
+ *
+ * [1] https://www.cloudshark.org/
+ */
+
+#include <libubox/uloop.h>
+#include <libubox/uclient.h>
+
+#include "cshark.h"
+#include "pcap.h"
+#include "shaper.h"
+#include "stream.h"
+#include "uclient.h"
+
+struct cshark_stream {
+	uint8_t *buf;
+	size_t size;
+	size_t head;
+	size_t tail;
+	size_t used;
+
+	bool paused;
+	bool finished;
+	bool requested;
+
+	uint64_t sent;
+	uint64_t dropped;
+};
+
+static void cshark_stream_pump_cb(struct uloop_timeout *t);
+
+static struct cshark_stream stream;
+static struct uloop_timeout pump_timeout = { .cb = cshark_stream_pump_cb };
+
+static void cshark_stream_shaper_cb(struct cshark_shaper_waiter *w);
+
+static struct cshark_shaper_waiter stream_waiter = { .cb = cshark_stream_shaper_cb };
+
+/* called with the capture lock held, possibly from a worker */
+static int cshark_stream_write(struct cshark_writer *w, struct iovec *iov, int iovcnt, size_t len)
+{
+	struct cshark_stream *st = &stream;
+	size_t n, done;
+	int i;
+
+	/* whole batches only so the stream never contains a partial record */
+	if (len > st->size - st->used) {
+		/* a gap in a compressed stream, or a missing header, would make the rest unreadable */
+		if (w->compress.ops || w->keep) {
+			ERROR("upload could not keep up with the %s\n",
+				w->compress.ops ? "compressed stream" : "capture headers");
+			return -1;
+		}
+
+		st->dropped += len;
+		return 0;
+	}
+
+	for (i = 0; i < iovcnt; i++) {
+		for (done = 0; done < iov[i].iov_len; done += n) {
+			n = st->size - st->head;
+			if (n > iov[i].iov_len - done)
+				n = iov[i].iov_len - done;
+
+			memcpy(st->buf + st->head, (uint8_t *) iov[i].iov_base + done, n);
+			st->head = (st->head + n) % st->size;
+		}
+	}
+	st->used += len;
+
+	/* keep room for the batch that is already on its way, let the kernel buffer the rest */
+	if (!st->paused && st->used > st->size - st->size / 4) {
+		DEBUG("upload is falling behind, pausing capture\n");
+		st->paused = true;
+		cshark_pcap_pause(&cshark, true);
+	}
+
+	return 0;
+}
+
+const struct cshark_writer_ops cshark_writer_stream = {
+	.name = "stream",
+	.write = cshark_stream_write,
+};
+
+void cshark_stream_pump(struct cshark *cs)
+{
+	struct cshark_stream *st = &stream;
+	bool request;
+	int pending;
+	size_t n;
+
+	if (!cs->ucl || cs->upload_failed)
+		return;
+
+	pthread_mutex_lock(&cs->lock);
+
+	/* only ever hand a small window to uclient so its buffers stay bounded */
+	while (st->used) {
+		pending = uclient_pending_bytes(cs->ucl, true);
+		if (pending < 0 || (size_t) pending >= cs->upload_window)
+			break;
+
+		n = st->size - st->tail;
+		if (n > st->used)
+			n = st->used;
+		if (n > cs->upload_window - pending)
+			n = cs->upload_window - pending;
+
+		n = cshark_shaper_allow(cs, &stream_waiter, n);
+		if (!n)
+			break;
+
+		if (uclient_write(cs->ucl, (char *) st->buf + st->tail, n) < 0) {
+			ERROR("uclient: could not stream capture\n");
+			cs->upload_failed = true;
+			break;
+		}
+
+		cshark_shaper_consume(n);
+		st->tail = (st->tail + n) % st->size;
+		st->used -= n;
+		st->sent += n;
+		cs->upload_sent = st->sent;
+	}
+
+	if (st->paused && st->used < st->size / 4) {
+		DEBUG("upload caught up, resuming capture\n");
+		st->paused = false;
+		cshark_pcap_pause(cs, false);
+	}
+
+	request = st->finished && !st->used && !st->requested;
+
+	pthread_mutex_unlock(&cs->lock);
+
+	if (cs->upload_failed) {
+		uloop_end();
+		return;
+	}
+
+	/* all data is queued, the last chunk ends the request */
+	if (request) {
+		st->requested = true;
+		if (uclient_request(cs->ucl)) {
+			ERROR("uclient: request failed\n");
+			cs->upload_failed = true;
+			uloop_end();
+		}
+	}
+}
+
+static void cshark_stream_pump_cb(struct uloop_timeout *t)
+{
+	cshark_stream_pump(&cshark);
+
+	if (!stream.requested)
+		uloop_timeout_set(t, STREAM_PUMP_INTERVAL);
+}
+
+static void cshark_stream_shaper_cb(struct cshark_shaper_waiter *w)
+{
+	cshark_stream_pump(&cshark);
+}
+
+int cshark_stream_init(struct cshark *cs)
+{
+	struct cshark_stream *st = &stream;
+	int rc;
+
+	memset(st, 0, sizeof(*st));
+	cs->stream_dropped = 0;
+
+	st->size = cs->stream_buffer;
+	st->buf = malloc(st->size);
+	if (!st->buf) {
+		ERROR("stream: not enough memory for %lu bytes\n", (long unsigned int) st->size);
+		return -1;
+	}
+
+	/* no Content-Length header so uclient sends the body with chunked encoding */
+	rc = cshark_uclient_connect(cs);
+	if (rc)
+		return rc;
+
+	cshark_shaper_init(cs);
+	uloop_timeout_set(&pump_timeout, STREAM_PUMP_INTERVAL);
+
+	return 0;
+}
+
+int cshark_stream_finish(struct cshark *cs)
+{
+	struct cshark_stream *st = &stream;
+
+	if (cs->upload_failed)
+		return -1;
+
+	st->finished = true;
+	cs->stream_dropped = st->dropped;
+	if (st->dropped)
+		ERROR("%lu bytes dropped, upload could not keep up\n", (long unsigned int) st->dropped);
+
+	cshark_stream_pump(cs);
+	if (!st->requested)
+		uloop_timeout_set(&pump_timeout, STREAM_PUMP_INTERVAL);
+
+	return cs->upload_failed ? -1 : 0;
+}
+
+void cshark_stream_done(struct cshark *cs)
+{
+	struct cshark_stream *st = &stream;
+
+	uloop_timeout_cancel(&pump_timeout);
+	cshark_shaper_cancel(&stream_waiter);
+
+	if (st->buf) {
+		DEBUG("streamed %lu bytes\n", (long unsigned int) st->sent);
+		cshark_shaper_report(cs);
+	}
+
+	free(st->buf);
+	st->buf = NULL;
+}
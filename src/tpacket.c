@@ -0,0 +1,662 @@
+/*
+ * Author: Luka Perkov <luka.perkov@sartura.hr>
+ *
+ * Copyright (C) 2014, QA Cafe, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * For more information see the project website [1].
+ *
+ * [1] https://www.cloudshark.org/
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+#include <linux/filter.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+
+#include <pcap.h>
+#include <pcap/sll.h>
+
+#include <libubox/uloop.h>
+
+#include "cshark.h"
+#include "pcap.h"
+#include "tpacket.h"
+
+#define VLAN_TAG_LEN 4
+
+static struct cshark_ring ring = { .fd = -1 };
+
+static struct cshark_worker *workers;
+static unsigned int workers_nr;
+static unsigned int workers_started;
+
+/* running kernel counters over all rings, wider than the kernel ones */
+static struct {
+	uint64_t packets;
+	uint64_t drops;
+	uint64_t freezes;
+} stats_total;
+
+static void cshark_tpacket_stop_cb(struct uloop_fd *ufd, __unused unsigned int events);
+static struct uloop_fd ufd_stop = { .cb = cshark_tpacket_stop_cb, .fd = -1 };
+
+static void cshark_tpacket_stop_cb(struct uloop_fd *ufd, __unused unsigned int events)
+{
+	uint64_t v;
+
+	if (read(ufd->fd, &v, sizeof(v)) < 0) return;
+
+	DEBUG("worker requested stop\n");
+	uloop_end();
+}
+
+/* called from a worker once a limit is hit or writing fails, wakes up the main loop */
+static void cshark_tpacket_stop(struct cshark *cs)
+{
+	uint64_t v = 1;
+
+	__atomic_store_n(&cs->stop, true, __ATOMIC_RELAXED);
+	if (write(ufd_stop.fd, &v, sizeof(v)) < 0)
+		ERROR("tpacket: unable to notify main loop\n");
+}
+
+static bool cshark_tpacket_stopped(struct cshark *cs, struct cshark_worker *w)
+{
+	if (w)
+		return __atomic_load_n(&cs->stop, __ATOMIC_RELAXED);
+
+	return uloop_cancelled;
+}
+
+static void cshark_tpacket_handle_packet(struct cshark *cs, struct cshark_ring *r,
+					 struct tpacket3_hdr *th, struct cshark_worker *w)
+{
+	struct sockaddr_ll *sll;
+	struct pcap_pkthdr hdr;
+	u_char *bp = (u_char *) th + th->tp_mac;
+	u_char *min = (u_char *) th + TPACKET_ALIGN(sizeof(*th)) + sizeof(*sll);
+	int snap;
+
+	sll = (struct sockaddr_ll *) ((u_char *) th + TPACKET_ALIGN(sizeof(*th)));
+
+	hdr.ts.tv_sec = th->tp_sec;
+	hdr.ts.tv_usec = cs->nano ? th->tp_nsec : th->tp_nsec / 1000;
+	hdr.caplen = th->tp_snaplen;
+	hdr.len = th->tp_len;
+
+	if (r->cooked) {
+		struct sll_header *h;
+
+		/* build the cooked header in the headroom in front of the network header */
+		if (bp - SLL_HDR_LEN < min) return;
+		bp -= SLL_HDR_LEN;
+
+		h = (struct sll_header *) bp;
+		h->sll_pkttype = htons(sll->sll_pkttype);
+		h->sll_hatype = htons(sll->sll_hatype);
+		h->sll_halen = htons(sll->sll_halen);
+		memcpy(h->sll_addr, sll->sll_addr, SLL_ADDRLEN);
+		h->sll_protocol = sll->sll_protocol;
+
+		hdr.caplen += SLL_HDR_LEN;
+		hdr.len += SLL_HDR_LEN;
+	} else if ((th->tp_status & TP_STATUS_VLAN_VALID) && th->tp_snaplen >= 2 * ETH_ALEN &&
+		   bp - VLAN_TAG_LEN >= min) {
+		uint16_t tag[2];
+
+		/* the kernel strips the outer VLAN tag, put it back in the reserved headroom */
+		tag[0] = htons((th->tp_status & TP_STATUS_VLAN_TPID_VALID) ?
+			       th->hv1.tp_vlan_tpid : ETH_P_8021Q);
+		tag[1] = htons(th->hv1.tp_vlan_tci);
+
+		memmove(bp - VLAN_TAG_LEN, bp, 2 * ETH_ALEN);
+		bp -= VLAN_TAG_LEN;
+		memcpy(bp + 2 * ETH_ALEN, tag, VLAN_TAG_LEN);
+
+		hdr.caplen += VLAN_TAG_LEN;
+		hdr.len += VLAN_TAG_LEN;
+	}
+
+	if (r->filter) {
+		snap = pcap_offline_filter(&cs->p_bfp, &hdr, bp);
+		if (!snap) return;
+	} else {
+		snap = cs->snaplen;
+	}
+
+	if (hdr.caplen > snap)
+		hdr.caplen = snap;
+
+	if (!cshark_pcap_stage(cs, cs->linktype, &hdr, bp))
+		return;
+
+	if (!w) {
+		cshark_pcap_capture_packet(cs, &hdr, bp, sll->sll_ifindex);
+		return;
+	}
+
+	if (!cshark_pcap_admit(cs, hdr.caplen) || cshark_pcap_dump_packet(cs, &hdr, bp, sll->sll_ifindex)) {
+		cshark_tpacket_stop(cs);
+		return;
+	}
+
+	w->packets++;
+	w->caplen += hdr.caplen;
+}
+
+static void cshark_tpacket_walk(struct cshark *cs, struct cshark_ring *r, struct cshark_worker *w)
+{
+	struct tpacket_block_desc *bd;
+	struct tpacket3_hdr *th;
+	unsigned int i;
+
+	/* a pause raised while walking a block takes effect at the next block, never half way */
+	while (!cshark_tpacket_stopped(cs, w) && !__atomic_load_n(&cs->paused, __ATOMIC_RELAXED)) {
+		bd = (struct tpacket_block_desc *) (r->map + r->block * r->block_size);
+		if (!(bd->hdr.bh1.block_status & TP_STATUS_USER))
+			break;
+
+		/* workers share the dump file, take the lock once per block and not per packet */
+		if (w) pthread_mutex_lock(&cs->lock);
+
+		/* walk the retired block in place, packets are never copied out of the ring */
+		th = (struct tpacket3_hdr *) ((uint8_t *) bd + bd->hdr.bh1.offset_to_first_pkt);
+		for (i = 0; i < bd->hdr.bh1.num_pkts && !cshark_tpacket_stopped(cs, w); i++) {
+			cshark_tpacket_handle_packet(cs, r, th, w);
+			th = (struct tpacket3_hdr *) ((uint8_t *) th + th->tp_next_offset);
+		}
+
+		/* the writer may still reference packets in this block */
+		if (cshark_writer_flush(&cs->writer)) {
+			if (w)
+				cshark_tpacket_stop(cs);
+			else
+				uloop_end();
+		}
+
+		if (w) pthread_mutex_unlock(&cs->lock);
+
+		__sync_synchronize();
+		bd->hdr.bh1.block_status = TP_STATUS_KERNEL;
+		r->block = (r->block + 1) % r->block_nr;
+	}
+}
+
+static void cshark_tpacket_handle_packet_cb(struct uloop_fd *ufd, __unused unsigned int events)
+{
+	struct cshark_ring *r = container_of(ufd, struct cshark_ring, ufd);
+
+	cshark_tpacket_walk(&cshark, r, NULL);
+
+	DEBUG("received '%d' packets\n", (int) cshark.packets);
+	DEBUG("received '%d' bytes\n", (int) cshark.caplen);
+}
+
+static void *cshark_tpacket_worker(void *arg)
+{
+	struct cshark_worker *w = arg;
+	struct pollfd pfd = { .fd = w->ring.fd, .events = POLLIN | POLLERR };
+	sigset_t set;
+
+	/* signals are handled by uloop on the main thread */
+	sigfillset(&set);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+	while (!__atomic_load_n(&cshark.stop, __ATOMIC_RELAXED)) {
+		if (__atomic_load_n(&cshark.paused, __ATOMIC_RELAXED)) {
+			poll(NULL, 0, 10);
+			continue;
+		}
+
+		cshark_tpacket_walk(&cshark, &w->ring, w);
+
+		/* wake up now and then to notice a stop request from the main thread */
+		poll(&pfd, 1, 100);
+	}
+
+	return NULL;
+}
+
+static int cshark_tpacket_linktype(struct cshark *cs, int *ifindex)
+{
+	struct ifreq ifr;
+	int fd, rc = -1;
+
+	*ifindex = 0;
+	if (!strcmp(cs->interface, "any"))
+		return DLT_LINUX_SLL;
+
+	fd = socket(AF_PACKET, SOCK_RAW, 0);
+	if (fd < 0) {
+		ERROR("tpacket: unable to open packet socket: %s\n", strerror(errno));
+		return -1;
+	}
+
+	memset(&ifr, 0, sizeof(ifr));
+	snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", cs->interface);
+
+	if (ioctl(fd, SIOCGIFINDEX, &ifr) < 0) {
+		ERROR("tpacket: no such interface '%s'\n", cs->interface);
+		goto exit;
+	}
+	*ifindex = ifr.ifr_ifindex;
+
+	if (ioctl(fd, SIOCGIFHWADDR, &ifr) < 0) {
+		ERROR("tpacket: unable to get link type of '%s'\n", cs->interface);
+		goto exit;
+	}
+
+	switch (ifr.ifr_hwaddr.sa_family) {
+		case ARPHRD_ETHER:
+		case ARPHRD_LOOPBACK:
+			rc = DLT_EN10MB;
+			break;
+		default:
+			rc = DLT_LINUX_SLL;
+			break;
+	}
+
+exit:
+	close(fd);
+	return rc;
+}
+
+static int cshark_tpacket_ring_open(struct cshark *cs, struct cshark_ring *r, bool cooked,
+				    int ifindex, int fanout)
+{
+	struct tpacket_req3 req;
+	struct sockaddr_ll addr;
+	struct sock_fprog fprog;
+	int version = TPACKET_V3;
+	int reserve;
+	int rc = -1;
+
+	r->cooked = cooked;
+
+	/* protocol 0 keeps the socket quiet until it is bound with the filter in place */
+	r->fd = socket(AF_PACKET, cooked ? SOCK_DGRAM : SOCK_RAW, 0);
+	if (r->fd < 0) {
+		ERROR("tpacket: unable to open packet socket: %s\n", strerror(errno));
+		goto exit;
+	}
+
+	/*
+	 * The kernel filter sees cooked packets without the link-layer header
+	 * so cooked sockets run the filter in userspace on the rebuilt frame.
+	 */
+	if (cooked) {
+		r->filter = true;
+	} else {
+		fprog.len = cs->p_bfp.bf_len;
+		fprog.filter = (struct sock_filter *) cs->p_bfp.bf_insns;
+
+		rc = setsockopt(r->fd, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog));
+		if (rc < 0) {
+			ERROR("tpacket: unable to attach filter: %s\n", strerror(errno));
+			goto exit;
+		}
+	}
+
+	rc = setsockopt(r->fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version));
+	if (rc < 0) {
+		ERROR("tpacket: TPACKET_V3 is not supported: %s\n", strerror(errno));
+		goto exit;
+	}
+
+	reserve = cooked ? SLL_HDR_LEN : VLAN_TAG_LEN;
+	rc = setsockopt(r->fd, SOL_PACKET, PACKET_RESERVE, &reserve, sizeof(reserve));
+	if (rc < 0) {
+		ERROR("tpacket: unable to reserve headroom: %s\n", strerror(errno));
+		goto exit;
+	}
+
+	r->block_size = cs->ring_block_size;
+	r->block_nr = cs->ring_block_nr;
+
+	memset(&req, 0, sizeof(req));
+	req.tp_block_size = r->block_size;
+	req.tp_block_nr = r->block_nr;
+	req.tp_frame_size = TPACKET_ALIGNMENT << 7;
+	req.tp_frame_nr = (r->block_size / req.tp_frame_size) * r->block_nr;
+	req.tp_retire_blk_tov = cs->ring_block_timeout;
+
+	rc = setsockopt(r->fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req));
+	if (rc < 0) {
+		ERROR("tpacket: unable to set up %u blocks of %u bytes: %s\n",
+			r->block_nr, r->block_size, strerror(errno));
+		goto exit;
+	}
+
+	r->map_len = (size_t) r->block_size * r->block_nr;
+	r->map = mmap(NULL, r->map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, 0);
+	if (r->map == MAP_FAILED) {
+		r->map = NULL;
+		ERROR("tpacket: unable to map ring: %s\n", strerror(errno));
+		rc = -1;
+		goto exit;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sll_family = AF_PACKET;
+	addr.sll_protocol = htons(ETH_P_ALL);
+	addr.sll_ifindex = ifindex;
+
+	rc = bind(r->fd, (struct sockaddr *) &addr, sizeof(addr));
+	if (rc < 0) {
+		ERROR("tpacket: unable to bind to '%s': %s\n", cs->interface, strerror(errno));
+		goto exit;
+	}
+
+	/* open device in promiscuous mode */
+	if (ifindex) {
+		struct packet_mreq mr;
+
+		memset(&mr, 0, sizeof(mr));
+		mr.mr_ifindex = ifindex;
+		mr.mr_type = PACKET_MR_PROMISC;
+
+		rc = setsockopt(r->fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mr, sizeof(mr));
+		if (rc < 0) {
+			ERROR("tpacket: unable to enter promiscuous mode: %s\n", strerror(errno));
+			goto exit;
+		}
+	}
+
+	if (fanout) {
+		rc = setsockopt(r->fd, SOL_PACKET, PACKET_FANOUT, &fanout, sizeof(fanout));
+		if (rc < 0) {
+			ERROR("tpacket: unable to join fanout group: %s\n", strerror(errno));
+			goto exit;
+		}
+	}
+
+	r->block = 0;
+	r->ufd.cb = cshark_tpacket_handle_packet_cb;
+	r->ufd.fd = r->fd;
+
+	rc = 0;
+exit:
+	return rc;
+}
+
+/* the kernel resets its counters on every read, so they add up here */
+static void cshark_tpacket_ring_stats(struct cshark_ring *r)
+{
+	struct tpacket_stats_v3 st;
+	socklen_t len = sizeof(st);
+
+	if (r->fd < 0)
+		return;
+
+	/* tp_packets already includes the dropped packets */
+	memset(&st, 0, sizeof(st));
+	if (!getsockopt(r->fd, SOL_PACKET, PACKET_STATISTICS, &st, &len)) {
+		stats_total.packets += st.tp_packets;
+		stats_total.drops += st.tp_drops;
+		stats_total.freezes += st.tp_freeze_q_cnt;
+	}
+}
+
+static void cshark_tpacket_ring_close(struct cshark_ring *r)
+{
+	if (r->fd < 0)
+		return;
+
+	if (r->ufd.registered)
+		uloop_fd_delete(&r->ufd);
+
+	cshark_tpacket_ring_stats(r);
+
+	if (r->map) {
+		munmap(r->map, r->map_len);
+		r->map = NULL;
+	}
+
+	close(r->fd);
+	r->fd = -1;
+	r->cooked = false;
+	r->filter = false;
+}
+
+/* n-th entry of the comma separated cpu list, cycled when there are more workers than cpus */
+static int cshark_tpacket_cpu(struct cshark *cs, unsigned int n)
+{
+	int cpus[CPU_SETSIZE];
+	unsigned int nr = 0;
+	char *p = cs->cpus, *end;
+
+	while (p && *p && nr < CPU_SETSIZE) {
+		long cpu = strtol(p, &end, 10);
+		if (end == p)
+			break;
+		if (cpu >= 0 && cpu < CPU_SETSIZE)
+			cpus[nr++] = cpu;
+		p = (*end == ',') ? end + 1 : end;
+	}
+
+	return nr ? cpus[n % nr] : -1;
+}
+
+static int cshark_tpacket_workers_init(struct cshark *cs, bool cooked, int ifindex)
+{
+	static const int modes[] = {
+		[CSHARK_FANOUT_HASH] = PACKET_FANOUT_HASH | PACKET_FANOUT_FLAG_DEFRAG,
+		[CSHARK_FANOUT_CPU] = PACKET_FANOUT_CPU,
+		[CSHARK_FANOUT_QUEUE] = PACKET_FANOUT_QM,
+	};
+	pthread_attr_t attr;
+	cpu_set_t set;
+	unsigned int i;
+	int fanout;
+	int rc;
+
+	rc = posix_memalign((void **) &workers, 64, cs->workers * sizeof(*workers));
+	if (rc) {
+		ERROR("tpacket: not enough memory\n");
+		workers = NULL;
+		return -1;
+	}
+	memset(workers, 0, cs->workers * sizeof(*workers));
+	for (i = 0; i < cs->workers; i++)
+		workers[i].ring.fd = -1;
+	workers_nr = cs->workers;
+
+	ufd_stop.fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (ufd_stop.fd < 0) {
+		ERROR("tpacket: unable to create eventfd: %s\n", strerror(errno));
+		return -1;
+	}
+	uloop_fd_add(&ufd_stop, ULOOP_READ);
+
+	cs->stop = false;
+
+	/* all sockets have to be in the group before the first one starts receiving */
+	fanout = (getpid() & 0xffff) | (modes[cs->fanout] << 16);
+	for (i = 0; i < workers_nr; i++) {
+		rc = cshark_tpacket_ring_open(cs, &workers[i].ring, cooked, ifindex, fanout);
+		if (rc)
+			return rc;
+	}
+
+	for (i = 0; i < workers_nr; i++) {
+		struct cshark_worker *w = &workers[i];
+
+		pthread_attr_init(&attr);
+
+		w->cpu = cshark_tpacket_cpu(cs, i);
+		if (w->cpu >= 0) {
+			CPU_ZERO(&set);
+			CPU_SET(w->cpu, &set);
+			pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+		}
+
+		rc = pthread_create(&w->thread, &attr, cshark_tpacket_worker, w);
+		pthread_attr_destroy(&attr);
+		if (rc) {
+			ERROR("tpacket: unable to start worker %u: %s\n", i, strerror(rc));
+			return -1;
+		}
+		workers_started++;
+	}
+
+	return 0;
+}
+
+int cshark_tpacket_init(struct cshark *cs)
+{
+	int linktype, ifindex;
+	bool cooked;
+	int rc = -1;
+
+	linktype = cshark_tpacket_linktype(cs, &ifindex);
+	if (linktype < 0)
+		goto exit;
+
+	cooked = (linktype == DLT_LINUX_SLL);
+	memset(&stats_total, 0, sizeof(stats_total));
+
+	cs->ifindex = ifindex;
+	cs->linktype = linktype;
+
+	/* the ring always has nanoseconds, pcapng keeps them */
+	cs->nano = cs->format == CSHARK_FORMAT_PCAPNG;
+	cs->p = pcap_open_dead_with_tstamp_precision(linktype, cs->snaplen,
+						     cs->nano ? PCAP_TSTAMP_PRECISION_NANO :
+								PCAP_TSTAMP_PRECISION_MICRO);
+	if (!cs->p) {
+		ERROR("tpacket: not enough memory\n");
+		goto exit;
+	}
+
+	rc = pcap_compile(cs->p, &cs->p_bfp, cs->filter ? cs->filter : "", 1, PCAP_NETMASK_UNKNOWN);
+	if (rc == -1) {
+		ERROR("pcap_compile(): could not parse filter\n");
+		goto exit;
+	}
+
+	if (cs->workers > 1) {
+		rc = cshark_tpacket_workers_init(cs, cooked, ifindex);
+		goto exit;
+	}
+
+	rc = cshark_tpacket_ring_open(cs, &ring, cooked, ifindex, 0);
+	if (rc)
+		goto exit;
+
+	uloop_fd_add(&ring.ufd, ULOOP_READ);
+
+	rc = 0;
+exit:
+	return rc;
+}
+
+/* stop walking the rings until the consumer catches up, the kernel keeps buffering meanwhile */
+void cshark_tpacket_pause(struct cshark *cs, bool pause)
+{
+	__atomic_store_n(&cs->paused, pause, __ATOMIC_RELAXED);
+
+	if (workers || ring.fd < 0)
+		return;
+
+	if (pause)
+		uloop_fd_delete(&ring.ufd);
+	else
+		uloop_fd_add(&ring.ufd, ULOOP_READ);
+}
+
+/* refreshes the kernel counters and adds what the workers captured so far, caller holds cs->lock */
+void cshark_tpacket_stats(struct cshark *cs, uint64_t *packets, uint64_t *caplen)
+{
+	unsigned int i;
+
+	if (workers) {
+		for (i = 0; i < workers_nr; i++) {
+			cshark_tpacket_ring_stats(&workers[i].ring);
+			*packets += workers[i].packets;
+			*caplen += workers[i].caplen;
+		}
+	} else if (ring.fd >= 0) {
+		cshark_tpacket_ring_stats(&ring);
+	} else {
+		return;
+	}
+
+	cs->stats_recv = stats_total.packets;
+	cs->stats_drop = stats_total.drops;
+}
+
+void cshark_tpacket_done(struct cshark *cs)
+{
+	unsigned int i;
+
+	if (workers) {
+		__atomic_store_n(&cs->stop, true, __ATOMIC_RELAXED);
+		for (i = 0; i < workers_started; i++)
+			pthread_join(workers[i].thread, NULL);
+
+		for (i = 0; i < workers_nr; i++) {
+			struct cshark_worker *w = &workers[i];
+
+			DEBUG("worker %u on cpu %d: %lu packets, %lu bytes\n", i, w->cpu,
+				(long unsigned int) w->packets, (long unsigned int) w->caplen);
+
+			cs->packets += w->packets;
+			cs->caplen += w->caplen;
+			cshark_tpacket_ring_close(&w->ring);
+		}
+
+		free(workers);
+		workers = NULL;
+		workers_nr = workers_started = 0;
+
+		if (ufd_stop.registered)
+			uloop_fd_delete(&ufd_stop);
+		if (ufd_stop.fd >= 0)
+			close(ufd_stop.fd);
+		ufd_stop.fd = -1;
+	} else if (ring.fd >= 0) {
+		cshark_tpacket_ring_close(&ring);
+	} else {
+		return;
+	}
+
+	cs->stats_recv = stats_total.packets;
+	cs->stats_drop = stats_total.drops;
+
+	LOG("%lu packets received by kernel, %lu dropped, %lu ring freezes\n",
+		(long unsigned int) stats_total.packets, (long unsigned int) stats_total.drops,
+		(long unsigned int) stats_total.freezes);
+}
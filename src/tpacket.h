@@ -0,0 +1,76 @@
+/*
+ * Author: Luka Perkov <luka.perkov@sartura.hr>
+ *
+ * Copyright (C) 2014, QA Cafe, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * For more information see the project website [1].
+ *
+ * [1] https://www.cloudshark.org/
+ */
+
+#ifndef __CSHARK_TPACKET_H__
+#define __CSHARK_TPACKET_H__
+
+#include <stdint.h>
+
+#include <libubox/uloop.h>
+
+#include "cshark.h"
+
+/* defaults for the TPACKET_V3 receive ring, overridable from uci and the command line */
+#define TPACKET_BLOCK_SIZE (256 * 1024)
+#define TPACKET_BLOCK_NR 16
+#define TPACKET_BLOCK_TIMEOUT 64
+
+struct cshark_ring {
+	int fd;
+	uint8_t *map;
+	size_t map_len;
+
+	unsigned int block_size;
+	unsigned int block_nr;
+	unsigned int block;
+
+	/* cooked (SOCK_DGRAM) sockets can not use the kernel filter, see cshark_tpacket_init() */
+	bool cooked;
+	bool filter;
+
+	struct uloop_fd ufd;
+};
+
+/* one capture worker per socket in the fanout group, aligned so counters do not share a cache line */
+struct cshark_worker {
+	struct cshark_ring ring;
+	pthread_t thread;
+	int cpu;
+
+	uint64_t packets;
+	uint64_t caplen;
+} __attribute__((aligned(64)));
+
+int cshark_tpacket_init(struct cshark *cs);
+void cshark_tpacket_pause(struct cshark *cs, bool pause);
+void cshark_tpacket_stats(struct cshark *cs, uint64_t *packets, uint64_t *caplen);
+void cshark_tpacket_done(struct cshark *cs);
+
+#endif /* __CSHARK_TPACKET_H__ */
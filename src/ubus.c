@@ -0,0 +1,182 @@
+/*
+ * Author: Luka Perkov <luka.perkov@sartura.hr>
+ *
+ * Copyright (C) 2014, QA Cafe, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * For more information see the project website [1].
+ *
+ * [1] https://www.cloudshark.org/
+ */
+
+#include <libubox/blobmsg.h>
+#include <libubus.h>
+
+#include "cshark.h"
+#include "daemon.h"
+#include "stats.h"
+#include "ubus.h"
+
+static struct ubus_context *ubus_ctx;
+static struct blob_buf ubus_buf;
+
+/* answers from the last sample, polling never touches the capture */
+static int cshark_ubus_stats(struct ubus_context *ctx, __unused struct ubus_object *obj,
+			     struct ubus_request_data *req, __unused const char *method,
+			     __unused struct blob_attr *msg)
+{
+	blob_buf_init(&ubus_buf, 0);
+	cshark_stats_blob(&cshark, &ubus_buf);
+
+	return ubus_send_reply(ctx, req, ubus_buf.head);
+}
+
+static int cshark_ubus_start(struct ubus_context *ctx, __unused struct ubus_object *obj,
+			     struct ubus_request_data *req, __unused const char *method,
+			     struct blob_attr *msg)
+{
+	int rc;
+
+	blob_buf_init(&ubus_buf, 0);
+	rc = cshark_daemon_start(msg, &ubus_buf);
+	if (rc)
+		return rc;
+
+	return ubus_send_reply(ctx, req, ubus_buf.head);
+}
+
+static int cshark_ubus_stop(struct ubus_context *ctx, __unused struct ubus_object *obj,
+			    struct ubus_request_data *req, __unused const char *method,
+			    __unused struct blob_attr *msg)
+{
+	int rc;
+
+	blob_buf_init(&ubus_buf, 0);
+	rc = cshark_daemon_stop(&ubus_buf);
+	if (rc)
+		return rc;
+
+	return ubus_send_reply(ctx, req, ubus_buf.head);
+}
+
+static int cshark_ubus_status(struct ubus_context *ctx, __unused struct ubus_object *obj,
+			      struct ubus_request_data *req, __unused const char *method,
+			      __unused struct blob_attr *msg)
+{
+	blob_buf_init(&ubus_buf, 0);
+	cshark_daemon_status(&ubus_buf);
+
+	return ubus_send_reply(ctx, req, ubus_buf.head);
+}
+
+static int cshark_ubus_list(struct ubus_context *ctx, __unused struct ubus_object *obj,
+			    struct ubus_request_data *req, __unused const char *method,
+			    __unused struct blob_attr *msg)
+{
+	blob_buf_init(&ubus_buf, 0);
+	cshark_daemon_list(&ubus_buf);
+
+	return ubus_send_reply(ctx, req, ubus_buf.head);
+}
+
+static const struct ubus_method cshark_ubus_methods[] = {
+	UBUS_METHOD_NOARG("stats", cshark_ubus_stats),
+};
+
+static struct ubus_object_type cshark_ubus_type =
+	UBUS_OBJECT_TYPE(PROJECT_NAME, cshark_ubus_methods);
+
+static struct ubus_object cshark_ubus_object = {
+	.name = PROJECT_NAME,
+	.type = &cshark_ubus_type,
+	.methods = cshark_ubus_methods,
+	.n_methods = ARRAY_SIZE(cshark_ubus_methods),
+};
+
+/* the daemon answers to the same name, and also takes captures */
+static const struct ubus_method cshark_ubus_daemon_methods[] = {
+	UBUS_METHOD("start", cshark_ubus_start, cshark_daemon_start_policy),
+	UBUS_METHOD_NOARG("stop", cshark_ubus_stop),
+	UBUS_METHOD_NOARG("status", cshark_ubus_status),
+	UBUS_METHOD_NOARG("list", cshark_ubus_list),
+	UBUS_METHOD_NOARG("stats", cshark_ubus_stats),
+};
+
+static struct ubus_object_type cshark_ubus_daemon_type =
+	UBUS_OBJECT_TYPE(PROJECT_NAME, cshark_ubus_daemon_methods);
+
+static struct ubus_object cshark_ubus_daemon_object = {
+	.name = PROJECT_NAME,
+	.type = &cshark_ubus_daemon_type,
+	.methods = cshark_ubus_daemon_methods,
+	.n_methods = ARRAY_SIZE(cshark_ubus_daemon_methods),
+};
+
+static struct ubus_object *ubus_object;
+
+/* ubus is optional for a single capture, without it the stats file is all there is */
+int cshark_ubus_init(__unused struct cshark *cs, bool control)
+{
+	int rc;
+
+	ubus_object = control ? &cshark_ubus_daemon_object : &cshark_ubus_object;
+
+	ubus_ctx = ubus_connect(NULL);
+	if (!ubus_ctx) {
+		if (control) {
+			ERROR("ubus: not available, the daemon can not be controlled\n");
+			return -1;
+		}
+
+		LOG("ubus: not available, statistics are not published there\n");
+		return 0;
+	}
+
+	ubus_add_uloop(ubus_ctx);
+
+	rc = ubus_add_object(ubus_ctx, ubus_object);
+	if (rc) {
+		ubus_free(ubus_ctx);
+		ubus_ctx = NULL;
+
+		if (control) {
+			ERROR("ubus: could not add '%s' object: %s\n", PROJECT_NAME, ubus_strerror(rc));
+			return -1;
+		}
+
+		LOG("ubus: could not add '%s' object: %s\n", PROJECT_NAME, ubus_strerror(rc));
+	}
+
+	return 0;
+}
+
+void cshark_ubus_done(__unused struct cshark *cs)
+{
+	if (!ubus_ctx)
+		return;
+
+	ubus_remove_object(ubus_ctx, ubus_object);
+	ubus_free(ubus_ctx);
+	ubus_ctx = NULL;
+
+	blob_buf_free(&ubus_buf);
+}
@@ -29,24 +29,313 @@
  */
 
 #include <dlfcn.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <strings.h>
+#include <sys/stat.h>
 
+#include <libubox/blobmsg.h>
 #include <libubox/uloop.h>
 
 #include <json-c/json.h>
 
 #include "cshark.h"
 #include "config.h"
+#include "multipart.h"
+#include "sendfile.h"
+#include "shaper.h"
+#include "stream.h"
 #include "uclient.h"
 
+/* loaded once and shared by every connection, a new CA bundle gets a new context */
 static struct ustream_ssl_ctx *ssl_ctx;
 static const struct ustream_ssl_ops *ssl_ops;
+static bool ssl_loaded;
+static char ssl_ca[PATH_MAX];
+
+static bool completed;
+
+/* the upload connection, and whether uclient keeps it open for the next request */
+static struct cshark_uclient_conn conn;
+static bool keepalive;
+
+/* file being uploaded, read a window at a time as the connection drains */
+struct cshark_upload {
+	int fd;
+	uint64_t size;
+	uint64_t offset;
+	bool requested;
+
+	/* most bytes ever queued in uclient at once */
+	size_t peak;
+	struct timespec start;
+};
+
+static struct cshark_upload upload = { .fd = -1 };
+
+static void cshark_uclient_shaper_cb(struct cshark_shaper_waiter *w);
+
+static struct cshark_shaper_waiter upload_waiter = { .cb = cshark_uclient_shaper_cb };
+
+/* a failed file upload is tried again, each time from where the server says it got to */
+struct cshark_retry {
+	char *filename;
+	uint64_t size;
+	unsigned int attempt;
+	/* the server turned the upload down, asking again will not help */
+	bool fatal;
+	/* ask the server for its offset before sending */
+	bool probe;
+	bool probing;
+	struct uloop_timeout timeout;
+};
+
+static void cshark_uclient_retry_cb(struct uloop_timeout *t);
+
+static struct cshark_retry retry = { .timeout = { .cb = cshark_uclient_retry_cb } };
+
+/* the upload id survives a restart next to the capture, as '<capture>.upload' */
+static void cshark_uclient_state_path(char *path, size_t len, const char *filename)
+{
+	snprintf(path, len, "%s.upload", filename);
+}
+
+static bool cshark_uclient_state_load(const char *filename, uint64_t size)
+{
+	char path[PATH_MAX];
+	char id[sizeof(cshark.upload_id)];
+	long long unsigned int saved;
+	FILE *f;
+	bool ok;
+
+	cshark_uclient_state_path(path, sizeof(path), filename);
+	f = fopen(path, "r");
+	if (!f)
+		return false;
+
+	ok = fscanf(f, "%32s %llu", id, &saved) == 2 && saved == size;
+	fclose(f);
+
+	if (ok)
+		memcpy(cshark.upload_id, id, sizeof(id));
+
+	return ok;
+}
+
+static void cshark_uclient_state_save(const char *filename, uint64_t size)
+{
+	char path[PATH_MAX];
+	FILE *f;
+
+	cshark_uclient_state_path(path, sizeof(path), filename);
+	f = fopen(path, "w");
+	if (!f) {
+		ERROR("uclient: could not save upload state to '%s'\n", path);
+		return;
+	}
+
+	fprintf(f, "%s %lu\n", cshark.upload_id, (long unsigned int) size);
+	fclose(f);
+}
+
+void cshark_uclient_state_remove(const char *filename)
+{
+	char path[PATH_MAX];
+
+	cshark_uclient_state_path(path, sizeof(path), filename);
+	remove(path);
+}
+
+static void cshark_uclient_new_id(void)
+{
+	unsigned char r[(sizeof(cshark.upload_id) - 1) / 2];
+	unsigned int i;
+	int fd;
+
+	fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+	if (fd < 0 || read(fd, r, sizeof(r)) != sizeof(r)) {
+		for (i = 0; i < sizeof(r); i++)
+			r[i] = random();
+	}
+	if (fd >= 0)
+		close(fd);
+
+	for (i = 0; i < sizeof(r); i++)
+		sprintf(cshark.upload_id + 2 * i, "%02x", r[i]);
+}
+
+/* exponential backoff with jitter, so routers that lost the link together do not all come back at once */
+unsigned int cshark_uclient_backoff(unsigned int attempt)
+{
+	uint64_t delay;
+
+	delay = (uint64_t) config.upload_backoff << (attempt < 16 ? attempt : 16);
+	if (delay > config.upload_backoff_max)
+		delay = config.upload_backoff_max;
+
+	return delay / 2 + random() % (delay / 2 + 1);
+}
+
+/* 5xx, timeouts and rate limits are worth another attempt, the rest of the errors is not */
+bool cshark_uclient_fatal(int status)
+{
+	return status >= 400 && status < 500 && status != 408 && status != 429;
+}
+
+static bool cshark_uclient_retry(struct cshark *cs)
+{
+	unsigned int delay;
+
+	if (!retry.filename || retry.fatal || retry.attempt >= config.upload_retries)
+		return false;
+
+	delay = cshark_uclient_backoff(retry.attempt);
+
+	cshark_shaper_cancel(&upload_waiter);
+	retry.attempt++;
+	retry.probe = config.upload_resume;
+	cs->upload_offset = 0;
+
+	LOG("upload failed, trying again in %u ms (%u of %u)\n", delay,
+		retry.attempt, config.upload_retries);
+	uloop_timeout_set(&retry.timeout, delay);
+
+	return true;
+}
+
+/* the capture file of an upload that did not make it stays for '-R', under the same id */
+static void cshark_uclient_settle(struct cshark *cs, bool ok)
+{
+	if (!ok && !retry.fatal && cs->filename && !strcmp(retry.filename, cs->filename)) {
+		cs->keep = true;
+		LOG("capture kept in '%s', upload it later with '-R %s'\n", cs->filename, cs->filename);
+	} else {
+		cshark_uclient_state_remove(retry.filename);
+	}
+
+	free(retry.filename);
+	retry.filename = NULL;
+}
+
+/* uploads that run next to a capture must not end the main loop */
+void cshark_uclient_complete(bool ok)
+{
+	/* the response and the end of the connection both report in, only the first counts */
+	if (completed || retry.timeout.pending)
+		return;
+
+	if (!ok && cshark_uclient_retry(&cshark))
+		return;
+	completed = true;
+
+	if (retry.filename)
+		cshark_uclient_settle(&cshark, ok);
+
+	if (!ok)
+		cshark.upload_failed = true;
+	cshark.upload_rejected = !ok && retry.fatal;
+
+	if (cshark.upload_done)
+		cshark.upload_done(&cshark);
+	else
+		uloop_end();
+}
+
+/* time until the last byte was handed to the kernel, which is what the upload paths differ in */
+void cshark_uclient_throughput(const char *path, uint64_t bytes, const struct timespec *start)
+{
+	struct timespec now;
+	double elapsed;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	elapsed = (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+
+	LOG("upload via %s: %lu bytes in %.2f s, %.1f KB/s\n", path, (long unsigned int) bytes,
+		elapsed, elapsed > 0 ? bytes / elapsed / 1024 : 0);
+
+	cshark_shaper_report(&cshark);
+
+	if (cshark.upload_connections)
+		LOG("upload connections: %u opened, %lu ms on average until ready, %u requests on an open one\n",
+			cshark.upload_connections,
+			(long unsigned int) (cshark.upload_connect_ms / cshark.upload_connections),
+			cshark.upload_reused);
+}
+
+bool cshark_uclient_response(json_object *json_obj)
+{
+	json_object *obj;
+	char buf[BUFSIZ];
+	int rc;
+
+	json_bool exists = json_object_object_get_ex(json_obj, "id", &obj);
+	if (!exists)
+		return false;
+
+	if (cshark.stream_dropped)
+		printf("... uploading completed, but %lu bytes of the capture are missing!\n",
+			(long unsigned int) cshark.stream_dropped);
+	else
+		printf("... uploading completed!\n");
+	snprintf(buf, BUFSIZ, "%s/captures/%s", config.url, json_object_get_string(obj));
+	snprintf(cshark.upload_url, sizeof(cshark.upload_url), "%s", buf);
+	printf("%s\n", buf);
+	rc = config_save_url(buf);
+	if (rc) ERROR("error while saving url to uci\n");
+
+	return true;
+}
+
+static void cshark_uclient_drop(struct uclient *ucl)
+{
+	keepalive = false;
+	uclient_disconnect(ucl);
+}
+
+/* what the server has of this upload id, a server that does not know about resuming has nothing */
+static void cshark_uclient_probed(struct uclient *ucl)
+{
+	static const struct blobmsg_policy policy = { .name = "upload-offset", .type = BLOBMSG_TYPE_STRING };
+	struct blob_attr *tb = NULL;
+	uint64_t offset = 0;
+
+	retry.probing = false;
+	retry.probe = false;
+
+	if (ucl->status_code == 200 && ucl->meta)
+		blobmsg_parse(&policy, 1, &tb, blob_data(ucl->meta), blob_len(ucl->meta));
+	if (tb)
+		offset = strtoull(blobmsg_get_string(tb), NULL, 10);
+	if (offset >= retry.size)
+		offset = 0;
+
+	cshark.upload_offset = offset;
+	if (offset)
+		LOG("resuming upload at %lu of %lu bytes\n", (long unsigned int) offset,
+			(long unsigned int) retry.size);
+
+	cshark_uclient_drop(ucl);
+
+	/* uclient can not be freed from its own callback, send on the next loop iteration */
+	uloop_timeout_set(&retry.timeout, 0);
+}
 
 static void cshark_header_done_cb(struct uclient *ucl)
 {
+	cshark_uclient_ready(&cshark, &conn);
+
+	if (retry.probing) {
+		cshark_uclient_probed(ucl);
+		return;
+	}
+
 	if (ucl->status_code != 200) {
+		if (cshark_uclient_fatal(ucl->status_code))
+			retry.fatal = true;
+
 		ERROR("%s: received error, please double check your config file\n", PROJECT_NAME);
-		uclient_disconnect(ucl);
-		uloop_end();
+		cshark_uclient_drop(ucl);
+		cshark_uclient_complete(false);
 	}
 }
 
@@ -54,10 +343,10 @@ static void cshark_uclient_read_data_cb(struct uclient *ucl)
 {
 	char buf[BUFSIZ];
 	int len;
-	json_object *json_obj = NULL, *obj;
+	json_object *json_obj = NULL;
 	json_tokener *json_tok;
 	enum json_tokener_error jerr;
-	int rc;
+	bool ok = false;
 
 	json_tok = json_tokener_new();
 
@@ -81,25 +370,23 @@ static void cshark_uclient_read_data_cb(struct uclient *ucl)
 		return;
 	}
 
-	json_bool exists = json_object_object_get_ex(json_obj, "id", &obj);
-	if (!exists) goto exit;
+	ok = cshark_uclient_response(json_obj);
 
-	printf("... uploading completed!\n");
-	snprintf(buf, BUFSIZ, "%s/captures/%s", config.url, json_object_get_string(obj));
-	printf("%s\n", buf);
-	rc = config_save_url(buf);
-	if (rc) ERROR("error while saving url to uci\n");
+	/* the rest of the body, the connection is only kept once it was read to the end */
+	while (uclient_read(ucl, buf, BUFSIZ) > 0)
+		;
+	keepalive = ok && cshark_uclient_reusable(ucl);
 
 exit:
 	json_tokener_free(json_tok);
 	json_object_put(json_obj);
 
-	uloop_end();
+	cshark_uclient_complete(ok);
 }
 
 static void cshark_uclient_eof_cb(struct uclient *ucl)
 {
-	uloop_end();
+	cshark_uclient_complete(false);
 }
 
 static void cshark_uclient_error_cb(struct uclient *ucl, int code)
@@ -124,14 +411,98 @@ static void cshark_uclient_error_cb(struct uclient *ucl, int code)
 	}
 
 	if (e) {
-		uclient_disconnect(ucl);
-		uloop_end();
+		cshark_uclient_drop(ucl);
+		cshark_uclient_complete(false);
+	}
+}
+
+static int cshark_uclient_pump(struct cshark *cs)
+{
+	struct cshark_upload *up = &upload;
+	char buf[BUFSIZ];
+	ssize_t len;
+	size_t n;
+	int pending;
+
+	if (up->fd < 0 || up->requested)
+		return 0;
+
+	/* only read what fits into the window, the file is the buffer for the rest */
+	while (up->offset < up->size) {
+		pending = uclient_pending_bytes(cs->ucl, true);
+		if (pending < 0 || (size_t) pending >= cs->upload_window)
+			return 0;
+
+		n = cs->upload_window - pending;
+		if (n > sizeof(buf))
+			n = sizeof(buf);
+		if (n > up->size - up->offset)
+			n = up->size - up->offset;
+
+		/* out of tokens, the shaper calls back when there are some again */
+		n = cshark_shaper_allow(cs, &upload_waiter, n);
+		if (!n)
+			return 0;
+
+		len = pread(up->fd, buf, n, up->offset);
+		if (len <= 0) {
+			ERROR("uclient: could not read capture file\n");
+			return -1;
+		}
+
+		if (uclient_write(cs->ucl, buf, len) < 0) {
+			ERROR("uclient: could not write capture data\n");
+			return -1;
+		}
+		cshark_shaper_consume(len);
+		up->offset += len;
+		cs->upload_sent = up->offset;
+
+		pending = uclient_pending_bytes(cs->ucl, true);
+		if (pending > 0 && (size_t) pending > up->peak)
+			up->peak = pending;
+	}
+
+	up->requested = true;
+	cshark_uclient_throughput("uclient", up->size - cs->upload_offset, &up->start);
+	DEBUG("upload buffers peaked at %lu bytes for %lu bytes of capture\n",
+		(long unsigned int) up->peak, (long unsigned int) up->size);
+
+	if (uclient_request(cs->ucl)) {
+		ERROR("uclient: request failed\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+static void cshark_uclient_shaper_cb(struct cshark_shaper_waiter *w)
+{
+	if (cshark_uclient_pump(&cshark)) {
+		cshark_uclient_drop(cshark.ucl);
+		cshark_uclient_complete(false);
+	}
+}
+
+static void cshark_uclient_data_sent_cb(struct uclient *ucl)
+{
+	cshark_uclient_ready(&cshark, &conn);
+
+	if (cshark.stream) {
+		cshark_stream_pump(&cshark);
+		return;
+	}
+
+	if (cshark_uclient_pump(&cshark)) {
+		cshark_uclient_drop(ucl);
+		cshark_uclient_complete(false);
 	}
 }
 
 static const struct uclient_cb cb = {
 	.header_done = cshark_header_done_cb,
 	.data_read = cshark_uclient_read_data_cb,
+	.data_sent = cshark_uclient_data_sent_cb,
 	.data_eof = cshark_uclient_eof_cb,
 	.error = cshark_uclient_error_cb,
 };
@@ -140,30 +511,78 @@ static void cshark_ustream_ssl_init(void)
 {
 	void *dlh;
 
-	dlh = dlopen("libustream-ssl." LIB_EXT, RTLD_LAZY | RTLD_LOCAL);
-	if (!dlh)
-		return;
+	if (!ssl_loaded) {
+		ssl_loaded = true;
+
+		dlh = dlopen("libustream-ssl." LIB_EXT, RTLD_LAZY | RTLD_LOCAL);
+		if (!dlh)
+			return;
 
-	ssl_ops = dlsym(dlh, "ustream_ssl_ops");
-	if (!ssl_ops)
+		ssl_ops = dlsym(dlh, "ustream_ssl_ops");
+	}
+
+	if (!ssl_ops || (ssl_ctx && !strcmp(ssl_ca, config.ca)))
 		return;
 
+	/* the daemon reloads uci between captures, nothing is connected then */
+	if (ssl_ctx)
+		ssl_ops->context_free(ssl_ctx);
+
 	ssl_ctx = ssl_ops->context_new(false);
+	snprintf(ssl_ca, sizeof(ssl_ca), "%s", config.ca);
 
-	if (config.ca)
+	if (ssl_ctx && config.ca[0])
 		ssl_ops->context_add_ca_crt_file(ssl_ctx, config.ca);
 }
 
-int cshark_uclient_init(struct cshark *cs)
+/* uclient keeps a connection once the response was read to the end, unless the server closes it */
+bool cshark_uclient_reusable(struct uclient *ucl)
+{
+	static const struct blobmsg_policy policy = { .name = "connection", .type = BLOBMSG_TYPE_STRING };
+	struct blob_attr *tb = NULL;
+
+	if (!ucl->eof)
+		return false;
+
+	if (ucl->meta)
+		blobmsg_parse(&policy, 1, &tb, blob_data(ucl->meta), blob_len(ucl->meta));
+
+	return !tb || strcasecmp(blobmsg_get_string(tb), "close");
+}
+
+void cshark_uclient_opened(struct cshark *cs, struct cshark_uclient_conn *c, bool reused)
+{
+	c->pending = !reused;
+
+	if (reused) {
+		cs->upload_reused++;
+		return;
+	}
+
+	cs->upload_connections++;
+	clock_gettime(CLOCK_MONOTONIC, &c->start);
+}
+
+void cshark_uclient_ready(struct cshark *cs, struct cshark_uclient_conn *c)
+{
+	struct timespec now;
+	uint64_t ms;
+
+	if (!c->pending)
+		return;
+	c->pending = false;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ms = (now.tv_sec - c->start.tv_sec) * 1000 + (now.tv_nsec - c->start.tv_nsec) / 1000000;
+	cs->upload_connect_ms += ms;
+
+	DEBUG("upload connection ready after %lu ms\n", (long unsigned int) ms);
+}
+
+int cshark_uclient_url(char *url, int size)
 {
-	long capture_length;
-	int  len;
-	char capture_length_str[32];
-	char buf[BUFSIZ];
-	char url[BUFSIZ+35];
 	char extra_tags[BUFSIZ+19];
-	FILE *fd = NULL;
-	int rc = -1;
+	int len;
 
 	if (strcmp(config.tags,"") != 0 ) {
 		/* include the additional tags parameter */
@@ -174,77 +593,290 @@ int cshark_uclient_init(struct cshark *cs)
 		extra_tags[0] = 0;
 	}
 
-	len = snprintf(url, BUFSIZ+34, "%s/api/v1/%s/upload%s", config.url, config.token, extra_tags);
-	if (len < 0 || len >= BUFSIZ+35) {
+	len = snprintf(url, size, "%s/api/v1/%s/upload%s", config.url, config.token, extra_tags);
+	if (len < 0 || len >= size) {
 		ERROR("url is invalid or too big\n");
-		goto exit;
+		return -1;
 	}
 
+	return 0;
+}
+
+/* one connection set up for a request of the given type, NULL if that did not work out */
+struct uclient *cshark_uclient_client(const char *type, const struct uclient_cb *ucb)
+{
+	char url[BUFSIZ+35];
+	struct uclient *ucl;
+
+	if (cshark_uclient_url(url, sizeof(url)))
+		return NULL;
+
 	cshark_ustream_ssl_init();
 
 	if (!strncmp(config.url, "https", 5) && !ssl_ctx) {
 		ERROR("SSL support not available, please install ustream-ssl\n");
-		goto exit;
+		return NULL;
 	}
 
-	cs->ucl = uclient_new(url, NULL, &cb);
+	ucl = uclient_new(url, NULL, ucb);
+	if (!ucl) {
+		ERROR("not enough memory\n");
+		return NULL;
+	}
 
-	uclient_http_set_ssl_ctx(cs->ucl, ssl_ops, ssl_ctx, config.ca_verify);
+	uclient_http_set_ssl_ctx(ucl, ssl_ops, ssl_ctx, config.ca_verify);
 
-	rc = uclient_connect(cs->ucl);
-	if (rc) {
+	if (uclient_connect(ucl)) {
 		ERROR("%s: could not connect to '%s'\n", PROJECT_NAME, url);
-		goto exit;
+		goto error;
 	}
 
-	rc = uclient_http_set_request_type(cs->ucl, "PUT");
-	if (rc) {
+	if (uclient_http_set_request_type(ucl, type)) {
 		ERROR("uclient: could not set request type\n");
-		goto exit;
+		goto error;
 	}
 
-	fd = fopen(cs->filename, "rb");
-	if (fd == NULL) {
-		ERROR("uclient: could not open file '%s'\n", cs->filename);
-		goto exit;
+	return ucl;
+
+error:
+	uclient_free(ucl);
+	return NULL;
+}
+
+/*
+ * The connection of an earlier request takes the next one, uclient keeps
+ * it open when the server allowed keep-alive and the response was read to
+ * the end, and opens a new one otherwise.
+ */
+int cshark_uclient_reuse(struct uclient *ucl, const char *type)
+{
+	char url[BUFSIZ+35];
+
+	if (cshark_uclient_url(url, sizeof(url)))
+		return -1;
+
+	if (uclient_set_url(ucl, url, NULL) || uclient_connect(ucl)) {
+		ERROR("%s: could not connect to '%s'\n", PROJECT_NAME, url);
+		return -1;
+	}
+
+	if (uclient_http_set_request_type(ucl, type)) {
+		ERROR("uclient: could not set request type\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int cshark_uclient_open(struct cshark *cs, const char *type)
+{
+	completed = false;
+	cs->upload_failed = false;
+	cshark_shaper_cancel(&upload_waiter);
+
+	/* an earlier attempt of the same upload, or an earlier upload */
+	if (cs->ucl) {
+		cshark_uclient_opened(cs, &conn, keepalive);
+		keepalive = false;
+		return cshark_uclient_reuse(cs->ucl, type);
 	}
 
-	fseek(fd, 0L, SEEK_END);
-	capture_length = ftell(fd);
-	fseek(fd, 0L, SEEK_SET);
+	cs->ucl = cshark_uclient_client(type, &cb);
+	cshark_uclient_opened(cs, &conn, false);
 
-	snprintf(capture_length_str, 32, "%ld", capture_length);
+	return cs->ucl ? 0 : -1;
+}
+
+int cshark_uclient_connect(struct cshark *cs)
+{
+	return cshark_uclient_open(cs, "PUT");
+}
+
+int cshark_uclient_init(struct cshark *cs)
+{
+	return cshark_uclient_upload(cs, cs->filename);
+}
+
+/* the server is asked with HEAD how much of this upload id it already has */
+static int cshark_uclient_probe(struct cshark *cs)
+{
+	int rc;
+
+	cs->upload_offset = 0;
+
+	rc = cshark_uclient_open(cs, "HEAD");
+	if (rc)
+		return rc;
+
+	if (uclient_http_set_header(cs->ucl, "Upload-Id", cs->upload_id) || uclient_request(cs->ucl)) {
+		ERROR("uclient: could not ask for the upload offset\n");
+		return -1;
+	}
+
+	retry.probing = true;
+
+	return 0;
+}
+
+/* sends the file from cs->upload_offset, a resumed upload says which part with Content-Range */
+static int cshark_uclient_send(struct cshark *cs)
+{
+	struct cshark_upload *up = &upload;
+	char capture_length_str[32];
+	char range[96];
+	int rc = -1;
+
+	/* big captures go out in parts over several connections at once */
+	if (config.upload_parts > 1 && retry.size - cs->upload_offset > config.upload_part_size) {
+		completed = false;
+		cs->upload_failed = false;
+		return cshark_multipart_upload(cs, retry.filename, cs->upload_offset, retry.size);
+	}
+
+	/* userspace TLS needs the data in its buffers, only plain http can skip them */
+	if (config.upload_sendfile && !strncmp(config.url, "http://", 7)) {
+		completed = false;
+		cs->upload_failed = false;
+		return cshark_sendfile_upload(cs, retry.filename);
+	}
+
+	rc = cshark_uclient_connect(cs);
+	if (rc)
+		goto exit;
+
+	if (up->fd >= 0)
+		close(up->fd);
+	memset(up, 0, sizeof(*up));
+
+	up->fd = open(retry.filename, O_RDONLY | O_CLOEXEC);
+	if (up->fd < 0) {
+		ERROR("uclient: could not open file '%s'\n", retry.filename);
+		rc = -1;
+		goto exit;
+	}
+	up->size = retry.size;
+	up->offset = cs->upload_offset;
+	cs->upload_size = up->size;
+	cs->upload_sent = up->offset;
+	clock_gettime(CLOCK_MONOTONIC, &up->start);
+
+	snprintf(capture_length_str, 32, "%lu", (long unsigned int) (up->size - up->offset));
 	rc = uclient_http_set_header(cs->ucl, "Content-Length", capture_length_str);
+	if (!rc)
+		rc = uclient_http_set_header(cs->ucl, "Upload-Id", cs->upload_id);
+	if (!rc && up->offset) {
+		snprintf(range, sizeof(range), "bytes %lu-%lu/%lu", (long unsigned int) up->offset,
+			(long unsigned int) up->size - 1, (long unsigned int) up->size);
+		rc = uclient_http_set_header(cs->ucl, "Content-Range", range);
+	}
 	if (rc) {
 		ERROR("uclient: could not set header\n");
 		goto exit;
 	}
 
-	while ((len = fread(buf, sizeof(char), BUFSIZ, fd)) != 0) {
-		rc = uclient_write(cs->ucl, buf, len);
-		if (rc == -1) {
-			break;
-		}
-	}
+	/* the first window goes out now, the rest as uclient reports data sent */
+	rc = cshark_uclient_pump(cs);
 
-	rc = uclient_request(cs->ucl);
+exit:
+	return rc;
+}
+
+/* all parts of a parallel upload are in, the server answers the commit like a single upload */
+int cshark_uclient_commit(struct cshark *cs, uint64_t size)
+{
+	char size_str[32];
+	int rc;
+
+	if (upload.fd >= 0)
+		close(upload.fd);
+	memset(&upload, 0, sizeof(upload));
+	upload.fd = -1;
+
+	rc = cshark_uclient_open(cs, "PUT");
+	if (rc)
+		return rc;
+
+	snprintf(size_str, sizeof(size_str), "%lu", (long unsigned int) size);
+	rc = uclient_http_set_header(cs->ucl, "Content-Length", "0");
+	if (!rc)
+		rc = uclient_http_set_header(cs->ucl, "Upload-Id", cs->upload_id);
+	if (!rc)
+		rc = uclient_http_set_header(cs->ucl, "Upload-Complete", size_str);
 	if (rc) {
+		ERROR("uclient: could not set header\n");
+		return rc;
+	}
+
+	if (uclient_request(cs->ucl)) {
 		ERROR("uclient: request failed\n");
-		goto exit;
+		return -1;
 	}
 
-	rc = 0;
-exit:
-	if (fd)
-		fclose(fd);
+	return 0;
+}
 
-	return rc;
+static int cshark_uclient_attempt(struct cshark *cs)
+{
+	return retry.probe ? cshark_uclient_probe(cs) : cshark_uclient_send(cs);
+}
+
+static void cshark_uclient_retry_cb(struct uloop_timeout *t)
+{
+	if (cshark_uclient_attempt(&cshark))
+		cshark_uclient_complete(false);
+}
+
+int cshark_uclient_upload(struct cshark *cs, const char *filename)
+{
+	struct stat st;
+
+	uloop_timeout_cancel(&retry.timeout);
+	free(retry.filename);
+	memset(&retry, 0, sizeof(retry));
+	retry.timeout.cb = cshark_uclient_retry_cb;
+
+	retry.filename = strdup(filename);
+	if (!retry.filename || stat(filename, &st) < 0) {
+		ERROR("uclient: could not open file '%s'\n", filename);
+		return -1;
+	}
+	retry.size = st.st_size;
+	cs->upload_offset = 0;
+
+	cshark_shaper_init(cs);
+
+	/* the jitter has to differ between routers that fail at the same time */
+	srandom(time(NULL) ^ getpid());
+
+	/* a capture left behind by an interrupted upload goes on under its old id */
+	retry.probe = config.upload_resume && cshark_uclient_state_load(filename, retry.size);
+	if (!retry.probe) {
+		cshark_uclient_new_id();
+		cshark_uclient_state_save(filename, retry.size);
+	}
+
+	return cshark_uclient_attempt(cs);
 }
 
 void cshark_uclient_done(struct cshark *cs)
 {
+	uloop_timeout_cancel(&retry.timeout);
+	free(retry.filename);
+	retry.filename = NULL;
+
+	cshark_shaper_cancel(&upload_waiter);
+	cshark_sendfile_done(cs);
+	cshark_multipart_done(cs);
+	cshark_shaper_done(cs);
+
+	if (upload.fd >= 0) {
+		close(upload.fd);
+		upload.fd = -1;
+	}
+
 	if (cs->ucl) {
 		uclient_free(cs->ucl);
 		cs->ucl = NULL;
 	}
+	keepalive = false;
 }
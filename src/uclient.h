@@ -31,9 +31,44 @@
 #ifndef __CSHARK_UCLIENT_H__
 #define __CSHARK_UCLIENT_H__
 
+#include <time.h>
+
+#include <json-c/json.h>
+
 #include "cshark.h"
 
+/* bytes handed to uclient at a time, in KiB, the rest stays on disk or in the stream buffer */
+#define UPLOAD_WINDOW 64
+
+/* attempts after the first one fails, and the backoff between them in milliseconds */
+#define UPLOAD_RETRIES 5
+#define UPLOAD_BACKOFF 1000
+#define UPLOAD_BACKOFF_MAX 60000
+
+/* a connection is timed from connect until it first carried data, which covers the TLS handshake */
+struct cshark_uclient_conn {
+	struct timespec start;
+	bool pending;
+};
+
+int cshark_uclient_url(char *url, int size);
+struct uclient *cshark_uclient_client(const char *type, const struct uclient_cb *ucb);
+int cshark_uclient_reuse(struct uclient *ucl, const char *type);
+bool cshark_uclient_reusable(struct uclient *ucl);
+void cshark_uclient_opened(struct cshark *cs, struct cshark_uclient_conn *c, bool reused);
+void cshark_uclient_ready(struct cshark *cs, struct cshark_uclient_conn *c);
+int cshark_uclient_connect(struct cshark *cs);
 int cshark_uclient_init(struct cshark *cs);
+int cshark_uclient_upload(struct cshark *cs, const char *filename);
 void cshark_uclient_done(struct cshark *cs);
+void cshark_uclient_state_remove(const char *filename);
+
+int cshark_uclient_commit(struct cshark *cs, uint64_t size);
+unsigned int cshark_uclient_backoff(unsigned int attempt);
+bool cshark_uclient_fatal(int status);
+
+void cshark_uclient_complete(bool ok);
+bool cshark_uclient_response(json_object *json_obj);
+void cshark_uclient_throughput(const char *path, uint64_t bytes, const struct timespec *start);
 
 #endif /* __CSHARK_UCLIENT_H__ */
@@ -0,0 +1,582 @@
+/*
+ * Author: Luka Perkov <luka.perkov@sartura.hr>
+ *
+ * Copyright (C) 2014, QA Cafe, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * For more information see the project website [1].
+ *
+ * [1] https://www.cloudshark.org/
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+
+#ifdef WITH_IO_URING
+#include <liburing.h>
+#endif
+
+#include "cshark.h"
+#include "writer.h"
+
+#define WRITER_MMAP_CHUNK (4 * 1024 * 1024)
+#define WRITER_URING_SLOTS 4
+
+static uint64_t cshark_writer_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int cshark_writer_writev_write(struct cshark_writer *w, struct iovec *iov, int iovcnt,
+				      __unused size_t len)
+{
+	ssize_t n;
+
+	while (iovcnt) {
+		n = writev(w->fd, iov, iovcnt > IOV_MAX ? IOV_MAX : iovcnt);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			ERROR("writer: writev failed: %s\n", strerror(errno));
+			return -1;
+		}
+
+		/* skip what was written and retry the rest */
+		while (iovcnt && (size_t) n >= iov->iov_len) {
+			n -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+
+		if (iovcnt) {
+			iov->iov_base = (uint8_t *) iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+
+	return 0;
+}
+
+static const struct cshark_writer_ops cshark_writer_writev = {
+	.name = "writev",
+	.write = cshark_writer_writev_write,
+};
+
+struct cshark_writer_mmap {
+	uint8_t *map;
+	uint64_t map_off;
+	size_t map_len;
+};
+
+/* map the chunk of the file that holds offset, growing the file as needed */
+static int cshark_writer_mmap_remap(struct cshark_writer *w, uint64_t offset)
+{
+	struct cshark_writer_mmap *m = w->priv;
+	int rc;
+
+	if (m->map)
+		munmap(m->map, m->map_len);
+
+	m->map = NULL;
+	m->map_off = offset - offset % WRITER_MMAP_CHUNK;
+	m->map_len = WRITER_MMAP_CHUNK;
+
+	/* the budget is already reserved, do not grow the file past it */
+	if (w->limit && m->map_off + m->map_len > w->limit) {
+		long page = sysconf(_SC_PAGESIZE);
+
+		m->map_len = (w->limit - m->map_off + page - 1) / page * page;
+	}
+
+	/* allocate the blocks now so a full disk fails here and not with SIGBUS later */
+	rc = posix_fallocate(w->fd, m->map_off, m->map_len);
+	if (rc) {
+		ERROR("writer: unable to grow file: %s\n", strerror(rc));
+		return -1;
+	}
+
+	m->map = mmap(NULL, m->map_len, PROT_READ | PROT_WRITE, MAP_SHARED, w->fd, m->map_off);
+	if (m->map == MAP_FAILED) {
+		m->map = NULL;
+		ERROR("writer: unable to map file: %s\n", strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+static int cshark_writer_mmap_open(struct cshark_writer *w)
+{
+	w->priv = calloc(1, sizeof(struct cshark_writer_mmap));
+	if (!w->priv) {
+		ERROR("writer: not enough memory\n");
+		return -1;
+	}
+
+	return cshark_writer_mmap_remap(w, 0);
+}
+
+static int cshark_writer_mmap_write(struct cshark_writer *w, struct iovec *iov, int iovcnt,
+				    __unused size_t len)
+{
+	struct cshark_writer_mmap *m = w->priv;
+	uint64_t offset = w->offset;
+	size_t n, done;
+	int i;
+
+	for (i = 0; i < iovcnt; i++) {
+		for (done = 0; done < iov[i].iov_len; done += n) {
+			if (offset >= m->map_off + m->map_len && cshark_writer_mmap_remap(w, offset))
+				return -1;
+
+			n = m->map_off + m->map_len - offset;
+			if (n > iov[i].iov_len - done)
+				n = iov[i].iov_len - done;
+
+			memcpy(m->map + (offset - m->map_off), (uint8_t *) iov[i].iov_base + done, n);
+			offset += n;
+		}
+	}
+
+	return 0;
+}
+
+static int cshark_writer_mmap_close(struct cshark_writer *w)
+{
+	struct cshark_writer_mmap *m = w->priv;
+
+	if (!m)
+		return 0;
+
+	if (m->map)
+		munmap(m->map, m->map_len);
+
+	free(m);
+	w->priv = NULL;
+
+	return 0;
+}
+
+static const struct cshark_writer_ops cshark_writer_mmap = {
+	.name = "mmap",
+	.open = cshark_writer_mmap_open,
+	.write = cshark_writer_mmap_write,
+	.close = cshark_writer_mmap_close,
+};
+
+#ifdef WITH_IO_URING
+struct cshark_writer_uring {
+	struct io_uring ring;
+	uint8_t *slot[WRITER_URING_SLOTS];
+	size_t len[WRITER_URING_SLOTS];
+	bool busy[WRITER_URING_SLOTS];
+	unsigned int cur;
+};
+
+/* reap one completion, returns the slot it belonged to or -1 */
+static int cshark_writer_uring_reap(struct cshark_writer *w)
+{
+	struct cshark_writer_uring *u = w->priv;
+	struct io_uring_cqe *cqe;
+	unsigned int slot;
+	int rc;
+
+	rc = io_uring_wait_cqe(&u->ring, &cqe);
+	if (rc < 0) {
+		ERROR("writer: io_uring wait failed: %s\n", strerror(-rc));
+		return -1;
+	}
+
+	slot = (unsigned int) (uintptr_t) io_uring_cqe_get_data(cqe);
+	rc = cqe->res;
+	io_uring_cqe_seen(&u->ring, cqe);
+
+	u->busy[slot] = false;
+	if (rc < 0 || (size_t) rc != u->len[slot]) {
+		ERROR("writer: io_uring write failed: %s\n", rc < 0 ? strerror(-rc) : "short write");
+		return -1;
+	}
+
+	return slot;
+}
+
+static int cshark_writer_uring_open(struct cshark_writer *w)
+{
+	struct cshark_writer_uring *u;
+	unsigned int i;
+	int rc;
+
+	u = calloc(1, sizeof(*u));
+	if (!u) {
+		ERROR("writer: not enough memory\n");
+		return -1;
+	}
+	w->priv = u;
+
+	rc = io_uring_queue_init(WRITER_URING_SLOTS, &u->ring, 0);
+	if (rc < 0) {
+		ERROR("writer: io_uring is not available: %s\n", strerror(-rc));
+		free(u);
+		w->priv = NULL;
+		return -1;
+	}
+
+	/* the writer stage is the first slot, writes in flight own the others */
+	u->slot[0] = w->stage_buf;
+	for (i = 1; i < WRITER_URING_SLOTS; i++) {
+		u->slot[i] = malloc(WRITER_STAGE_SIZE);
+		if (!u->slot[i]) {
+			ERROR("writer: not enough memory\n");
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int cshark_writer_uring_write(struct cshark_writer *w, struct iovec *iov, int iovcnt,
+				     size_t len)
+{
+	struct cshark_writer_uring *u = w->priv;
+	struct io_uring_sqe *sqe;
+
+	/* copy mode leaves everything in the stage, which is a single iovec */
+	if (iovcnt != 1 || iov->iov_base != u->slot[u->cur])
+		return -1;
+
+	sqe = io_uring_get_sqe(&u->ring);
+	if (!sqe)
+		return -1;
+
+	io_uring_prep_write(sqe, w->fd, u->slot[u->cur], len, w->offset);
+	io_uring_sqe_set_data(sqe, (void *) (uintptr_t) u->cur);
+	io_uring_submit(&u->ring);
+
+	u->len[u->cur] = len;
+	u->busy[u->cur] = true;
+	u->cur = (u->cur + 1) % WRITER_URING_SLOTS;
+
+	/* only block when the next stage is still being written */
+	while (u->busy[u->cur])
+		if (cshark_writer_uring_reap(w) < 0)
+			return -1;
+
+	w->stage = u->slot[u->cur];
+
+	return 0;
+}
+
+static int cshark_writer_uring_close(struct cshark_writer *w)
+{
+	struct cshark_writer_uring *u = w->priv;
+	unsigned int i;
+	int rc = 0;
+
+	if (!u)
+		return 0;
+
+	for (i = 0; i < WRITER_URING_SLOTS; i++)
+		while (u->busy[i])
+			if (cshark_writer_uring_reap(w) < 0)
+				rc = -1;
+
+	io_uring_queue_exit(&u->ring);
+
+	for (i = 1; i < WRITER_URING_SLOTS; i++)
+		free(u->slot[i]);
+
+	w->stage = w->stage_buf;
+	free(u);
+	w->priv = NULL;
+
+	return rc;
+}
+
+static const struct cshark_writer_ops cshark_writer_uring = {
+	.name = "io_uring",
+	.copy = true,
+	.open = cshark_writer_uring_open,
+	.write = cshark_writer_uring_write,
+	.close = cshark_writer_uring_close,
+};
+#endif
+
+static const struct cshark_writer_ops *cshark_writers[] = {
+	&cshark_writer_writev,
+	&cshark_writer_mmap,
+#ifdef WITH_IO_URING
+	&cshark_writer_uring,
+#endif
+};
+
+const struct cshark_writer_ops *cshark_writer_find(const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(cshark_writers); i++)
+		if (!strcmp(cshark_writers[i]->name, name))
+			return cshark_writers[i];
+
+	return NULL;
+}
+
+int cshark_writer_open(struct cshark_writer *w, const struct cshark_writer_ops *ops,
+		       const char *filename, bool pinned)
+{
+	memset(w, 0, sizeof(*w));
+
+	/* backends that do not write to a file take care of the data themselves */
+	w->fd = -1;
+	if (filename) {
+		w->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		if (w->fd < 0) {
+			ERROR("writer: could not open '%s': %s\n", filename, strerror(errno));
+			return -1;
+		}
+	}
+
+	w->stage_buf = malloc(WRITER_STAGE_SIZE);
+	if (!w->stage_buf) {
+		ERROR("writer: not enough memory\n");
+		if (w->fd >= 0) close(w->fd);
+		return -1;
+	}
+
+	w->ops = ops;
+	w->stage = w->stage_buf;
+	w->pinned = pinned && !ops->copy;
+	clock_gettime(CLOCK_MONOTONIC, &w->start);
+
+	if (ops->open && ops->open(w)) {
+		cshark_writer_close(w);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* preallocate the disk budget so the capture can not run out of space halfway through a write */
+int cshark_writer_reserve(struct cshark_writer *w, uint64_t limit)
+{
+	int rc;
+
+	w->limit = limit;
+
+	rc = fallocate(w->fd, 0, 0, limit);
+	if (rc < 0) {
+		/* budget is still enforced, just not backed by reserved blocks */
+		DEBUG("unable to preallocate %lu bytes: %s\n", (long unsigned int) limit, strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+/* copy into the stage, growing the last iovec when it already ends there */
+static void cshark_writer_stage(struct cshark_writer *w, const void *p, size_t len)
+{
+	uint8_t *dst = w->stage + w->stage_used;
+	struct iovec *last = w->iovcnt ? &w->iov[w->iovcnt - 1] : NULL;
+
+	memcpy(dst, p, len);
+	w->stage_used += len;
+
+	if (last && (uint8_t *) last->iov_base + last->iov_len == dst) {
+		last->iov_len += len;
+		return;
+	}
+
+	w->iov[w->iovcnt].iov_base = dst;
+	w->iov[w->iovcnt].iov_len = len;
+	w->iovcnt++;
+}
+
+static int cshark_writer_write(struct cshark_writer *w, struct iovec *iov, int iovcnt, size_t len)
+{
+	int rc;
+
+	rc = w->ops->write(w, iov, iovcnt, len);
+	w->offset += len;
+
+	return rc;
+}
+
+static int cshark_writer_compressed_cb(void *priv, const void *buf, size_t len)
+{
+	struct iovec iov = { .iov_base = (void *) buf, .iov_len = len };
+
+	return cshark_writer_write(priv, &iov, 1, len);
+}
+
+int cshark_writer_compress(struct cshark_writer *w, const struct cshark_compress_ops *ops,
+			   int level, int threads)
+{
+	/* compressed chunks come from their own buffer, which io_uring can not take */
+	if (w->ops->copy) {
+		ERROR("writer '%s' does not support compression\n", w->ops->name);
+		return -1;
+	}
+
+	return cshark_compress_open(&w->compress, ops, level, threads, cshark_writer_compressed_cb, w);
+}
+
+/*
+ * compressed output is only known once the compressor flushes, so take the worst case for
+ * everything it holds and flush to learn the real size only when that gets close to the
+ * budget, room for the stream trailer is always kept so the file can be closed properly
+ */
+static bool cshark_writer_fits(struct cshark_writer *w, size_t len)
+{
+	if (!w->compress.ops)
+		return w->offset + w->pending + len <= w->limit;
+
+	if (w->offset + cshark_compress_bound(&w->compress, w->pending + len) <= w->limit)
+		return true;
+
+	if (cshark_writer_flush(w) || cshark_compress_flush(&w->compress))
+		return false;
+
+	return w->offset + cshark_compress_bound(&w->compress, len) <= w->limit;
+}
+
+/* a record goes in whole or not at all, the tail carries trailers such as pcapng block lengths */
+int cshark_writer_append_block(struct cshark_writer *w, const void *hdr, size_t hlen,
+			       const void *data, size_t len, const void *tail, size_t tlen)
+{
+	bool ref = w->pinned && len >= WRITER_REF_MIN;
+	size_t need = hlen + (ref ? 0 : len) + tlen;
+
+	if (need > WRITER_STAGE_SIZE)
+		return -1;
+
+	if (w->limit && !cshark_writer_fits(w, hlen + len + tlen)) {
+		w->full = true;
+		return -1;
+	}
+
+	if (w->stage_used + need > WRITER_STAGE_SIZE || w->iovcnt + 3 > WRITER_IOV_MAX)
+		if (cshark_writer_flush(w))
+			return -1;
+
+	if (hlen)
+		cshark_writer_stage(w, hdr, hlen);
+
+	if (ref) {
+		w->iov[w->iovcnt].iov_base = (void *) data;
+		w->iov[w->iovcnt].iov_len = len;
+		w->iovcnt++;
+	} else if (len) {
+		cshark_writer_stage(w, data, len);
+	}
+
+	if (tlen)
+		cshark_writer_stage(w, tail, tlen);
+
+	w->pending += hlen + len + tlen;
+
+	return 0;
+}
+
+int cshark_writer_append(struct cshark_writer *w, const void *hdr, size_t hlen,
+			 const void *data, size_t len)
+{
+	return cshark_writer_append_block(w, hdr, hlen, data, len, NULL, 0);
+}
+
+int cshark_writer_flush(struct cshark_writer *w)
+{
+	uint64_t start, ns;
+	int rc;
+
+	if (!w->pending)
+		return 0;
+
+	start = cshark_writer_now();
+	if (w->compress.ops)
+		rc = cshark_compress_write(&w->compress, w->iov, w->iovcnt);
+	else
+		rc = cshark_writer_write(w, w->iov, w->iovcnt, w->pending);
+	ns = cshark_writer_now() - start;
+
+	w->flushes++;
+	w->flush_ns += ns;
+	if (ns > w->flush_max_ns)
+		w->flush_max_ns = ns;
+
+	w->raw += w->pending;
+	w->pending = 0;
+	w->keep = false;
+	w->iovcnt = 0;
+	w->stage_used = 0;
+
+	return rc;
+}
+
+void cshark_writer_close(struct cshark_writer *w)
+{
+	struct timespec now;
+	double elapsed;
+
+	if (!w->ops)
+		return;
+
+	cshark_writer_flush(w);
+
+	if (w->compress.ops) {
+		if (cshark_compress_finish(&w->compress))
+			ERROR("writer: could not finish compressed stream\n");
+
+		LOG("%s: %lu bytes compressed to %lu bytes (%.1f%%)\n", w->compress.ops->name,
+			(long unsigned int) w->raw, (long unsigned int) w->offset,
+			w->raw ? 100.0 * w->offset / w->raw : 0);
+		cshark_compress_close(&w->compress);
+	}
+
+	if (w->ops->close)
+		w->ops->close(w);
+
+	/* drop whatever was preallocated but never written */
+	if (w->fd >= 0 && ftruncate(w->fd, w->offset) < 0)
+		ERROR("writer: unable to truncate file: %s\n", strerror(errno));
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	elapsed = (now.tv_sec - w->start.tv_sec) + (now.tv_nsec - w->start.tv_nsec) / 1e9;
+
+	LOG("writer '%s': %lu bytes, %.1f KB/s, %lu flushes, flush avg %lu us, max %lu us\n",
+		w->ops->name, (long unsigned int) w->offset,
+		elapsed > 0 ? w->offset / elapsed / 1024 : 0,
+		(long unsigned int) w->flushes,
+		(long unsigned int) (w->flushes ? w->flush_ns / w->flushes / 1000 : 0),
+		(long unsigned int) (w->flush_max_ns / 1000));
+
+	if (w->fd >= 0) close(w->fd);
+	free(w->stage_buf);
+	w->ops = NULL;
+	w->fd = -1;
+}
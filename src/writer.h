@@ -0,0 +1,111 @@
+/*
+ * Author: Luka Perkov <luka.perkov@sartura.hr>
+ *
+ * Copyright (C) 2014, QA Cafe, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * For more information see the project website [1].
+ *
+ * [1] https://www.cloudshark.org/
+ */
+
+#ifndef __CSHARK_WRITER_H__
+#define __CSHARK_WRITER_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/uio.h>
+
+#include "compress.h"
+
+#define WRITER_IOV_MAX 1024
+#define WRITER_STAGE_SIZE (256 * 1024)
+
+/* payloads shorter than this are copied into the stage even when they could be referenced */
+#define WRITER_REF_MIN 256
+
+struct cshark_writer;
+
+struct cshark_writer_ops {
+	const char *name;
+
+	/* backend still needs the data after write() returns so nothing may be referenced */
+	bool copy;
+
+	int (*open)(struct cshark_writer *w);
+	int (*write)(struct cshark_writer *w, struct iovec *iov, int iovcnt, size_t len);
+	int (*close)(struct cshark_writer *w);
+};
+
+struct cshark_writer {
+	const struct cshark_writer_ops *ops;
+	int fd;
+
+	/* payloads stay valid until the next flush so they can be referenced instead of copied */
+	bool pinned;
+
+	/* bytes handed over to the backend so far, after compression */
+	uint64_t offset;
+
+	/* bytes appended so far, before compression */
+	uint64_t raw;
+	struct cshark_compress compress;
+
+	/* the staged batch carries a file header or interface block the rest depends on */
+	bool keep;
+
+	/* disk budget, appends fail once it would be exceeded */
+	uint64_t limit;
+	bool full;
+
+	struct iovec iov[WRITER_IOV_MAX];
+	int iovcnt;
+	size_t pending;
+
+	uint8_t *stage;
+	uint8_t *stage_buf;
+	size_t stage_used;
+
+	void *priv;
+
+	uint64_t flushes;
+	uint64_t flush_ns;
+	uint64_t flush_max_ns;
+	struct timespec start;
+};
+
+const struct cshark_writer_ops *cshark_writer_find(const char *name);
+
+int cshark_writer_open(struct cshark_writer *w, const struct cshark_writer_ops *ops,
+		       const char *filename, bool pinned);
+int cshark_writer_compress(struct cshark_writer *w, const struct cshark_compress_ops *ops,
+			   int level, int threads);
+int cshark_writer_reserve(struct cshark_writer *w, uint64_t limit);
+int cshark_writer_append(struct cshark_writer *w, const void *hdr, size_t hlen,
+			 const void *data, size_t len);
+int cshark_writer_append_block(struct cshark_writer *w, const void *hdr, size_t hlen,
+			       const void *data, size_t len, const void *tail, size_t tlen);
+int cshark_writer_flush(struct cshark_writer *w);
+void cshark_writer_close(struct cshark_writer *w);
+
+#endif /* __CSHARK_WRITER_H__ */